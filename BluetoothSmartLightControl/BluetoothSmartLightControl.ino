@@ -1,5 +1,8 @@
 #include <BluetoothSerial.h> // For ESP32 Bluetooth Classic
 #include <AiEsp32RotaryEncoder.h>
+// LightProtocol is in ../libraries, shared with ESP32_Smart_Dimmer. The IDE finds it when the sketchbook
+// location is this repository's root (or with arduino-cli compile --libraries ../libraries).
+#include <LightProtocol.h>
 
 #if !defined(CONFIG_BT_ENABLED) || !defined(CONFIG_BLUEDROID_ENABLED)
 #error "Bluetooth is not enabled! Please run `make menuconfig` to enable it"
@@ -62,27 +65,15 @@ const unsigned long longPressActionInterval = 50; // Call action every 50ms
 
 unsigned long lastButtonPressTime[5]; // Array to store last press time for each button
 
-// Data payload to send to the light.
-const uint8_t BT_PREFIX[] = { 0x01, 0xfe, 0x00, 0x00, 0x51, 0x81, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0d };
-const uint8_t BT_SUFFIX[] = { 0x0e, 0x00 };
-
-const uint8_t LIGHT_ON = 0X01;
-const uint8_t LIGHT_OFF = 0X02;
-const uint8_t ON_OFF_DATA_PREFIX[] = { 0x07, 0x01, 0x03, 0x01 }; // follow with on/off value
-
+// Value ranges for the light commands (packet layout lives in LightProtocol.h)
 const uint8_t MIN_INTENSITY = 0X01;
 const uint8_t MAX_INTENSITY = 0X10;
-const uint8_t INTENSITY_DATA_PREFIX[] = { 0x07, 0x01, 0x03, 0x02 }; // follow with intensity
 
 const uint8_t MIN_WARMNESS = 0X00;
 const uint8_t MAX_WARMNESS = 0XFA;
-const uint8_t WARMNESS_DATA_PREFIX[] = { 0x07, 0x01, 0x03, 0x03 }; // follow with warmness
-
-const uint8_t RGB_DATA_PREFIX[] = { 0x0A, 0x02, 0x03, 0x0C }; // follow with I R G B
 
 const uint8_t MIN_FAN_SPEED = 0;
 const uint8_t MAX_FAN_SPEED = 3;
-const uint8_t FAN_SPEED_DATA_PREFIX[] = { 0x07, 0x0e, 0x03, 0x03 }; // follow with fan speed (0, 1, 2 or 3)
 
 const int BT_LIGHT_ON_OFF_COMMAND = 0;
 const int BT_INTENSITY_COMMAND = 1;
@@ -90,69 +81,48 @@ const int BT_WARMNESS_COMMAND = 2;
 const int BT_RGB_COMMAND = 3;
 const int BT_FAN_SPEED_COMMAND = 4;
 
-const uint8_t* BT_COMMANDS[] = { ON_OFF_DATA_PREFIX, INTENSITY_DATA_PREFIX, WARMNESS_DATA_PREFIX, RGB_DATA_PREFIX, FAN_SPEED_DATA_PREFIX };
-
 long lastRotaryPosition = 0;
 
 AiEsp32RotaryEncoder rotaryEncoder = AiEsp32RotaryEncoder(ROTARY_ENCODER_CLK_PIN, ROTARY_ENCODER_DT_PIN, ROTARY_ENCODER_SW_PIN, ROTARY_ENCODER_STEPS_PER_NOTCH);
 
-void sendBtCommand(int command) {
-
-    const int MAX_PACKET_SIZE = 128;
-    uint8_t packetBuffer[MAX_PACKET_SIZE];
-    
-    // Use a variable to track the final size of the packet
-    size_t packetSize = 0;
-    if (command < 0 || command >= 5) {
-        Serial.printf("invalid command %d", command);
-        return;
-    }
-
-    // Serial.println("sending known BT command");
-    // 1. Copy the 17-byte prefix into the buffer
-    memcpy(packetBuffer, BT_PREFIX, sizeof(BT_PREFIX));
-    packetSize += sizeof(BT_PREFIX);
-
-    // 2. Copy the command into the buffer
-    int commandSize = sizeof(BT_COMMANDS[command]);
-    memcpy(&packetBuffer[packetSize], BT_COMMANDS[command], commandSize);
-    packetSize += commandSize;
+template <typename Packet>
+void writePacket(const Packet& packet) {
+    // Write the entire composed packet in a single, efficient call
+    SerialBT.write(packet.data(), packet.size());
+    SerialBT.flush();
+}
 
-    // 3. Append the variable payload byte(s) to the buffer
+void sendBtCommand(int command) {
     switch(command) {
-        case BT_LIGHT_ON_OFF_COMMAND:
-            packetBuffer[packetSize++] = (lightOn ? LIGHT_ON : LIGHT_OFF);
+        case BT_LIGHT_ON_OFF_COMMAND: {
+            const uint8_t payload[] = { lightOn ? LightProtocol::LIGHT_ON : LightProtocol::LIGHT_OFF };
+            writePacket(LightProtocol::OnOff::encode(payload));
             break;
-
-        case BT_INTENSITY_COMMAND:
-            packetBuffer[packetSize++] = (uint8_t)constrain(currentBrightness, MIN_INTENSITY, MAX_INTENSITY);
+        }
+        case BT_INTENSITY_COMMAND: {
+            const uint8_t payload[] = { (uint8_t)constrain(currentBrightness, MIN_INTENSITY, MAX_INTENSITY) };
+            writePacket(LightProtocol::Intensity::encode(payload));
             break;
-
-        case BT_WARMNESS_COMMAND:
-            packetBuffer[packetSize++] = (uint8_t)constrain(currentLightWarmness, MIN_WARMNESS, MAX_WARMNESS);
+        }
+        case BT_WARMNESS_COMMAND: {
+            const uint8_t payload[] = { (uint8_t)constrain(currentLightWarmness, MIN_WARMNESS, MAX_WARMNESS) };
+            writePacket(LightProtocol::Warmness::encode(payload));
             break;
-
-        case BT_RGB_COMMAND:
-            // This is the multi-byte case
-            packetBuffer[packetSize++] = (uint8_t)currentBrightness;
-            packetBuffer[packetSize++] = (uint8_t)ringR;
-            packetBuffer[packetSize++] = (uint8_t)ringG;
-            packetBuffer[packetSize++] = (uint8_t)ringB;
-            packetBuffer[6] = 0x1c;
+        }
+        case BT_RGB_COMMAND: {
+            const uint8_t payload[] = { (uint8_t)currentBrightness, (uint8_t)ringR, (uint8_t)ringG, (uint8_t)ringB };
+            writePacket(LightProtocol::Rgb::encode(payload));
             break;
-
-        case BT_FAN_SPEED_COMMAND:
-            packetBuffer[packetSize++] = (uint8_t)constrain(currentFanSpeed, MIN_FAN_SPEED, MAX_FAN_SPEED);
+        }
+        case BT_FAN_SPEED_COMMAND: {
+            const uint8_t payload[] = { (uint8_t)constrain(currentFanSpeed, MIN_FAN_SPEED, MAX_FAN_SPEED) };
+            writePacket(LightProtocol::FanSpeed::encode(payload));
+            break;
+        }
+        default:
+            Serial.printf("invalid command %d", command);
             break;
     }
-    
-    // 4. Append the final suffix byte
-    memcpy(&packetBuffer[packetSize], BT_SUFFIX, sizeof(BT_SUFFIX));
-    packetSize += sizeof(BT_SUFFIX);
-    
-    // 5. Write the entire composed packet in a single, efficient call
-    SerialBT.write(packetBuffer, packetSize);
-    SerialBT.flush();
 }
 
 // Function to handle button presses more generically
@@ -53,6 +53,8 @@ function updateLightModeDisplay() {
 let currentlySendingControlData = false;
 let newControlDataWaiting = false;
 let waitingControlDataUrl = null;
+// /control jobs of this page not reported by /events yet
+const controlJobsInFlight = new Set();
 const lightModeInput = getById("lightMode");
 const fanSpeedInput = getById("fanSpeed");
 // Function to send control data (reads from updated elements)
@@ -61,11 +63,13 @@ function sendControlData() {
     const mac = deviceControlDiv.dataset.mac;
     const device = registeredDevices[mac];
     let url = "/control?address=" + mac + "&";
+    const fields = [[CONTROL_FIELD.mode, CONTROL_MODES[lightMode]]];
 
     if (lightMode === "main") {
         const intensity = intensityValueInput.value; // 1-16
         const warmness = 255 - warmnessValueInput.value;   // 0-255. it's reversed for some reason, lowest value is highest temprature
         url += `mode=${lightMode}&bright=${intensity}&warm=${warmness}`;
+        fields.push([CONTROL_FIELD.bright, intensity], [CONTROL_FIELD.warm, warmness]);
         device.light_mode = "main"
         device.main_brightness = intensity
         device.main_warmness = warmness
@@ -74,6 +78,7 @@ function sendControlData() {
         const rgbHue = rgbHueInput.value;     // 0-100
         const rgbValue = rgbValueInput.value; // 0-255 (brightness for RGB)
         url += `mode=${lightMode}&hue=${rgbHue}&rgbValue=${rgbValue}`;
+        fields.push([CONTROL_FIELD.hue, rgbHue], [CONTROL_FIELD.rgbValue, rgbValue]);
         device.light_mode = "rgb"
         device.ring_hue = rgbHue;
         device.ring_brightness = rgbValue
@@ -86,6 +91,7 @@ function sendControlData() {
     const fanSpeed = fanSpeedInput.value;
     device.fan_speed = fanSpeed
     url += `&fan=${fanSpeed}`;
+    fields.push([CONTROL_FIELD.fan, fanSpeed]);
     registeredDevices[mac] = device;
     const deviceInfoDiv = getById(`device-${mac.replace(/:/g, '')}`);
     const lightStatusSpan = deviceInfoDiv.querySelector(".device-status>.light-status>span.status");
@@ -94,6 +100,12 @@ function sendControlData() {
     lightStatusSpan.className = device.is_on ? "status status-on" : "status staus-off";
     fanStatusSpan.innerHTML = fanSpeeds[device.fan_speed];
 
+    // Over the WebSocket when it is open, otherwise one /control request at a time
+    if (controlSocket && device.index !== undefined) {
+        waitingControlFrame = { index: device.index, check: controlDeviceCheck(device.mac_address), fields: fields };
+        sendNextControlFrame();
+        return;
+    }
     newControlDataWaiting = true;
     waitingControlDataUrl = url;
     if (currentlySendingControlData) return;
@@ -114,7 +126,12 @@ function sendNextControlData() {
     waitingControlDataUrl = null;
 
     performGet(urlToSend,
-        () => {
+        (responseText) => {
+            // 202 with the job; how it went comes as a "control" event
+            try {
+                controlJobsInFlight.add(JSON.parse(responseText).job);
+            } catch (e) {
+            }
             currentlySendingControlData = false;
             if (newControlDataWaiting) {
                 // If new data came in while we were sending, send it now
@@ -132,13 +149,86 @@ function sendNextControlData() {
     );
 }
 
+// --- WebSocket control channel: binary frames, see src/ControlProtocol.h ---
+const CONTROL_FIELD = { mode: 0, fan: 1, bright: 2, warm: 3, hue: 4, rgbValue: 5 };
+const CONTROL_MODES = { off: 0, main: 1, rgb: 2 };
+const CONTROL_STATUS = ["OK", "Queued", "Bad frame", "Device not found", "Timed out"];
+const CONTROL_QUEUED = 1;
+const CONTROL_HEADER_SIZE = 5; // seq, device index, device check
+const CONTROL_WINDOW = 4; // frames sent before their ack; a newer frame waits (and replaces older waiting ones)
+const CONTROL_SOCKET_MAX_RETRY_MS = 30000;
+let controlSocket = null;
+let controlSocketRetryMs = 1000;
+let controlSeq = 0;
+let controlFramesInFlight = new Set();
+let waitingControlFrame = null;
+
+function openControlSocket() {
+    const socket = new WebSocket(`ws://${location.host}/ws`);
+    socket.binaryType = "arraybuffer";
+    socket.onopen = () => {
+        controlSocket = socket;
+        controlSocketRetryMs = 1000;
+        controlFramesInFlight.clear();
+        console.log("Control socket open");
+    };
+    socket.onclose = () => {
+        // Falls back to /control until the socket is back
+        controlSocket = null;
+        setTimeout(openControlSocket, controlSocketRetryMs);
+        controlSocketRetryMs = Math.min(controlSocketRetryMs * 2, CONTROL_SOCKET_MAX_RETRY_MS);
+    };
+    socket.onmessage = (event) => handleControlAck(new DataView(event.data));
+}
+
+// Last two bytes of the MAC; the ESP32 only takes the frame if the device at the index has them
+function controlDeviceCheck(macAddress) {
+    const bytes = macAddress.split(":");
+    return parseInt(bytes[4] + bytes[5], 16);
+}
+
+function sendNextControlFrame() {
+    if (!waitingControlFrame || !controlSocket || controlFramesInFlight.size >= CONTROL_WINDOW) {
+        return;
+    }
+    const { index, check, fields } = waitingControlFrame;
+    waitingControlFrame = null;
+    const seq = controlSeq;
+    controlSeq = (controlSeq + 1) & 0xFFFF;
+    const view = new DataView(new ArrayBuffer(CONTROL_HEADER_SIZE + fields.length * 3));
+    view.setUint16(0, seq, true);
+    view.setUint8(2, index);
+    view.setUint16(3, check, true);
+    fields.forEach(([field, value], i) => {
+        view.setUint8(CONTROL_HEADER_SIZE + i * 3, field);
+        view.setUint16(CONTROL_HEADER_SIZE + 1 + i * 3, Number(value), true);
+    });
+    controlFramesInFlight.add(seq);
+    controlSocket.send(view.buffer);
+}
+
+// Every frame is acked once right away; a queued one (its light was connecting) again when it went out
+function handleControlAck(view) {
+    if (view.byteLength < 3) return;
+    const seq = view.getUint16(0, true);
+    const status = view.getUint8(2);
+    controlFramesInFlight.delete(seq);
+    if (status > CONTROL_QUEUED) {
+        const responseDiv = getById("response");
+        responseDiv.className = "show error";
+        responseDiv.innerText = "Error: " + (CONTROL_STATUS[status] || status);
+        setTimeout(() => { responseDiv.className = ""; }, 3000);
+    }
+    sendNextControlFrame();
+}
+
 function performGet(url, callback, error) {
     const xhr = new XMLHttpRequest();
     xhr.open("GET", url, true);
     xhr.onreadystatechange = function () {
         const responseDiv = getById("response");
         if (xhr.readyState === 4) {
-            if (xhr.status === 200) {
+            if (xhr.status >= 200 && xhr.status < 300) {
                 responseDiv.className = "show success";
                 if (callback) {
                     callback(xhr.responseText);
@@ -165,7 +255,7 @@ const deviceSelectionOverlay = getById("device-selection-overlay");
 
 function openDeviceSelectionDialog() {
     deviceSelectionOverlay.classList.add("show");
-    searchForDevices();
+    searchForDevices(false);
 }
 
 function closeDeviceSelectionDialog() {
@@ -173,19 +263,29 @@ function closeDeviceSelectionDialog() {
 }
 
 const deviceListContainer = getById("device-list-container");
-function searchForDevices() {
-    let url = "/discover_devices";
+const DISCOVERY_POLL_MS = 1500;
+let discoveryPollTimer = null;
+function searchForDevices(refresh = true) {
+    let url = "/discover_devices" + (refresh ? "?refresh=1" : "");
+    clearTimeout(discoveryPollTimer);
     searchForDevicesBtn.setAttribute("disabled", "disabled");
     searchIndicator.style.display = "block";
     performGet(url, (responseText => {
+        let scanning = false;
         try {
-            const devices = JSON.parse(responseText);
-            displayDiscoveredDevices(devices);
+            // Cached devices come back right away; while the scan runs, poll for the ones it finds
+            const result = JSON.parse(responseText);
+            scanning = result.scanning;
+            displayDiscoveredDevices(result.devices, scanning);
         } catch (e) {
             // Handle JSON parsing errors specifically
             deviceListContainer.innerHTML = '<div class="error-message">Error parsing device data.</div>';
             console.error("Error parsing JSON response:", e);
         }
+        if (scanning && deviceSelectionOverlay.classList.contains("show")) {
+            discoveryPollTimer = setTimeout(() => searchForDevices(false), DISCOVERY_POLL_MS);
+            return;
+        }
         searchForDevicesBtn.removeAttribute("disabled");
         searchIndicator.style.display = "none";
     }));
@@ -197,7 +297,49 @@ const noDevicesSpan = getById("no-devices");
 const deviceControlDiv = getById("device-control");
 const currentDeviceTitleHeader = deviceControlDiv.querySelector(".title > h1");
 const fanSpeeds = ["Off", "Low", "Medium", "High"];
+let deviceEvents = null;
+let deviceStateVersion = 0;
+
+// Device state pushed by the server: one snapshot when connected, then only the devices that changed
+function openDeviceEvents() {
+    if (!window.EventSource) {
+        return;
+    }
+    deviceEvents = new EventSource("/events");
+    deviceEvents.addEventListener("snapshot", (event) => {
+        const snapshot = JSON.parse(event.data);
+        deviceStateVersion = snapshot.version;
+        renderDevices(snapshot.devices);
+    });
+    deviceEvents.addEventListener("device", (event) => {
+        const change = JSON.parse(event.data);
+        const device = registeredDevices[change.device.mac_address];
+        // Already part of a newer snapshot, or a device the page does not know yet
+        if (change.version <= deviceStateVersion || !device) {
+            return;
+        }
+        deviceStateVersion = change.version;
+        Object.assign(device, change.device);
+        renderDevices(registeredDevices);
+    });
+    deviceEvents.addEventListener("control", (event) => {
+        const job = JSON.parse(event.data);
+        if (!controlJobsInFlight.delete(job.job) || job.status === "applied") {
+            return;
+        }
+        const responseDiv = getById("response");
+        responseDiv.className = "show error";
+        responseDiv.innerText = "Error: " + job.status;
+        setTimeout(() => { responseDiv.className = ""; }, 3000);
+    });
+}
+
 function reloadMainPage() {
+    // The event stream sends a new snapshot by itself when devices are added or removed
+    if (deviceEvents && deviceEvents.readyState === EventSource.OPEN) {
+        return;
+    }
+
     // Clear previous content to avoid duplicates on reload
     registeredDevicesDiv.innerHTML = "";
 
@@ -205,70 +347,68 @@ function reloadMainPage() {
     registeredDevicesDiv.innerHTML = "<p>Loading configured devices...</p>";
 
     // Fetch the list of registered devices from the mock server (or ESP32)
-    // Using /get_all_devices for the mock server as per your Python code
-    // If on ESP32, this would be /get_managed_devices
-    performGet("/get_all_devices", (response) => {
-        // Clear the loading message once data is received
-        registeredDevicesDiv.innerHTML = "";
-
-        const devices = JSON.parse(response)
-        registeredDevices = devices;
-        if (devices.length === 0) {
-            // If no devices are registered, show the "No devices configured yet." message
-            noDevicesSpan.style.display = "block";
-        } else {
-            // If devices are found, hide the "No devices" message
-            noDevicesSpan.style.display = "none";
-
-            // Iterate over each device and create its HTML representation
-            Object.values(devices).forEach(device => {
-                const deviceElement = document.createElement("div");
-                deviceElement.className = "registered-device-item"; // Add a class for CSS styling
-                // Give a unique ID for potential future targeting (e.g., controlling a specific device)
-                deviceElement.id = `device-${device.mac_address.replace(/:/g, '')}`;
-
-                // Determine ON/OFF status and apply a class for styling
-                const isLightOnStatus = device.is_on ? "ON" : "OFF";
-                const lightMode = device.is_on ? device.light_mode : "off";
-                const lightStatusClass = device.is_on ? "status-on" : "status-off";
-                const fanStatus = fanSpeeds[device.fan_speed];
-
-                deviceElement.innerHTML = `
-                    <div class="data" data-mac="${device.mac_address}" data-name="${device.name}">
-                        <h3>${device.name || "Unnamed Device"}</h3>
-                        <p>MAC: ${device.mac_address}</p>
-
-                        <div class="device-status">
-                            <div class="light-status">
-                                <span class="status ${lightStatusClass}">${lightMode}</span>
-                            </div>
-                            <div class="fan-status">
-                                <span class="status">${fanStatus}</span>
-                            </div>
+    performGet("/get_all_devices", (response) => renderDevices(JSON.parse(response)));
+}
+
+function renderDevices(devices) {
+    registeredDevicesDiv.innerHTML = "";
+
+    registeredDevices = devices;
+    if (Object.keys(devices).length === 0) {
+        // If no devices are registered, show the "No devices configured yet." message
+        noDevicesSpan.style.display = "block";
+    } else {
+        // If devices are found, hide the "No devices" message
+        noDevicesSpan.style.display = "none";
+
+        // Iterate over each device and create its HTML representation
+        Object.values(devices).forEach(device => {
+            const deviceElement = document.createElement("div");
+            deviceElement.className = "registered-device-item"; // Add a class for CSS styling
+            // Give a unique ID for potential future targeting (e.g., controlling a specific device)
+            deviceElement.id = `device-${device.mac_address.replace(/:/g, '')}`;
+
+            // Determine ON/OFF status and apply a class for styling
+            const isLightOnStatus = device.is_on ? "ON" : "OFF";
+            const lightMode = device.is_on ? device.light_mode : "off";
+            const lightStatusClass = device.is_on ? "status-on" : "status-off";
+            const fanStatus = fanSpeeds[device.fan_speed];
+
+            deviceElement.innerHTML = `
+                <div class="data" data-mac="${device.mac_address}" data-name="${device.name}">
+                    <h3>${device.name || "Unnamed Device"}</h3>
+                    <p>MAC: ${device.mac_address}</p>
+
+                    <div class="device-status">
+                        <div class="light-status">
+                            <span class="status ${lightStatusClass}">${lightMode}</span>
+                        </div>
+                        <div class="fan-status">
+                            <span class="status">${fanStatus}</span>
                         </div>
                     </div>
-                    <div class="device-actions">
-                        <button class="remove-device-btn" data-mac="${device.mac_address}"><span class="button-text">Remove</span></button>
-                    </div>
-                `;
-                registeredDevicesDiv.appendChild(deviceElement);
-
-                deviceElement.querySelector(".data").addEventListener("click", (e) => {
-                    const mac = e.currentTarget.dataset.mac;
-                    const name = e.currentTarget.dataset.name;
-                    goToDeviceControlPage(mac, name);
-                });
-
-                deviceElement.querySelector(".remove-device-btn").addEventListener("click", (e) => {
-                    const mac = e.currentTarget.dataset.mac;
-                    console.log(`Remove button clicked for MAC: ${mac}`);
-                    if (confirm(`Are you sure you want to remove device ${mac}?`)) {
-                        performGet(`/remove_device?address=${mac}`, () => reloadMainPage())
-                    }
-                });
+                </div>
+                <div class="device-actions">
+                    <button class="remove-device-btn" data-mac="${device.mac_address}"><span class="button-text">Remove</span></button>
+                </div>
+            `;
+            registeredDevicesDiv.appendChild(deviceElement);
+
+            deviceElement.querySelector(".data").addEventListener("click", (e) => {
+                const mac = e.currentTarget.dataset.mac;
+                const name = e.currentTarget.dataset.name;
+                goToDeviceControlPage(mac, name);
             });
-        }
-    });
+
+            deviceElement.querySelector(".remove-device-btn").addEventListener("click", (e) => {
+                const mac = e.currentTarget.dataset.mac;
+                console.log(`Remove button clicked for MAC: ${mac}`);
+                if (confirm(`Are you sure you want to remove device ${mac}?`)) {
+                    performGet(`/remove_device?address=${mac}`, () => reloadMainPage())
+                }
+            });
+        });
+    }
 }
 
 function goToDeviceControlPage(mac, name) {
@@ -300,11 +440,13 @@ function addDevice(device) {
     reloadMainPage();
 }
 
-function displayDiscoveredDevices(devices) {
+function displayDiscoveredDevices(devices, scanning) {
     deviceListContainer.innerHTML = ''; // Clear previous content
 
     if (devices.length === 0) {
-        deviceListContainer.innerHTML = '<div class="info-message">No devices found.</div>';
+        if (!scanning) {
+            deviceListContainer.innerHTML = '<div class="info-message">No devices found.</div>';
+        }
         return;
     }
 
@@ -313,7 +455,7 @@ function displayDiscoveredDevices(devices) {
         deviceItem.className = 'device-item';
         deviceItem.innerHTML = `
             <strong>${device.name}</strong><br>
-            <small>${device.mac_address}</small>
+            <small>${device.mac_address}${device.rssi !== undefined ? ` (${device.rssi} dBm)` : ""}</small>
         `;
         deviceItem.addEventListener('click', () => {
             addDevice(device);
@@ -644,6 +786,8 @@ function endWarmnessIntensityDrag() {
 document.addEventListener('DOMContentLoaded', () => {
     // Initial display update when page loads
     reloadMainPage();
+    openDeviceEvents();
+    openControlSocket();
     updateLightModeDisplay();
 
     // Attach listeners for main mode selection
@@ -3,23 +3,22 @@
 // Initialize static instance pointer
 BluetoothManager *BluetoothManager::instance = nullptr;
 
-// --- Constants for BT Commands ---
-const uint8_t BT_PREFIX[] = {0x01, 0xfe, 0x00, 0x00, 0x51, 0x81, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0d};
-const uint8_t BT_SUFFIX[] = {0x0e, 0x00};
-const uint8_t ON_OFF_DATA_PREFIX[] = {0x07, 0x01, 0x03, 0x01};
-const uint8_t INTENSITY_DATA_PREFIX[] = {0x07, 0x01, 0x03, 0x02};
-const uint8_t WARMNESS_DATA_PREFIX[] = {0x07, 0x01, 0x03, 0x03};
-const uint8_t RGB_DATA_PREFIX[] = {0x0A, 0x02, 0x03, 0x0C};
-const uint8_t FAN_SPEED_DATA_PREFIX[] = {0x07, 0x0e, 0x03, 0x03};
-
-const int MIN_SEND_INTERVAL = 100; // give bluetooth time to digest...
-const int MAX_PACKET_SIZE = 128;
+const uint32_t WRITER_TASK_STACK_SIZE = 4096;
+const uint32_t DISCOVERY_DURATION_MS = 10240; // inquiry length is counted in 1.28 s units
+const uint32_t DISCOVERY_GRACE_MS = 1000;     // for the last inquiry results to arrive
+
+// Number of simultaneous links is bounded by the controller's ACL connection limit
+#ifdef CONFIG_BTDM_CTRL_BR_EDR_MAX_ACL_CONN
+const size_t BT_MAX_LINKS = CONFIG_BTDM_CTRL_BR_EDR_MAX_ACL_CONN;
+#else
+const size_t BT_MAX_LINKS = 2;
+#endif
 
 BluetoothManager::BluetoothManager(const char *deviceName)
-    : espDeviceName(deviceName)
+    : espDeviceName(deviceName), pipeline(transport, BT_MAX_LINKS)
 {
     instance = this; // Set the static instance pointer
-    lastSendTime = millis() - MIN_SEND_INTERVAL;
+    pipeline.setListener(this);
 }
 
 void BluetoothManager::registerDeviceConnectedListener(IBtDeviceConnectedListener *listener)
@@ -34,430 +33,391 @@ void BluetoothManager::registerBtDisconnectedListener(IBtDisconnectedListener *l
     log_i("Bluetooth disconected listener registered.");
 }
 
-void BluetoothManager::registerDevicesListReadyListener(IBtDevicesListReadyListener *listener)
+void BluetoothManager::registerDeviceFoundListener(IBtDeviceFoundListener *listener)
 {
-    devicesListReadyListener = listener;
-    log_i("Devices list ready listener registered.");
+    deviceFoundListener = listener;
+    log_i("Device found listener registered.");
+}
+
+void BluetoothManager::registerStatusListener(IBtStatusListener *listener)
+{
+    statusListener = listener;
+    log_i("Status listener registered.");
 }
 
 void BluetoothManager::begin()
 {
     SerialBT.begin(espDeviceName, true); // Master mode
-    SerialBT.register_callback(btCallback);
+    // BluetoothSerial handles a single client link, so the transport takes the SPP events over.
+    // SerialBT is still used for bringing up the stack and for discovery (GAP).
+    if (!pipeline.begin())
+    {
+        log_e("Could not register the SPP callback.");
+    }
+    xTaskCreate(writerTask, "bt_writer", WRITER_TASK_STACK_SIZE, this, 1, &writerTaskHandle);
 }
 
-bool BluetoothManager::isConnected()
+void BluetoothManager::writerTask(void *arg)
 {
-    return deviceConnected;
+    static_cast<BluetoothManager *>(arg)->pipeline.runWriter();
 }
 
-void BluetoothManager::disconnect()
+size_t BluetoothManager::getTxQueueDepth()
 {
-    log_i("Disconnecting");
-    if (!SerialBT.disconnect())
-    {
-        log_w("Failed to disconnect.");
-    }
+    return pipeline.getTxQueueDepth();
 }
 
-// Connects to a specific device
-void BluetoothManager::connectToDevice(const BTAddress &remoteAddress)
+BtTxStats BluetoothManager::getTxStats()
 {
-    log_i("remoteAddress: %s (current connected device: %s (%s))", 
-        remoteAddress.toString(true).c_str(),
-        connectedMacAddress.toString(true).c_str(),
-        deviceConnected ? "connected" : "not connecetd");
+    return pipeline.getTxStats();
+}
+
+BtAckStats BluetoothManager::getAckStats()
+{
+    return pipeline.getAckStats();
+}
+
+std::vector<BtDeviceAckStats> BluetoothManager::getDeviceAckStats()
+{
+    return pipeline.getDeviceAckStats();
+}
+
+BtShadowStats BluetoothManager::getShadowStats()
+{
+    return pipeline.getShadowStats();
+}
+
+void BluetoothManager::requestFullSync(const BTAddress &device)
+{
+    pipeline.invalidateShadow(*device.getNative());
+}
+
+std::vector<BtLinkInfo> BluetoothManager::getLinks()
+{
+    return pipeline.getLinks();
+}
+
+BtLinkPoolStats BluetoothManager::getLinkPoolStats()
+{
+    return pipeline.getLinkPoolStats();
+}
+
+BtReconnectStats BluetoothManager::getReconnectStats()
+{
+    return pipeline.getReconnectStats();
+}
+
+std::vector<BtConnectHistory> BluetoothManager::getConnectHistory()
+{
+    return pipeline.getConnectHistory();
+}
 
-    if (deviceConnected)
+BtCapture &BluetoothManager::getCapture()
+{
+    return pipeline.getCapture();
+}
+
+bool BluetoothManager::isConnected()
+{
+    uint8_t device[6];
     {
-        if (connectedMacAddress.equals(remoteAddress))
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (!hasActiveDevice)
         {
-            log_i("Already connected to this device.");
-            return;
+            return false;
         }
-        disconnect();
+        memcpy(device, activeDevice, sizeof(device));
     }
+    return pipeline.isConnected(device);
+}
 
-    SerialBT.connect(remoteAddress);
+bool BluetoothManager::isConnected(const BTAddress &device)
+{
+    return pipeline.isConnected(*device.getNative());
 }
 
-bool BluetoothManager::sendConfigToDevice(const DeviceConfig &config)
+void BluetoothManager::disconnect()
 {
-    log_i("deviceConnected: %s , connectedMacAddress: %s",
-          deviceConnected ? "true" : "false", connectedMacAddress.toString(true).c_str());
+    pipeline.disconnectAll();
+}
 
+void BluetoothManager::connect(const BTAddress &device, BtConnectReason reason)
+{
+    pipeline.connect(*device.getNative(), reason);
+}
+
+size_t BluetoothManager::getMaxLinks()
+{
+    return pipeline.getMaxLinks();
+}
+
+bool BluetoothManager::sendConfigToDevice(const DeviceConfig &config, bool forceFullSync,
+                                          std::vector<BtCompletion> *completions)
+{
     BTAddress address(config.mac_address);
-    if (!deviceConnected || !connectedMacAddress.equals(address))
+    String mac = address.toString(true);
+    const uint8_t *device = *address.getNative();
+    bool connected = pipeline.lookup(device);
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (connected)
+        {
+            awaitingConfigs.erase(mac);
+        }
+        else
+        {
+            awaitingConfigs[mac] = config;
+        }
+    }
+    if (!connected)
     {
-        log_i("need to switch device");
-        awaitingDeviceConfig = config;
-        waitingToSendCommand = true;
-        // Automatically try to connect if not connected to the right device
-        connectToDevice(config.mac_address);
+        log_i("%s not in the link pool, connecting", mac.c_str());
+        // Automatically try to connect; the config is sent once the link opens
+        pipeline.connect(device);
         return false;
     }
-    else {
-        log_i("correct device connected");
+
+    if (forceFullSync)
+    {
+        pipeline.invalidateShadow(device);
     }
-    waitingToSendCommand = false;
-    // Now call your existing sendCommand with the new parameters
+    // Only fields that differ from the shadow state go over the air
+    auto track = [completions](const BtCompletion &completion)
+    {
+        if (completions && completion)
+        {
+            completions->push_back(completion);
+        }
+    };
     uint8_t payload[4]; // Max payload size for your commands
 
     // Light ON/OFF
-    payload[0] = config.is_on ? 0x01 : 0x00;
-    sendCommand(CMD_LIGHT_ON_OFF, payload, 1);
+    payload[0] = config.is_on ? LightProtocol::LIGHT_ON : LightProtocol::LIGHT_OFF;
+    track(pipeline.send(device, CMD_LIGHT_ON_OFF, payload, 1));
 
     // Fan Speed
     payload[0] = config.fan_speed;
-    sendCommand(CMD_FAN_SPEED, payload, 1);
-
-    // Light Intensity
-    payload[0] = config.main_brightness;
-    sendCommand(CMD_LIGHT_INTENSITY, payload, 1);
+    track(pipeline.send(device, CMD_FAN_SPEED, payload, 1));
 
-    // Warmness
-    payload[0] = config.main_warmness;
-    sendCommand(CMD_LIGHT_WARMNESS, payload, 1);
-
-    // RGB (if applicable)
+    // RGB (if applicable), otherwise the main light. Only the active mode's fields are sent:
+    // sending the other mode's would switch the light over to it.
     if (config.light_mode == LightMode::RGB_RING)
     {
-        payload[0] = (config.ring_hue >> 8) & 0xFF;
-        payload[1] = config.ring_hue & 0xFF;
-        payload[2] = config.ring_brightness;
-        sendCommand(CMD_RGB, payload, 3);
+        int r, g, b;
+        hslToRgb((float)config.ring_hue / 100.0, 1.0, (float)config.ring_brightness / 255.0, &r, &g, &b);
+        payload[0] = config.ring_brightness;
+        payload[1] = (uint8_t)r;
+        payload[2] = (uint8_t)g;
+        payload[3] = (uint8_t)b;
+        track(pipeline.send(device, CMD_RGB, payload, 4));
+    }
+    else
+    {
+        // Light Intensity
+        payload[0] = config.main_brightness;
+        track(pipeline.send(device, CMD_LIGHT_INTENSITY, payload, 1));
+
+        // Warmness
+        payload[0] = config.main_warmness;
+        track(pipeline.send(device, CMD_LIGHT_WARMNESS, payload, 1));
     }
     // Note: You may need more logic here for other light modes
 
     return true;
 }
 
-void BluetoothManager::sendCommand(CommandType cmd, const uint8_t *payload, size_t payloadSize)
+BtCompletion BluetoothManager::sendCommand(CommandType cmd, const uint8_t *payload, size_t payloadSize, BtPriority priority)
 {
-    log_i("enter");
-    if (!deviceConnected)
-    {
-        log_w("Cannot send command: Not connected.");
-        return;
-    }
-
-    int time = millis();
-    int diff = time - lastSendTime;
-    if (diff < MIN_SEND_INTERVAL)
+    uint8_t device[6];
     {
-        log_i("waiting %d ms (%d - (%d - %d))", MIN_SEND_INTERVAL - diff, MIN_SEND_INTERVAL, time, lastSendTime);
-        delay(MIN_SEND_INTERVAL - diff);
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (!hasActiveDevice)
+        {
+            log_w("Cannot send command: Not connected.");
+            return BtCompletion();
+        }
+        memcpy(device, activeDevice, sizeof(device));
     }
-    const uint8_t *cmdPrefix;
-    size_t cmdPrefixSize;
-    uint8_t finalPacketByte6 = 0x18; // Default value
-
-    String commandTypeName = commandTypeToString(cmd);
-    log_i("command: %s", commandTypeName.c_str());
-
-    switch (cmd)
+    if (!pipeline.lookup(device))
     {
-    case CMD_LIGHT_ON_OFF:
-        cmdPrefix = ON_OFF_DATA_PREFIX;
-        cmdPrefixSize = sizeof(ON_OFF_DATA_PREFIX);
-        break;
-    case CMD_LIGHT_INTENSITY:
-        cmdPrefix = INTENSITY_DATA_PREFIX;
-        cmdPrefixSize = sizeof(INTENSITY_DATA_PREFIX);
-        break;
-    case CMD_LIGHT_WARMNESS:
-        cmdPrefix = WARMNESS_DATA_PREFIX;
-        cmdPrefixSize = sizeof(WARMNESS_DATA_PREFIX);
-        break;
-    case CMD_RGB:
-        cmdPrefix = RGB_DATA_PREFIX;
-        cmdPrefixSize = sizeof(RGB_DATA_PREFIX);
-        finalPacketByte6 = 0x1c; // Special value for RGB
-        break;
-    case CMD_FAN_SPEED:
-        cmdPrefix = FAN_SPEED_DATA_PREFIX;
-        cmdPrefixSize = sizeof(FAN_SPEED_DATA_PREFIX);
-        break;
-    default:
-        log_w("Unknown command type.");
-        return;
+        log_w("Cannot send command: Not connected.");
+        return BtCompletion();
     }
+    return pipeline.send(device, cmd, payload, payloadSize, priority);
+}
 
-    uint8_t packetBuffer[MAX_PACKET_SIZE];
-    size_t packetSize = 0;
-
-    memcpy(packetBuffer, BT_PREFIX, sizeof(BT_PREFIX));
-    packetSize += sizeof(BT_PREFIX);
-
-    packetBuffer[6] = finalPacketByte6; // Set byte 6 based on command
-
-    memcpy(&packetBuffer[packetSize], cmdPrefix, cmdPrefixSize);
-    packetSize += cmdPrefixSize;
-
-    memcpy(&packetBuffer[packetSize], payload, payloadSize);
-    packetSize += payloadSize;
-
-    memcpy(&packetBuffer[packetSize], BT_SUFFIX, sizeof(BT_SUFFIX));
-    packetSize += sizeof(BT_SUFFIX);
-
-    log_i("create packet (size: %d)", packetSize);
-    String str = "Sending packet (HEX): ";
-    for (size_t i = 0; i < packetSize; i++)
+BtCompletion BluetoothManager::sendCommand(const BTAddress &device, CommandType cmd, const uint8_t *payload, size_t payloadSize,
+                                           BtPriority priority)
+{
+    if (!pipeline.lookup(*device.getNative()))
     {
-        str += String(packetBuffer[i], HEX);
+        log_w("Cannot send command: %s not connected, connecting.", device.toString(true).c_str());
+        pipeline.connect(*device.getNative());
+        return BtCompletion();
     }
-    log_i("%s", str.c_str());
+    return pipeline.send(*device.getNative(), cmd, payload, payloadSize, priority);
+}
 
-    SerialBT.write(packetBuffer, packetSize);
-    SerialBT.flush();
+bool BluetoothManager::getDeviceState(const BTAddress &device, BtDeviceState &state)
+{
+    return pipeline.getDeviceState(*device.getNative(), state);
+}
 
-    lastSendTime = millis();
+std::vector<BtDeviceState> BluetoothManager::getDeviceStates()
+{
+    return pipeline.getDeviceStates();
 }
 
-void printStatus(esp_spp_status_t status)
+bool BluetoothManager::getLastStatus(const BTAddress &device, uint8_t function, BtStatus &status)
 {
-    switch (status)
-    {
-    case ESP_SPP_SUCCESS:
-        log_i("ESP_SPP_SUCCESS");
-        break;
-    case ESP_SPP_FAILURE:
-        log_i("ESP_SPP_FAILURE");
-        break;
-    case ESP_SPP_BUSY:
-        log_i("ESP_SPP_BUSY");
-        break;
-    case ESP_SPP_NO_DATA:
-        log_i("ESP_SPP_NO_DATA");
-        break;
-    case ESP_SPP_NO_RESOURCE:
-        log_i("ESP_SPP_NO_RESOURCE");
-        break;
-    case ESP_SPP_NEED_INIT:
-        log_i("ESP_SPP_NEED_INIT");
-        break;
-    case ESP_SPP_NEED_DEINIT:
-        log_i("ESP_SPP_NEED_DEINIT");
-        break;
-    case ESP_SPP_NO_CONNECTION:
-        log_i("ESP_SPP_NO_CONNECTION");
-        break;
-    case ESP_SPP_NO_SERVER:
-        log_i("ESP_SPP_NO_SERVER");
-        break;
-    default:
-        log_i("Unknown status");
-        break;
-    }
+    return pipeline.getLastStatus(*device.getNative(), function, status);
 }
 
-// Member method to handle Bluetooth events
-void BluetoothManager::handleBtEvent(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
+bool BluetoothManager::waitForAck(const std::vector<BtCompletion> &completions, unsigned long timeout_ms)
 {
-    uint8_t receivedBytes[MAX_PACKET_SIZE];
-    int bytesRead = 0;
+    return pipeline.waitForAck(completions, timeout_ms);
+}
 
-    log_i("%d", event);
-    switch (event)
+// The device that was asked for last becomes the active one, and the config waiting for it is sent.
+// Links opened in the background (reconnects, pre-connects) only take the active device back when
+// it was theirs and no other device took over in the meantime.
+void BluetoothManager::onLinkOpened(const uint8_t address[6], BtConnectReason reason)
+{
+    BTAddress mac((uint8_t *)address);
+    DeviceConfig config;
+    bool hasConfig = false;
+    bool activated;
     {
-
-    case ESP_SPP_INIT_EVT:
-        log_i("ESP_SPP_INIT_EVT");
-        printStatus(param->init.status);
-        break;
-    case ESP_SPP_UNINIT_EVT:
-        log_i("ESP_SPP_UNINIT_EVT");
-        printStatus(param->uninit.status);
-        break;
-    case ESP_SPP_DISCOVERY_COMP_EVT:
-        log_i("ESP_SPP_DISCOVERY_COMP_EVT");
-        printStatus(param->disc_comp.status);
-        break;
-    case ESP_SPP_OPEN_EVT:
-        log_i("ESP_SPP_OPEN_EVT");
+        std::lock_guard<std::mutex> lock(stateMutex);
+        activated = reason == BtConnectReason::REQUESTED ||
+                    (!hasActiveDevice && hadActiveDevice && memcmp(activeDevice, address, sizeof(activeDevice)) == 0);
+        if (activated)
         {
-            printStatus(param->open.status);
-            BTAddress mac(param->open.rem_bda);
-            log_i("Target device connected successfully. mac: %s", mac.toString(true).c_str());
-            deviceConnected = true;
-            connectedMacAddress = mac;
-            if (deviceConnectedListener != nullptr)
-            {
-                deviceConnectedListener->onDeviceConnected(mac.toString(true));
-            }
+            memcpy(activeDevice, address, sizeof(activeDevice));
+            hasActiveDevice = true;
+            hadActiveDevice = true;
         }
-        break;
-    case ESP_SPP_CLOSE_EVT:
-        log_i("ESP_SPP_CLOSE_EVT");
+        auto it = awaitingConfigs.find(mac.toString(true));
+        if (it != awaitingConfigs.end())
         {
-            printStatus(param->close.status);
-            log_i("Target device disconnected.");
-            // You might want an onBluetoothDisconnected callback here too
-            deviceConnected = false;
-            connectedMacAddress = BTAddress();
-            if (btDisconnectedListener)
-            {
-                btDisconnectedListener->onBtDisconnected();
-            }
-            onDeviceDisconnected();
+            config = it->second;
+            hasConfig = true;
+            awaitingConfigs.erase(it);
         }
-        break;
-
-    case ESP_SPP_START_EVT:
-        log_i("ESP_SPP_START_EVT");
-        printStatus(param->start.status);
-        break;
-    case ESP_SPP_CL_INIT_EVT:
-        log_i("ESP_SPP_CL_INIT_EVT");
-        printStatus(param->cl_init.status);
-        break;
-    case ESP_SPP_DATA_IND_EVT:
-        log_i("ESP_SPP_DATA_IND_EVT");
-        printStatus(param->data_ind.status);
-        break;
-    case ESP_SPP_CONG_EVT:
-        log_i("ESP_SPP_CONG_EVT");
-        printStatus(param->cong.status);
-        break;
-    case ESP_SPP_WRITE_EVT:
-        log_i("ESP_SPP_WRITE_EVT");
-        printStatus(param->write.status);
-        break;
-    case ESP_SPP_SRV_OPEN_EVT:
-        log_i("ESP_SPP_SRV_OPEN_EVT");
-        printStatus(param->srv_open.status);
-        break;
-    case ESP_SPP_SRV_STOP_EVT:
-        log_i("ESP_SPP_SRV_STOP_EVT");
-        printStatus(param->srv_stop.status);
-        break;
-    case ESP_SPP_VFS_REGISTER_EVT:
-        log_i("ESP_SPP_VFS_REGISTER_EVT");
-        printStatus(param->vfs_register.status);
-        break;
-    case ESP_SPP_VFS_UNREGISTER_EVT:
-        log_i("ESP_SPP_VFS_UNREGISTER_EVT");
-        printStatus(param->vfs_unregister.status);
-        break;
-    default:
-        log_i("Unknown SPP event: %d", event);
-        break;
     }
-}
-
-void BluetoothManager::btCallback(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
-{
-    if (instance)
+    if (activated && deviceConnectedListener != nullptr)
     {
-        instance->handleBtEvent(event, param); // Forward to member method
+        deviceConnectedListener->onDeviceConnected(mac.toString(true));
+    }
+    if (hasConfig)
+    {
+        log_i("calling sendConfigToDevice");
+        sendConfigToDevice(config);
     }
 }
 
-bool BluetoothManager::waitForAck(const std::vector<CommandType> &expectedAckTypes, unsigned long timeout_ms)
+void BluetoothManager::onLinkClosed(const uint8_t address[6])
 {
-    unsigned long startMillis = millis();
-
-    // Clear the ACK flags at the start of waiting
-    // This ensures we only acknowledge events that occur *during* this wait period.
-    _ackReceived = false;
-    _ackType = CMD_NONE;
-
-    while ((millis() - startMillis < timeout_ms))
+    bool wasActive;
     {
-        // Check if an ACK was received AND its type is among the expected types
-        if (_ackReceived && std::find(expectedAckTypes.begin(), expectedAckTypes.end(), _ackType) != expectedAckTypes.end())
+        std::lock_guard<std::mutex> lock(stateMutex);
+        wasActive = hasActiveDevice && memcmp(activeDevice, address, sizeof(activeDevice)) == 0;
+        if (wasActive)
         {
-            _ackReceived = false; // Reset for next command
-            _ackType = CMD_NONE;  // Clear acknowledged type
-            return true;          // Success: Expected ACK type received
+            hasActiveDevice = false;
         }
-
-        // *** CRITICAL FIX: Replace delay(1) with vTaskDelay ***
-        // Yield execution to allow other tasks (like BT event handler) to run
-        vTaskDelay(pdMS_TO_TICKS(10)); // Yield for 10ms (adjust as needed, 1ms to 100ms)
     }
+    if (wasActive && btDisconnectedListener)
+    {
+        btDisconnectedListener->onBtDisconnected();
+    }
+}
 
-    // If loop finishes, it's a timeout or an unexpected ACK type arrived
-    _ackReceived = false; // Reset flags for next operation
-    _ackType = CMD_NONE;
-    Serial.printf("[BluetoothManager] waitForAck timeout for expected types. Last ACK was %d\n", _ackType); // Debug timeout
-    return false;                                                                                           // Timeout or incorrect ACK type received
+void BluetoothManager::onConnectFailed(const uint8_t address[6])
+{
+    std::lock_guard<std::mutex> lock(stateMutex);
+    awaitingConfigs.erase(BTAddress((uint8_t *)address).toString(true));
 }
 
-void BluetoothManager::clearInputBuffer()
+void BluetoothManager::onStatus(const uint8_t address[6], const BtStatus &status)
 {
-    while (SerialBT.available())
+    if (statusListener)
     {
-        SerialBT.read();
+        statusListener->onStatusReceived(BTAddress((uint8_t *)address).toString(true), status);
     }
 }
 
-void BluetoothManager::onDeviceConnected(const BTAddress &mac)
+bool BluetoothManager::startDiscovery()
 {
-    if (waitingToSendCommand)
+    std::lock_guard<std::mutex> lock(discoveryMutex);
+    if (updateDiscovery())
     {
-        log_i("calling sendConfigToDevice");
-        sendConfigToDevice(awaitingDeviceConfig);
+        return false;
+    }
+    log_i("Starting background discovery (%d ms)", DISCOVERY_DURATION_MS);
+    // Runs next to the open links; results arrive on the GAP task
+    if (!SerialBT.discoverAsync([](BTAdvertisedDevice *device)
+                                { instance->onDeviceDiscovered(device); },
+                                DISCOVERY_DURATION_MS))
+    {
+        log_w("Could not start discovery.");
+        return false;
     }
+    discoveryStartedMs = millis();
+    discoveryRunning = true;
+    return true;
+}
+
+bool BluetoothManager::isDiscovering()
+{
+    std::lock_guard<std::mutex> lock(discoveryMutex);
+    return updateDiscovery();
 }
 
-void BluetoothManager::onDeviceDisconnected()
+bool BluetoothManager::updateDiscovery()
 {
-    if (waitingToScanForDevices)
+    if (discoveryRunning && millis() - discoveryStartedMs >= DISCOVERY_DURATION_MS + DISCOVERY_GRACE_MS)
     {
-        log_i("calling scanForDevices");
-        delay(500);
-        scanForDevices();
+        SerialBT.discoverAsyncStop();
+        discoveryRunning = false;
+        log_i("Discovery finished, %d lights cached.", scanCache.getEntries().size());
     }
+    return discoveryRunning;
 }
 
-void BluetoothManager::scanForDevices()
+void BluetoothManager::onDeviceDiscovered(BTAdvertisedDevice *device)
 {
-    log_i("deviceConnected: %s, connectedDevice: %s",
-        deviceConnected ? "true" : "false",
-        connectedMacAddress.toString(true).c_str());
-
-    if (deviceConnected)
+    // Filter on the OUI before doing anything else: most inquiry results are phones, TVs, ...
+    BTAddress btAddress = device->getAddress();
+    const uint8_t *address = *btAddress.getNative();
+    if (!isLightAddress(address))
     {
-        waitingToScanForDevices = true;
-        disconnect();
         return;
     }
-    
-    waitingToScanForDevices = false;
-
-    log_i("------------------------------------");
-    log_i("Scanning for devices (10 seconds)...");
-
-    BTScanResults *scanResults = SerialBT.discover(10000);
-
-    std::map<String, BtDevice> *foundDevices = new std::map<String, BtDevice>();
-    if (scanResults != nullptr && scanResults->getCount() > 0)
+    uint32_t now = millis();
+    bool isNew = scanCache.update(address, device->getName().c_str(), device->haveRSSI(), device->getRSSI(), now);
+    log_i("  - Found Device: %s, Address: %s%s", device->getName().c_str(),
+          btAddress.toString(true).c_str(), isNew ? " (new)" : "");
+    if (deviceFoundListener)
     {
-        log_i("Found %d devices:\n", scanResults->getCount());
-        for (int i = 0; i < scanResults->getCount(); i++)
+        for (const BtScanEntry &entry : scanCache.getEntries())
         {
-            BTAdvertisedDevice *device_result = scanResults->getDevice(i);
-            String name = device_result->getName().c_str();
-            BTAddress address = device_result->getAddress();
-            String mac = address.toString(true);
-            log_i("  - Found Device: %s, Address: %s\n", name.c_str(), mac.c_str());
-            if (mac.startsWith("C9:A3:05"))
+            if (memcmp(entry.address, address, sizeof(entry.address)) == 0)
             {
-                (*foundDevices)[mac] = {name, mac};
+                deviceFoundListener->onDeviceFound(entry, isNew);
+                break;
             }
         }
-
-        if (devicesListReadyListener)
-        {
-            log_i("calling callback with %d devices", foundDevices->size());
-            // Call the method using the pointer.
-            devicesListReadyListener->onDevicesListReady(*foundDevices);
-            delete foundDevices;
-        }
-    }
-    else
-    {
-        log_i("No classic Bluetooth devices found.");
     }
 }
+
+std::vector<BtScanEntry> BluetoothManager::getDiscoveredDevices()
+{
+    scanCache.expire(millis());
+    return scanCache.getEntries();
+}
+
+uint32_t BluetoothManager::getLastDiscoveryUpdateMs()
+{
+    return scanCache.getLastUpdateMs();
+}
@@ -3,29 +3,18 @@
 
 #include <vector>
 #include <map>
+#include <mutex>
 #include <Arduino.h>
 #include <BluetoothSerial.h>
+#include <LightProtocol.h>
 #include "DeviceConfig.h"
 #include "CommandType.h"
 #include "Utils.h"
+#include "BtCommandPipeline.h"
+#include "SppTransport.h"
+#include "BtScanCache.h"
 
-// Define constants for received packet parsing
-// These are based on your observed "BT Data Received" logs
-const uint8_t RX_PACKET_HEADER_BYTE4 = 0x41;   // Identifies a received status packet
-const uint8_t RX_PACKET_HEADER_BYTE5 = 0x81;   // Consistent second header byte for received packets
-const uint8_t RX_PACKET_FUNCTION_FAN = 0x18;   // Byte 6 for fan/motor status
-const uint8_t RX_PACKET_FUNCTION_LIGHT = 0x1C; // Byte 6 for light status (assuming, based on sent command)
-
-// Indices for parsing received packets (0-indexed from start of 24-byte packet)
-const int RX_PACKET_FUNCTION_BYTE_IDX = 6;
-const int RX_PACKET_FAN_STATE_BYTE_IDX = 22; // For fan ON/OFF/Speed
-
-struct BtDevice
-{
-    String name;
-    String address;
-};
-
+// Called from the Bluetooth writer task, never from the SPP callbacks
 class IBtDeviceConnectedListener
 {
 public:
@@ -40,56 +29,128 @@ public:
     virtual ~IBtDisconnectedListener() = default;
 };
 
-class IBtDevicesListReadyListener
+// Called from the Bluetooth task for every status packet
+class IBtStatusListener
 {
 public:
-    virtual void onDevicesListReady(std::map<String, BtDevice> devices) = 0;
-    virtual ~IBtDevicesListReadyListener() = default;
+    virtual void onStatusReceived(String mac_address, const BtStatus &status) = 0;
+    virtual ~IBtStatusListener() = default;
 };
 
-class BluetoothManager
+// Called from the Bluetooth (GAP) task for every light a discovery finds
+class IBtDeviceFoundListener
+{
+public:
+    virtual void onDeviceFound(const BtScanEntry &device, bool isNew) = 0;
+    virtual ~IBtDeviceFoundListener() = default;
+};
+
+/**
+ * Keeps a pool of SPP links to the managed lights and routes commands to them.
+ * The command pipeline (queue, pacing, framing, ACKs) runs over an SppTransport; BluetoothSerial
+ * only brings up the stack and runs discovery.
+ */
+class BluetoothManager : public IBtPipelineListener
 {
 public:
     BluetoothManager(const char *deviceName);
     void begin();
-    void clearInputBuffer();
+    // True while the active device (the one the local controllers drive) is connected
     bool isConnected();
+    // True while the device has an open link in the pool
+    bool isConnected(const BTAddress &device);
+    // Closes every link in the pool
     void disconnect();
-    void sendCommand(CommandType cmd, const uint8_t *payload, size_t payloadSize);
-    bool sendConfigToDevice(const DeviceConfig &config);
+    // Opens a link to the device (see BtCommandPipeline::connect); only REQUESTED makes it the active device
+    void connect(const BTAddress &device, BtConnectReason reason = BtConnectReason::REQUESTED);
+    size_t getMaxLinks();
+    // Encodes the command and queues it for the writer task. The returned handle completes when the
+    // light's status packet acknowledges the command; it is invalid if not connected or the queue is full.
+    // A payload equal to the device's shadow state is not sent again; the handle of the command that sent it is returned.
+    // Local input uses BtPriority::URGENT so it goes out ahead of queued web traffic.
+    BtCompletion sendCommand(CommandType cmd, const uint8_t *payload, size_t payloadSize, BtPriority priority = BtPriority::NORMAL);
+    BtCompletion sendCommand(const BTAddress &device, CommandType cmd, const uint8_t *payload, size_t payloadSize,
+                             BtPriority priority = BtPriority::NORMAL);
+    // Sends the fields of the config that differ from the device's shadow state (all of them with forceFullSync)
+    // over its pooled link. Returns false (and starts connecting) on a pool miss; the config is then sent once the link opens.
+    // The handles of the commands sent are added to completions, if given.
+    bool sendConfigToDevice(const DeviceConfig &config, bool forceFullSync = false,
+                            std::vector<BtCompletion> *completions = nullptr);
+    // Marks the device's whole shadow state dirty, so every field is sent again
+    void requestFullSync(const BTAddress &device);
     void registerDeviceConnectedListener(IBtDeviceConnectedListener *listener);
     void registerBtDisconnectedListener(IBtDisconnectedListener *listener);
-    void registerDevicesListReadyListener(IBtDevicesListReadyListener *listener);
-    bool waitForAck(const std::vector<CommandType> &expectedAckTypes, unsigned long timeout_ms);
-    void scanForDevices();
+    void registerDeviceFoundListener(IBtDeviceFoundListener *listener);
+    void registerStatusListener(IBtStatusListener *listener);
+    // Fan speed and power state the device last reported, whether set by us or with its remote
+    bool getDeviceState(const BTAddress &device, BtDeviceState &state);
+    std::vector<BtDeviceState> getDeviceStates();
+    // Latest status packet with the given function byte. Returns false if none was received on the device's link.
+    bool getLastStatus(const BTAddress &device, uint8_t function, BtStatus &status);
+    // Waits until every command is acknowledged, timed out or dropped. True if all were acknowledged.
+    bool waitForAck(const std::vector<BtCompletion> &completions, unsigned long timeout_ms);
+    // Starts a background discovery that fills the scan cache as lights are found. False if one is already running.
+    // Safe from any task, like isDiscovering.
+    bool startDiscovery();
+    bool isDiscovering();
+    // Lights found by recent discoveries, expired after BT_SCAN_CACHE_TTL_MS
+    std::vector<BtScanEntry> getDiscoveredDevices();
+    // When a discovery last found a light (0 if never)
+    uint32_t getLastDiscoveryUpdateMs();
+    size_t getTxQueueDepth();
+    BtTxStats getTxStats();
+    BtAckStats getAckStats();
+    // Retransmit rate and ACK timeout of each recently used device, to spot flaky lights
+    std::vector<BtDeviceAckStats> getDeviceAckStats();
+    BtShadowStats getShadowStats();
+    // Open links with their pacing (effective packets per second, learned interval)
+    std::vector<BtLinkInfo> getLinks();
+    BtLinkPoolStats getLinkPoolStats();
+    // Reconnects of dropped links and pre-connects of the lights likely to be used next
+    BtReconnectStats getReconnectStats();
+    std::vector<BtConnectHistory> getConnectHistory();
+    // Binary capture of the last packets sent and received, for download and offline replay
+    BtCapture &getCapture();
+
+    // IBtPipelineListener
+    void onLinkOpened(const uint8_t address[6], BtConnectReason reason) override;
+    void onLinkClosed(const uint8_t address[6]) override;
+    void onConnectFailed(const uint8_t address[6]) override;
+    void onStatus(const uint8_t address[6], const BtStatus &status) override;
 
 private:
     BluetoothSerial SerialBT;
     const char *espDeviceName;
-    bool deviceConnected = false;
-    BTAddress connectedMacAddress;
     IBtDeviceConnectedListener *deviceConnectedListener = nullptr;
-    IBtDevicesListReadyListener *devicesListReadyListener = nullptr;
+    IBtDeviceFoundListener *deviceFoundListener = nullptr;
     IBtDisconnectedListener *btDisconnectedListener = nullptr;
-    long lastSendTime;
-    bool waitingToScanForDevices = false;
-    bool waitingToSendCommand = false;
-
-    DeviceConfig awaitingDeviceConfig;
+    IBtStatusListener *statusListener = nullptr;
+    SppTransport transport;
+    BtCommandPipeline pipeline;
+    TaskHandle_t writerTaskHandle = nullptr;
+    BtScanCache scanCache;
+    // Guards the discovery state, so two callers cannot both start a discovery
+    std::mutex discoveryMutex;
+    uint32_t discoveryStartedMs = 0;
+    bool discoveryRunning = false;
 
-    void connectToDevice(const BTAddress &remoteAddress);
-    void handleBtEvent(esp_spp_cb_event_t event, esp_spp_cb_param_t *param);
-    void onDeviceConnected(const BTAddress &mac);
-    void onDeviceDisconnected();
+    // Guards activeDevice and awaitingConfigs (touched by the loop, writer and Bluetooth tasks)
+    std::mutex stateMutex;
+    uint8_t activeDevice[6];
+    bool hasActiveDevice = false;
+    // activeDevice holds the device that was active last, even after its link closed
+    bool hadActiveDevice = false;
+    // Configs to send once their device's link opens
+    std::map<String, DeviceConfig> awaitingConfigs;
 
-    static void btCallback(esp_spp_cb_event_t event, esp_spp_cb_param_t *param);
+    void onDeviceDiscovered(BTAdvertisedDevice *device);
+    // Called with discoveryMutex held. Stops a discovery that ran its time; true while one runs.
+    bool updateDiscovery();
 
-    volatile bool _ackReceived = false;       // Flag set by callback when ACK is parsed
-    volatile CommandType _ackType = CMD_NONE; // Type of command for which ACK was received
-    volatile uint8_t _ackStateValue = 0;      // State value from the ACK (e.g., fan speed)
+    static void writerTask(void *arg);
 
     // Static pointer to the instance to be used in the static callback
     static BluetoothManager *instance;
 };
 
-#endif // BLUETOOTH_MANAGER_H
\ No newline at end of file
+#endif // BLUETOOTH_MANAGER_H
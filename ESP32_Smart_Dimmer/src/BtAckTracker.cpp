@@ -0,0 +1,421 @@
+#include "BtAckTracker.h"
+#include "BtRxFramer.h"
+#include <chrono>
+#include <string.h>
+
+BtAckState BtCompletion::state() const
+{
+    return tracker ? tracker->state(completionId) : BtAckState::EXPIRED;
+}
+
+uint8_t BtCompletion::ackValue() const
+{
+    return tracker ? tracker->ackValue(completionId) : 0;
+}
+
+bool BtCompletion::wait(uint32_t timeoutMs) const
+{
+    return tracker ? tracker->wait(completionId, timeoutMs) : false;
+}
+
+BtCompletionSummary summarizeCompletions(const std::vector<BtCompletion> &completions)
+{
+    BtCompletionSummary summary = {false, false};
+    for (const BtCompletion &completion : completions)
+    {
+        BtAckState state = completion.state();
+        summary.pending |= state == BtAckState::QUEUED || state == BtAckState::SENT;
+        summary.failed |= state == BtAckState::TIMED_OUT || state == BtAckState::DROPPED;
+    }
+    return summary;
+}
+
+BtAckTracker::BtAckTracker()
+    : entries(), stats(), devices()
+{
+}
+
+bool BtAckTracker::isFinal(BtAckState state)
+{
+    return state == BtAckState::ACKED || state == BtAckState::TIMED_OUT || state == BtAckState::DROPPED;
+}
+
+BtAckTracker::Entry *BtAckTracker::find(BtCompletionId id)
+{
+    if (id.generation == 0 || id.slot >= BT_ACK_TRACKER_CAPACITY)
+    {
+        return nullptr;
+    }
+    Entry &entry = entries[id.slot];
+    if (entry.generation != id.generation || entry.state == BtAckState::FREE)
+    {
+        return nullptr;
+    }
+    return &entry;
+}
+
+void BtAckTracker::finish(Entry &entry, BtAckState state)
+{
+    entry.state = state;
+    if (state == BtAckState::TIMED_OUT)
+    {
+        stats.timedOut++;
+        deviceFor(entry.device).stats.timedOut++;
+    }
+    else if (state == BtAckState::DROPPED)
+    {
+        stats.dropped++;
+    }
+}
+
+BtCompletion BtAckTracker::track(const uint8_t device[6], CommandType cmd)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    // Round robin, so finished commands keep their result for as long as possible
+    for (size_t i = 0; i < BT_ACK_TRACKER_CAPACITY; i++)
+    {
+        size_t slot = (nextSlot + i) % BT_ACK_TRACKER_CAPACITY;
+        Entry &entry = entries[slot];
+        if (entry.state != BtAckState::FREE && !isFinal(entry.state))
+        {
+            continue;
+        }
+        entry.generation++;
+        if (entry.generation == 0)
+        {
+            entry.generation = 1;
+        }
+        entry.state = BtAckState::QUEUED;
+        entry.cmd = cmd;
+        memcpy(entry.device, device, sizeof(entry.device));
+        entry.ackValue = 0;
+        entry.attempts = 0;
+        entry.sentAt = 0;
+        entry.deadline = 0;
+        nextSlot = (slot + 1) % BT_ACK_TRACKER_CAPACITY;
+        stats.tracked++;
+        return BtCompletion(this, {(uint16_t)slot, entry.generation});
+    }
+    stats.untracked++;
+    return BtCompletion();
+}
+
+BtCompletion BtAckTracker::handleFor(BtCompletionId id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return find(id) ? BtCompletion(this, id) : BtCompletion();
+}
+
+void BtAckTracker::release(BtCompletionId id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry *entry = find(id);
+    if (entry && entry->state == BtAckState::QUEUED)
+    {
+        entry->state = BtAckState::FREE;
+        stats.tracked--;
+    }
+}
+
+void BtAckTracker::markSent(BtCompletionId id, uint32_t nowMs)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Entry *entry = find(id);
+        if (!entry || entry->state != BtAckState::QUEUED)
+        {
+            return;
+        }
+        Device &target = deviceFor(entry->device);
+        if (entry->attempts == 0)
+        {
+            target.stats.sent++;
+        }
+        entry->attempts++;
+        entry->state = BtAckState::SENT;
+        entry->sentAt = nowMs;
+        // Exponential backoff: a device that did not answer in time is probably busy or out of range
+        uint32_t timeout = timeoutFor(target) << (entry->attempts - 1);
+        entry->deadline = nowMs + (timeout < BT_ACK_MAX_TIMEOUT_MS ? timeout : BT_ACK_MAX_TIMEOUT_MS);
+    }
+    changed.notify_all();
+}
+
+void BtAckTracker::markDropped(BtCompletionId id)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Entry *entry = find(id);
+        if (!entry || isFinal(entry->state))
+        {
+            return;
+        }
+        finish(*entry, BtAckState::DROPPED);
+    }
+    changed.notify_all();
+}
+
+void BtAckTracker::markRetransmitQueued(BtCompletionId id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry *entry = find(id);
+    if (!entry || isFinal(entry->state))
+    {
+        return;
+    }
+    deviceFor(entry->device).stats.retransmits++;
+    stats.retransmits++;
+}
+
+void BtAckTracker::markTimedOut(BtCompletionId id)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Entry *entry = find(id);
+        if (!entry || isFinal(entry->state))
+        {
+            return;
+        }
+        finish(*entry, BtAckState::TIMED_OUT);
+    }
+    changed.notify_all();
+}
+
+void BtAckTracker::dropDevice(const uint8_t device[6])
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Entry &entry : entries)
+        {
+            if ((entry.state == BtAckState::QUEUED || entry.state == BtAckState::SENT) &&
+                memcmp(entry.device, device, sizeof(entry.device)) == 0)
+            {
+                finish(entry, BtAckState::DROPPED);
+            }
+        }
+    }
+    changed.notify_all();
+}
+
+bool BtAckTracker::acknowledge(const uint8_t device[6], uint8_t rxFunction, uint8_t value, uint32_t nowMs)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Entry *oldest = nullptr;
+        for (Entry &entry : entries)
+        {
+            if (entry.state != BtAckState::SENT ||
+                rxFunctionForCommand(entry.cmd) != rxFunction ||
+                memcmp(entry.device, device, sizeof(entry.device)) != 0)
+            {
+                continue;
+            }
+            if (!oldest || (nowMs - entry.sentAt) > (nowMs - oldest->sentAt))
+            {
+                oldest = &entry;
+            }
+        }
+        if (!oldest)
+        {
+            return false;
+        }
+        oldest->state = BtAckState::ACKED;
+        oldest->ackValue = value;
+
+        uint32_t latency = nowMs - oldest->sentAt;
+        Device &target = deviceFor(device);
+        target.stats.acked++;
+        // Only first writes are timed: an ACK after a retransmit may answer either write (Karn)
+        if (oldest->attempts == 1)
+        {
+            updateLatency(target, latency);
+        }
+        stats.acked++;
+        stats.lastAckLatencyMs = latency;
+        stats.avgAckLatencyMs = stats.acked == 1 ? latency : (stats.avgAckLatencyMs * 7 + latency) / 8;
+        if (latency > stats.maxAckLatencyMs)
+        {
+            stats.maxAckLatencyMs = latency;
+        }
+    }
+    changed.notify_all();
+    return true;
+}
+
+// Called with mutex held. A newer command of the same kind carries a more recent value, so
+// resending this one would be wasted (and could overwrite the newer value on the light).
+bool BtAckTracker::isSuperseded(const Entry &entry)
+{
+    for (const Entry &other : entries)
+    {
+        if (&other != &entry && other.cmd == entry.cmd &&
+            (other.state == BtAckState::QUEUED || (other.state == BtAckState::SENT && (int32_t)(other.sentAt - entry.sentAt) >= 0)) &&
+            memcmp(other.device, entry.device, sizeof(other.device)) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t BtAckTracker::expire(uint32_t nowMs, BtCompletionId *retransmit, size_t max)
+{
+    size_t count = 0;
+    bool timedOut = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t slot = 0; slot < BT_ACK_TRACKER_CAPACITY; slot++)
+        {
+            Entry &entry = entries[slot];
+            if (entry.state != BtAckState::SENT || (int32_t)(nowMs - entry.deadline) < 0)
+            {
+                continue;
+            }
+            if (entry.attempts > BT_ACK_MAX_RETRANSMITS || count == max || isSuperseded(entry))
+            {
+                finish(entry, BtAckState::TIMED_OUT);
+                timedOut = true;
+                continue;
+            }
+            entry.state = BtAckState::QUEUED;
+            retransmit[count++] = {(uint16_t)slot, entry.generation};
+        }
+    }
+    if (timedOut)
+    {
+        changed.notify_all();
+    }
+    return count;
+}
+
+// Called with mutex held. Finds the device's entry, taking over the oldest one when all are in use.
+BtAckTracker::Device &BtAckTracker::deviceFor(const uint8_t address[6])
+{
+    Device *free = nullptr;
+    for (Device &candidate : devices)
+    {
+        if (!candidate.used)
+        {
+            free = free ? free : &candidate;
+        }
+        else if (memcmp(candidate.stats.address, address, sizeof(candidate.stats.address)) == 0)
+        {
+            return candidate;
+        }
+    }
+    if (!free)
+    {
+        free = &devices[nextDevice];
+        nextDevice = (nextDevice + 1) % BT_ACK_DEVICE_CAPACITY;
+    }
+    *free = Device();
+    free->used = true;
+    memcpy(free->stats.address, address, sizeof(free->stats.address));
+    free->stats.timeoutMs = BT_ACK_INITIAL_TIMEOUT_MS;
+    return *free;
+}
+
+uint32_t BtAckTracker::timeoutFor(const Device &device)
+{
+    if (!device.hasLatency)
+    {
+        return BT_ACK_INITIAL_TIMEOUT_MS;
+    }
+    uint32_t timeout = device.smoothedMs + 4 * device.variationMs;
+    if (timeout < BT_ACK_MIN_TIMEOUT_MS)
+    {
+        return BT_ACK_MIN_TIMEOUT_MS;
+    }
+    return timeout < BT_ACK_MAX_TIMEOUT_MS ? timeout : BT_ACK_MAX_TIMEOUT_MS;
+}
+
+// RFC 6298 smoothing: 1/8 of each sample goes into the latency, 1/4 into its variation
+void BtAckTracker::updateLatency(Device &device, uint32_t latencyMs)
+{
+    if (!device.hasLatency)
+    {
+        device.smoothedMs = latencyMs;
+        device.variationMs = latencyMs / 2;
+        device.hasLatency = true;
+    }
+    else
+    {
+        uint32_t error = latencyMs > device.smoothedMs ? latencyMs - device.smoothedMs : device.smoothedMs - latencyMs;
+        device.variationMs = (device.variationMs * 3 + error) / 4;
+        device.smoothedMs = (device.smoothedMs * 7 + latencyMs) / 8;
+    }
+    device.stats.timeoutMs = timeoutFor(device);
+}
+
+BtAckState BtAckTracker::state(BtCompletionId id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry *entry = find(id);
+    return entry ? entry->state : BtAckState::EXPIRED;
+}
+
+uint8_t BtAckTracker::ackValue(BtCompletionId id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry *entry = find(id);
+    return entry ? entry->ackValue : 0;
+}
+
+bool BtAckTracker::wait(BtCompletionId id, uint32_t timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this, id]
+                     {
+        Entry *entry = find(id);
+        return !entry || isFinal(entry->state); });
+    Entry *entry = find(id);
+    return entry && entry->state == BtAckState::ACKED;
+}
+
+bool BtAckTracker::waitAll(const std::vector<BtCompletion> &completions, uint32_t timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this, &completions]
+                     {
+        for (const BtCompletion &completion : completions)
+        {
+            Entry *entry = find(completion.id());
+            if (entry && !isFinal(entry->state))
+            {
+                return false;
+            }
+        }
+        return true; });
+
+    for (const BtCompletion &completion : completions)
+    {
+        Entry *entry = find(completion.id());
+        if (!entry || entry->state != BtAckState::ACKED)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+BtAckStats BtAckTracker::getStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+std::vector<BtDeviceAckStats> BtAckTracker::getDeviceStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<BtDeviceAckStats> result;
+    for (const Device &device : devices)
+    {
+        if (device.used)
+        {
+            BtDeviceAckStats stats = device.stats;
+            stats.retransmitRate = stats.sent ? (float)stats.retransmits / stats.sent : 0;
+            result.push_back(stats);
+        }
+    }
+    return result;
+}
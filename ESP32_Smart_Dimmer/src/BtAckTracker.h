@@ -0,0 +1,190 @@
+#ifndef BT_ACK_TRACKER_H
+#define BT_ACK_TRACKER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include "CommandType.h"
+
+// Number of commands whose acknowledgement can be tracked at the same time
+const size_t BT_ACK_TRACKER_CAPACITY = 32;
+// Devices whose ACK latency and retransmit counts are kept
+const size_t BT_ACK_DEVICE_CAPACITY = 8;
+// ACK timeout of a device until its first status packet has been timed
+const uint32_t BT_ACK_INITIAL_TIMEOUT_MS = 1000;
+const uint32_t BT_ACK_MIN_TIMEOUT_MS = 100;
+const uint32_t BT_ACK_MAX_TIMEOUT_MS = 2000;
+// Resends of a command with no matching status packet before it is timed out
+const uint8_t BT_ACK_MAX_RETRANSMITS = 2;
+// Longest a command can stay in flight, retransmits included
+const uint32_t BT_ACK_GIVE_UP_MS = BT_ACK_MAX_TIMEOUT_MS * (BT_ACK_MAX_RETRANSMITS + 1);
+
+enum class BtAckState : uint8_t
+{
+    FREE,      // slot not in use
+    QUEUED,    // waiting in the TX queue
+    SENT,      // written to the link, waiting for a status packet
+    ACKED,     // a matching status packet arrived
+    TIMED_OUT, // no status packet after the last retransmit
+    DROPPED,   // never written (link went away, queue cleared)
+    EXPIRED    // the handle's slot has since been reused for another command
+};
+
+struct BtCompletionId
+{
+    uint16_t slot;
+    uint16_t generation; // 0 means "no completion"
+};
+
+struct BtAckStats
+{
+    uint32_t tracked;
+    uint32_t acked;
+    uint32_t timedOut;
+    uint32_t dropped;
+    uint32_t untracked; // commands sent without a handle because every slot was busy
+    uint32_t retransmits;
+    uint32_t lastAckLatencyMs;
+    uint32_t avgAckLatencyMs;
+    uint32_t maxAckLatencyMs;
+};
+
+// Delivery of one device's commands
+struct BtDeviceAckStats
+{
+    uint8_t address[6];
+    uint32_t sent;        // commands written for the first time
+    uint32_t retransmits; // resends after an ACK timeout
+    uint32_t acked;
+    uint32_t timedOut;    // given up on after the last retransmit
+    uint32_t timeoutMs;   // current ACK timeout, from the measured ACK latency
+    float retransmitRate; // retransmits per command sent
+};
+
+class BtAckTracker;
+
+/**
+ * Lightweight handle for one sent command. Copies refer to the same command.
+ * A default constructed handle refers to nothing (e.g. the command was rejected).
+ */
+class BtCompletion
+{
+public:
+    BtCompletion() = default;
+
+    bool isValid() const { return tracker != nullptr; }
+    explicit operator bool() const { return isValid(); }
+    BtCompletionId id() const { return completionId; }
+
+    BtAckState state() const;
+    // Status byte of the acknowledging packet, valid once state() is ACKED
+    uint8_t ackValue() const;
+    // Blocks until the command is no longer queued or in flight, or timeoutMs passes. True if it was acknowledged.
+    bool wait(uint32_t timeoutMs) const;
+
+private:
+    friend class BtAckTracker;
+    BtCompletion(BtAckTracker *tracker, BtCompletionId id) : tracker(tracker), completionId(id) {}
+
+    BtAckTracker *tracker = nullptr;
+    BtCompletionId completionId = {0, 0};
+};
+
+// Where a group of commands stands, e.g. the ones one config went out as
+struct BtCompletionSummary
+{
+    bool pending; // some are still queued or in flight
+    bool failed;  // some were timed out or dropped
+};
+
+BtCompletionSummary summarizeCompletions(const std::vector<BtCompletion> &completions);
+
+/**
+ * Tracks every queued/sent command until the status packet that acknowledges it arrives.
+ * The RX path calls acknowledge(), which wakes the waiters of that command directly.
+ *
+ * Each device gets its own ACK timeout, derived from its measured ACK latency the way TCP
+ * derives its retransmit timeout (smoothed latency + 4 x variation, doubled per retransmit).
+ * A command that is not acknowledged in time is handed back for a retransmit, at most
+ * BT_ACK_MAX_RETRANSMITS times, unless a newer command of the same kind is already on its way.
+ */
+class BtAckTracker
+{
+public:
+    BtAckTracker();
+
+    BtCompletion track(const uint8_t device[6], CommandType cmd);
+    BtCompletion handleFor(BtCompletionId id);
+    // Frees a slot that was tracked but never queued
+    void release(BtCompletionId id);
+
+    // Starts (or restarts, for a retransmit) the command's ACK timeout
+    void markSent(BtCompletionId id, uint32_t nowMs);
+    void markDropped(BtCompletionId id);
+    // Counts a retransmit handed out by expire() once the caller queued it
+    void markRetransmitQueued(BtCompletionId id);
+    // Gives up on a command handed out for a retransmit that could not be queued
+    void markTimedOut(BtCompletionId id);
+    // Drops every queued or in-flight command of the device (e.g. its link closed)
+    void dropDevice(const uint8_t device[6]);
+    // Acknowledges the oldest in-flight command of the device answered by this status function
+    bool acknowledge(const uint8_t device[6], uint8_t rxFunction, uint8_t value, uint32_t nowMs);
+    /**
+     * Handles sent commands whose ACK timeout passed: each one is either put back to QUEUED and
+     * its id written to retransmit (the caller queues the packet again, then reports it with
+     * markRetransmitQueued or markTimedOut), or timed out.
+     * @return the number of ids written, at most max.
+     */
+    size_t expire(uint32_t nowMs, BtCompletionId *retransmit, size_t max);
+
+    BtAckState state(BtCompletionId id);
+    uint8_t ackValue(BtCompletionId id);
+    bool wait(BtCompletionId id, uint32_t timeoutMs);
+    // Waits until none of the commands is queued or in flight. True if all of them were acknowledged.
+    bool waitAll(const std::vector<BtCompletion> &completions, uint32_t timeoutMs);
+
+    BtAckStats getStats();
+    std::vector<BtDeviceAckStats> getDeviceStats();
+
+private:
+    struct Entry
+    {
+        BtAckState state;
+        uint16_t generation;
+        CommandType cmd;
+        uint8_t device[6];
+        uint8_t ackValue;
+        uint8_t attempts; // writes so far, retransmits included
+        uint32_t sentAt;  // last write
+        uint32_t deadline;
+    };
+
+    struct Device
+    {
+        bool used;
+        bool hasLatency;
+        uint32_t smoothedMs;
+        uint32_t variationMs;
+        BtDeviceAckStats stats;
+    };
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    Entry entries[BT_ACK_TRACKER_CAPACITY];
+    size_t nextSlot = 0;
+    BtAckStats stats;
+    Device devices[BT_ACK_DEVICE_CAPACITY];
+    size_t nextDevice = 0;
+
+    Entry *find(BtCompletionId id);
+    static bool isFinal(BtAckState state);
+    void finish(Entry &entry, BtAckState state);
+    Device &deviceFor(const uint8_t address[6]);
+    static uint32_t timeoutFor(const Device &device);
+    void updateLatency(Device &device, uint32_t latencyMs);
+    bool isSuperseded(const Entry &entry);
+};
+
+#endif // BT_ACK_TRACKER_H
@@ -0,0 +1,84 @@
+#include "BtCapture.h"
+#include "BtPlatform.h"
+#include <string.h>
+
+BtCapture::BtCapture()
+    : records()
+{
+}
+
+void BtCapture::record(BtCaptureDirection direction, const uint8_t device[6], uint8_t cmd, const uint8_t *data, size_t len)
+{
+    uint64_t now = btMicros();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!enabled)
+    {
+        return;
+    }
+    BtCaptureRecord &record = records[written % BT_CAPTURE_CAPACITY];
+    record.timeUs = now;
+    memcpy(record.device, device, sizeof(record.device));
+    record.direction = (uint8_t)direction;
+    record.cmd = cmd;
+    record.length = len > sizeof(record.data) ? sizeof(record.data) : len;
+    memcpy(record.data, data, record.length);
+    memset(record.data + record.length, 0, sizeof(record.data) - record.length);
+    written++;
+}
+
+void BtCapture::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    cleared = written;
+}
+
+void BtCapture::setEnabled(bool enabled)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->enabled = enabled;
+}
+
+bool BtCapture::isEnabled()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return enabled;
+}
+
+BtCaptureHeader BtCapture::makeHeader()
+{
+    uint32_t first, end;
+    range(first, end);
+    BtCaptureHeader header = {};
+    header.magic = BT_CAPTURE_MAGIC;
+    header.version = BT_CAPTURE_VERSION;
+    header.recordSize = sizeof(BtCaptureRecord);
+    std::lock_guard<std::mutex> lock(mutex);
+    header.overwritten = first - cleared;
+    return header;
+}
+
+void BtCapture::range(uint32_t &first, uint32_t &end)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    end = written;
+    uint32_t held = written - cleared < BT_CAPTURE_CAPACITY ? written - cleared : BT_CAPTURE_CAPACITY;
+    first = written - held;
+}
+
+size_t BtCapture::read(uint32_t &from, uint32_t end, BtCaptureRecord *out, size_t max)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t held = written - cleared < BT_CAPTURE_CAPACITY ? written - cleared : BT_CAPTURE_CAPACITY;
+    uint32_t oldest = written - held;
+    if ((int32_t)(from - oldest) < 0)
+    {
+        from = oldest;
+    }
+    size_t count = 0;
+    while (count < max && (int32_t)(end - from) > 0)
+    {
+        out[count++] = records[from % BT_CAPTURE_CAPACITY];
+        from++;
+    }
+    return count;
+}
@@ -0,0 +1,81 @@
+#ifndef BT_CAPTURE_H
+#define BT_CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include "BtTxQueue.h"
+#include "BtRxFramer.h"
+
+// Number of packets kept; the oldest are overwritten (48 bytes each). Host tools build with a bigger one.
+#ifndef BT_CAPTURE_RECORDS
+#define BT_CAPTURE_RECORDS 256
+#endif
+const size_t BT_CAPTURE_CAPACITY = BT_CAPTURE_RECORDS;
+const size_t BT_CAPTURE_DATA_SIZE = BT_MAX_PACKET_SIZE > RX_PACKET_SIZE ? BT_MAX_PACKET_SIZE : RX_PACKET_SIZE;
+const uint32_t BT_CAPTURE_MAGIC = 0x50414342; // "BCAP"
+const uint16_t BT_CAPTURE_VERSION = 1;
+// cmd of received packets
+const uint8_t BT_CAPTURE_CMD_NONE = 0xFF;
+
+enum class BtCaptureDirection : uint8_t
+{
+    TX,
+    RX
+};
+
+// One captured packet. Stored and downloaded as is, so the layout is the file format (little endian).
+struct BtCaptureRecord
+{
+    uint64_t timeUs;  // btMicros() when the packet was written / framed
+    uint8_t device[6];
+    uint8_t direction; // BtCaptureDirection
+    uint8_t cmd;       // CommandType of sent packets, BT_CAPTURE_CMD_NONE for received ones
+    uint8_t length;
+    uint8_t data[BT_CAPTURE_DATA_SIZE];
+    uint8_t reserved[4];
+};
+static_assert(sizeof(BtCaptureRecord) == 48, "capture record layout is the file format");
+
+// Start of a capture file, followed by records up to the end of the file
+struct BtCaptureHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+    uint32_t overwritten; // records lost to the ring buffer before the first one in the file
+    uint32_t reserved;
+};
+static_assert(sizeof(BtCaptureHeader) == 16, "capture header layout is the file format");
+
+/**
+ * Ring buffer of the last BT_CAPTURE_CAPACITY packets sent and received, with microsecond
+ * timestamps. Records are numbered by a running sequence number, so a reader can copy them out
+ * in chunks while new ones are being added.
+ */
+class BtCapture
+{
+public:
+    BtCapture();
+
+    void record(BtCaptureDirection direction, const uint8_t device[6], uint8_t cmd, const uint8_t *data, size_t len);
+    void clear();
+    void setEnabled(bool enabled);
+    bool isEnabled();
+
+    BtCaptureHeader makeHeader();
+    // Sequence numbers of the oldest record held and one past the newest
+    void range(uint32_t &first, uint32_t &end);
+    // Copies up to max records from sequence number `from` (moved past overwritten ones) until `end`.
+    // Advances from and returns the number of records copied.
+    size_t read(uint32_t &from, uint32_t end, BtCaptureRecord *out, size_t max);
+
+private:
+    std::mutex mutex;
+    BtCaptureRecord records[BT_CAPTURE_CAPACITY];
+    uint32_t written = 0; // sequence number of the next record
+    uint32_t cleared = 0; // sequence number of the first record after the last clear()
+    bool enabled = true;
+};
+
+#endif // BT_CAPTURE_H
@@ -0,0 +1,791 @@
+#include "BtCommandPipeline.h"
+#include "BtPlatform.h"
+#include <LightProtocol.h>
+#include <string.h>
+#include <chrono>
+
+const uint32_t WRITER_POLL_TIMEOUT_MS = 100;    // also the granularity of ACK and connect timeouts
+const uint32_t WRITE_COMPLETE_TIMEOUT_MS = 500; // wait for the transport's write completion
+const uint32_t CONNECT_TIMEOUT_MS = 15000;      // channel lookup + open of one link
+const uint32_t LINK_STATS_LOG_INTERVAL_MS = 10000;
+
+BtCommandPipeline::BtCommandPipeline(ITransport &transport, size_t maxLinks)
+    : transport(transport), linkPool(maxLinks)
+{
+}
+
+void BtCommandPipeline::setListener(IBtPipelineListener *listener)
+{
+    this->listener = listener;
+}
+
+bool BtCommandPipeline::begin()
+{
+    log_i("Link pool size: %d", (int)linkPool.getMaxLinks());
+    lastStatsLogMs = btMillis();
+    return transport.begin(this);
+}
+
+size_t BtCommandPipeline::getTxQueueDepth()
+{
+    return txQueue.depth();
+}
+
+BtTxStats BtCommandPipeline::getTxStats()
+{
+    return txQueue.getStats();
+}
+
+BtAckStats BtCommandPipeline::getAckStats()
+{
+    return ackTracker.getStats();
+}
+
+std::vector<BtDeviceAckStats> BtCommandPipeline::getDeviceAckStats()
+{
+    return ackTracker.getDeviceStats();
+}
+
+BtShadowStats BtCommandPipeline::getShadowStats()
+{
+    return shadow.getStats();
+}
+
+std::vector<BtLinkInfo> BtCommandPipeline::getLinks()
+{
+    std::lock_guard<std::mutex> lock(linkMutex);
+    return linkPool.getLinks(btMillis());
+}
+
+BtLinkPoolStats BtCommandPipeline::getLinkPoolStats()
+{
+    std::lock_guard<std::mutex> lock(linkMutex);
+    return linkPool.getStats();
+}
+
+BtReconnectStats BtCommandPipeline::getReconnectStats()
+{
+    std::lock_guard<std::mutex> lock(linkMutex);
+    return reconnects.getStats();
+}
+
+std::vector<BtConnectHistory> BtCommandPipeline::getConnectHistory()
+{
+    std::lock_guard<std::mutex> lock(linkMutex);
+    return reconnects.getHistory(btMillis());
+}
+
+void BtCommandPipeline::invalidateShadow(const uint8_t device[6])
+{
+    shadow.invalidate(device);
+}
+
+bool BtCommandPipeline::lookup(const uint8_t device[6])
+{
+    std::lock_guard<std::mutex> lock(linkMutex);
+    reconnects.onUsed(device, btMillis());
+    return linkPool.lookup(device, btMillis()) != nullptr;
+}
+
+bool BtCommandPipeline::isConnected(const uint8_t device[6])
+{
+    std::lock_guard<std::mutex> lock(linkMutex);
+    BtLink *link = linkPool.find(device);
+    return link && link->state == BtLinkState::CONNECTED;
+}
+
+void BtCommandPipeline::logLinkStats()
+{
+    char mac[BT_ADDRESS_STR_SIZE];
+    for (const BtLinkInfo &info : getLinks())
+    {
+        if (info.state != BtLinkState::CONNECTED)
+        {
+            continue;
+        }
+        log_i("%s: %.1f packets/s, interval %u ms (floor %u ms), %u sent, %u congestions",
+              formatBtAddress(info.address, mac), info.pacing.packetsPerSecond,
+              info.pacing.intervalMs, info.pacing.floorMs, info.pacing.sent, info.pacing.congestions);
+    }
+    for (const BtDeviceAckStats &stats : getDeviceAckStats())
+    {
+        if (stats.retransmits > 0 || stats.timedOut > 0)
+        {
+            log_i("%s: %u sent, %u retransmits (%.1f%%), %u timed out, ACK timeout %u ms",
+                  formatBtAddress(stats.address, mac), stats.sent, stats.retransmits,
+                  stats.retransmitRate * 100, stats.timedOut, stats.timeoutMs);
+        }
+    }
+    BtReconnectStats reconnect = getReconnectStats();
+    if (reconnect.reconnects > 0 || reconnect.preconnects > 0)
+    {
+        log_i("%u reconnects (%u back, %u given up), %u pre-connects (%u used)", reconnect.reconnects,
+              reconnect.reconnected, reconnect.gaveUp, reconnect.preconnects, reconnect.preconnectHits);
+    }
+}
+
+// Called with linkMutex held
+bool BtCommandPipeline::closeLink(BtLink &link)
+{
+    linkPool.setState(link, BtLinkState::CLOSING, btMillis());
+    if (!transport.close(link.handle))
+    {
+        char mac[BT_ADDRESS_STR_SIZE];
+        log_w("Failed to disconnect %s.", formatBtAddress(link.address, mac));
+        return false;
+    }
+    return true;
+}
+
+void BtCommandPipeline::disconnectAll()
+{
+    log_i("Disconnecting all links");
+    std::lock_guard<std::mutex> lock(linkMutex);
+    reconnects.cancelReconnects();
+    BtLink *pending;
+    while ((pending = linkPool.nextPending()) != nullptr)
+    {
+        linkPool.release(*pending);
+    }
+    for (const BtLinkInfo &info : linkPool.getLinks(btMillis()))
+    {
+        BtLink *link = linkPool.find(info.address);
+        if (link && link->state == BtLinkState::CONNECTED)
+        {
+            closeLink(*link);
+        }
+    }
+}
+
+void BtCommandPipeline::connect(const uint8_t device[6], BtConnectReason reason)
+{
+    char mac[BT_ADDRESS_STR_SIZE];
+    std::lock_guard<std::mutex> lock(linkMutex);
+    BtLink *evicted = nullptr;
+    BtLink *link = linkPool.reserve(device, btMillis(), evicted, reason);
+    if (evicted)
+    {
+        log_i("Pool full, closing least recently used link %s", formatBtAddress(evicted->address, mac));
+        if (!closeLink(*evicted))
+        {
+            linkPool.release(*evicted);
+        }
+    }
+    if (!link)
+    {
+        log_w("No free link for %s, every link is still connecting.", formatBtAddress(device, mac));
+        return;
+    }
+    log_i("remoteAddress: %s (link state %d)", formatBtAddress(device, mac), (int)link->state);
+    startNextConnect();
+}
+
+// Called with linkMutex held. Opens are serialized: the stack only runs one SDP / connect at a time.
+void BtCommandPipeline::startNextConnect()
+{
+    if (linkPool.findInProgress())
+    {
+        return;
+    }
+    BtLink *link;
+    while ((link = linkPool.nextPending()) != nullptr)
+    {
+        linkPool.setState(*link, BtLinkState::CONNECTING, btMillis());
+        reconnects.onConnectStarted(link->address, link->reason, btMillis());
+        // A channel known from an earlier connect skips the SDP lookup
+        if (transport.open(link->address, link->scn))
+        {
+            return;
+        }
+        char mac[BT_ADDRESS_STR_SIZE];
+        log_w("Could not start connecting %s", formatBtAddress(link->address, mac));
+        reconnects.onConnectFailed(link->address, btMillis());
+        linkPool.onConnectFailed(*link);
+    }
+}
+
+void BtCommandPipeline::expireStaleConnect(uint32_t nowMs)
+{
+    uint8_t address[6];
+    {
+        std::lock_guard<std::mutex> lock(linkMutex);
+        BtLink *link = linkPool.findInProgress();
+        if (!link || nowMs - link->stateSinceMs < CONNECT_TIMEOUT_MS)
+        {
+            return;
+        }
+        char mac[BT_ADDRESS_STR_SIZE];
+        log_w("Connecting %s timed out.", formatBtAddress(link->address, mac));
+        memcpy(address, link->address, sizeof(address));
+        reconnects.onConnectFailed(link->address, nowMs);
+        linkPool.onConnectFailed(*link);
+        startNextConnect();
+    }
+    postLinkEvent(LinkEventType::CONNECT_FAILED, address);
+}
+
+// Opens a dropped link again once its backoff ran out, or else the link most likely needed next.
+// Only one at a time, only while no other connect waits, and never at the cost of an open link.
+void BtCommandPipeline::maintainLinks(uint32_t nowMs)
+{
+    uint8_t address[6];
+    BtConnectReason reason;
+    {
+        std::lock_guard<std::mutex> lock(linkMutex);
+        if (linkPool.findInProgress() || linkPool.nextPending() || !linkPool.hasFreeLink())
+        {
+            return;
+        }
+        if (reconnects.nextReconnect(nowMs, address))
+        {
+            reason = BtConnectReason::RECONNECT;
+        }
+        else if (reconnects.nextPreconnect(nowMs, address))
+        {
+            reason = BtConnectReason::PREDICTED;
+        }
+        else
+        {
+            return;
+        }
+    }
+    char mac[BT_ADDRESS_STR_SIZE];
+    log_i("%s %s", reason == BtConnectReason::RECONNECT ? "Reconnecting" : "Pre-connecting", formatBtAddress(address, mac));
+    connect(address, reason);
+}
+
+// Encodes into out if the payload has the size the command expects. Returns the packet size, or 0.
+template <typename Cmd>
+static size_t encodeCommand(uint8_t *out, const uint8_t *payload, size_t payloadSize)
+{
+    if (payloadSize != Cmd::PAYLOAD_SIZE)
+    {
+        return 0;
+    }
+    return Cmd::encodeInto(out, payload);
+}
+
+BtCompletion BtCommandPipeline::send(const uint8_t device[6], CommandType cmd, const uint8_t *payload, size_t payloadSize,
+                                     BtPriority priority)
+{
+    const char *commandName = commandTypeName(cmd);
+    log_d("command: %s", commandName);
+
+    BtPacket packet;
+    size_t packetSize = 0;
+    switch (cmd)
+    {
+    case CMD_LIGHT_ON_OFF:
+        packetSize = encodeCommand<LightProtocol::OnOff>(packet.data, payload, payloadSize);
+        break;
+    case CMD_LIGHT_INTENSITY:
+        packetSize = encodeCommand<LightProtocol::Intensity>(packet.data, payload, payloadSize);
+        break;
+    case CMD_LIGHT_WARMNESS:
+        packetSize = encodeCommand<LightProtocol::Warmness>(packet.data, payload, payloadSize);
+        break;
+    case CMD_RGB:
+        packetSize = encodeCommand<LightProtocol::Rgb>(packet.data, payload, payloadSize);
+        break;
+    case CMD_FAN_SPEED:
+        packetSize = encodeCommand<LightProtocol::FanSpeed>(packet.data, payload, payloadSize);
+        break;
+    default:
+        log_w("Unknown command type.");
+        return BtCompletion();
+    }
+
+    if (packetSize == 0)
+    {
+        log_w("Wrong payload size for %s (%d bytes).", commandName, (int)payloadSize);
+        return BtCompletion();
+    }
+
+    BtCompletionId previous;
+    if (shadow.matches(device, cmd, payload, payloadSize, ackTracker, previous))
+    {
+        log_d("%s unchanged, not sent", commandName);
+        return ackTracker.handleFor(previous);
+    }
+
+    packet.size = packetSize;
+    packet.cmd = cmd;
+    packet.priority = priority;
+    memcpy(packet.device, device, sizeof(packet.device));
+    packet.enqueuedAt = btMillis();
+
+    BtCompletion completion = ackTracker.track(packet.device, cmd);
+    packet.completion = completion.id();
+
+    switch (txQueue.push(packet))
+    {
+    case BtPushResult::REJECTED:
+        log_w("TX queue full, dropping %s.", commandName);
+        ackTracker.release(completion.id());
+        return BtCompletion();
+    case BtPushResult::COALESCED:
+        // The waiting packet now carries our value; share its completion
+        ackTracker.release(completion.id());
+        shadow.record(device, cmd, payload, payloadSize, packet.completion);
+        return ackTracker.handleFor(packet.completion);
+    default:
+        shadow.record(device, cmd, payload, payloadSize, completion.id());
+        wakeWriter();
+        return completion;
+    }
+}
+
+void BtCommandPipeline::postLinkEvent(LinkEventType type, const uint8_t address[6], BtConnectReason reason)
+{
+    if (!listener)
+    {
+        return;
+    }
+    LinkEvent event;
+    event.type = type;
+    memcpy(event.address, address, sizeof(event.address));
+    event.reason = reason;
+    {
+        std::lock_guard<std::mutex> lock(eventMutex);
+        linkEvents.push_back(event);
+    }
+    wakeWriter();
+}
+
+// Writer only: calls the listener for the link events posted since the last call, in order
+void BtCommandPipeline::dispatchLinkEvents()
+{
+    std::vector<LinkEvent> events;
+    {
+        std::lock_guard<std::mutex> lock(eventMutex);
+        events.swap(linkEvents);
+    }
+    for (const LinkEvent &event : events)
+    {
+        switch (event.type)
+        {
+        case LinkEventType::OPENED:
+            listener->onLinkOpened(event.address, event.reason);
+            break;
+        case LinkEventType::CLOSED:
+            listener->onLinkClosed(event.address);
+            break;
+        case LinkEventType::CONNECT_FAILED:
+            listener->onConnectFailed(event.address);
+            break;
+        }
+    }
+}
+
+void BtCommandPipeline::wakeWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        wakeRequested = true;
+    }
+    wakeCondition.notify_one();
+}
+
+void BtCommandPipeline::waitForWake(uint32_t timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(wakeMutex);
+    wakeCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]
+                           { return wakeRequested; });
+    wakeRequested = false;
+}
+
+void BtCommandPipeline::runWriter()
+{
+    running = true;
+    while (running)
+    {
+        processNext(WRITER_POLL_TIMEOUT_MS);
+    }
+}
+
+void BtCommandPipeline::stop()
+{
+    running = false;
+}
+
+// Queues the commands whose ACK timed out again, from the copy kept when they were written
+void BtCommandPipeline::retransmitExpired()
+{
+    BtCompletionId due[BT_ACK_TRACKER_CAPACITY];
+    size_t count = ackTracker.expire(btMillis(), due, BT_ACK_TRACKER_CAPACITY);
+    for (size_t i = 0; i < count; i++)
+    {
+        BtPacket &packet = inFlight[due[i].slot];
+        if (packet.completion.generation != due[i].generation)
+        {
+            ackTracker.markTimedOut(due[i]);
+            continue;
+        }
+        log_d("No ACK for %s, retransmitting", commandTypeName(packet.cmd));
+        packet.enqueuedAt = btMillis();
+        if (txQueue.pushRetransmit(packet))
+        {
+            ackTracker.markRetransmitQueued(due[i]);
+        }
+        else
+        {
+            ackTracker.markTimedOut(due[i]);
+        }
+    }
+}
+
+bool BtCommandPipeline::processNext(uint32_t timeoutMs)
+{
+    retransmitExpired();
+    expireStaleConnect(btMillis());
+    maintainLinks(btMillis());
+    dispatchLinkEvents();
+    if (btMillis() - lastStatsLogMs >= LINK_STATS_LOG_INTERVAL_MS)
+    {
+        lastStatsLogMs = btMillis();
+        logLinkStats();
+    }
+
+    // Each link has its own adaptive pace and one write in flight. The packets of a link that has to
+    // wait stay queued while those of the other links go ahead of them.
+    uint8_t busy[BT_LINK_POOL_CAPACITY][6];
+    size_t busyCount;
+    uint32_t waitMs = timeoutMs;
+    {
+        std::lock_guard<std::mutex> lock(linkMutex);
+        busyCount = findBusyLinks(btMillis(), busy, waitMs);
+    }
+    BtPacket packet;
+    if (!txQueue.pop(packet, btMillis(), [&busy, busyCount](const BtPacket &candidate)
+                     {
+                         for (size_t i = 0; i < busyCount; i++)
+                         {
+                             if (memcmp(busy[i], candidate.device, sizeof(candidate.device)) == 0)
+                             {
+                                 return false;
+                             }
+                         }
+                         return true;
+                     }))
+    {
+        // New packets, write completions and cleared congestion wake us early
+        waitForWake(waitMs);
+        return false;
+    }
+
+    uint32_t handle = 0;
+    {
+        std::lock_guard<std::mutex> lock(linkMutex);
+        BtLink *link = linkPool.find(packet.device);
+        if (link && link->state == BtLinkState::CONNECTED)
+        {
+            uint32_t now = btMillis();
+            handle = link->handle;
+            link->pacer.onSend(now);
+            link->writing = true;
+            link->writeStartedMs = now;
+            link->writeEnqueuedAt = packet.enqueuedAt;
+            link->writePriority = packet.priority;
+        }
+    }
+
+    if (handle == 0)
+    {
+        log_w("Dropping queued packet: its device is no longer connected.");
+        txQueue.recordDropped();
+        ackTracker.markDropped(packet.completion);
+        return true;
+    }
+
+    log_d("Sending %s (%d bytes)", commandTypeName(packet.cmd), (int)packet.size);
+    capture.record(BtCaptureDirection::TX, packet.device, packet.cmd, packet.data, packet.size);
+
+    if (packet.completion.generation != 0)
+    {
+        inFlight[packet.completion.slot] = packet;
+    }
+    // Marked sent before the write: a fast light can answer before the write completion arrives
+    ackTracker.markSent(packet.completion, btMillis());
+    if (!transport.write(handle, packet.data, packet.size))
+    {
+        log_w("Transport write failed, dropping packet.");
+        {
+            std::lock_guard<std::mutex> lock(linkMutex);
+            BtLink *link = linkPool.findByHandle(handle);
+            if (link)
+            {
+                link->writing = false;
+            }
+        }
+        txQueue.recordDropped();
+        ackTracker.markDropped(packet.completion);
+    }
+    return true;
+}
+
+// Called with linkMutex held. Copies the addresses of the connected links that may not write yet
+// (paced, congested or waiting for a write completion) to busy and returns how many there are.
+// waitMs is lowered to the time until the first of them may write.
+size_t BtCommandPipeline::findBusyLinks(uint32_t nowMs, uint8_t busy[][6], uint32_t &waitMs)
+{
+    BtLink *links[BT_LINK_POOL_CAPACITY];
+    size_t connected = linkPool.connected(links);
+    size_t count = 0;
+    for (size_t i = 0; i < connected; i++)
+    {
+        BtLink &link = *links[i];
+        if (link.writing && nowMs - link.writeStartedMs >= WRITE_COMPLETE_TIMEOUT_MS)
+        {
+            char mac[BT_ADDRESS_STR_SIZE];
+            log_w("No write completion from %s within %d ms.", formatBtAddress(link.address, mac),
+                  (int)WRITE_COMPLETE_TIMEOUT_MS);
+            finishWrite(link, false, false, nowMs);
+        }
+        uint32_t delay = link.writing ? WRITE_COMPLETE_TIMEOUT_MS - (nowMs - link.writeStartedMs)
+                                      : link.pacer.delayBefore(nowMs);
+        if (delay == 0)
+        {
+            continue;
+        }
+        memcpy(busy[count++], link.address, sizeof(link.address));
+        if (delay < waitMs)
+        {
+            waitMs = delay;
+        }
+    }
+    return count;
+}
+
+// Called with linkMutex held
+void BtCommandPipeline::finishWrite(BtLink &link, bool ok, bool congested, uint32_t nowMs)
+{
+    link.pacer.onWriteComplete(ok, congested, nowMs);
+    if (link.writing)
+    {
+        link.writing = false;
+        txQueue.recordSent(link.writePriority, link.writeEnqueuedAt, nowMs);
+    }
+}
+
+void BtCommandPipeline::onTransportOpen(const uint8_t address[6], uint32_t handle, uint8_t channel, bool ok)
+{
+    char mac[BT_ADDRESS_STR_SIZE];
+    bool opened = false;
+    bool failed = false;
+    BtConnectReason reason = BtConnectReason::REQUESTED;
+    {
+        std::lock_guard<std::mutex> lock(linkMutex);
+        BtLink *link = linkPool.find(address);
+        if (!link || link->state != BtLinkState::CONNECTING)
+        {
+            if (ok)
+            {
+                // Open that already timed out or was dropped
+                log_w("Unexpected link to %s, closing it.", formatBtAddress(address, mac));
+                transport.close(handle);
+            }
+            return;
+        }
+        if (ok)
+        {
+            linkPool.onConnected(*link, handle, channel, btMillis());
+            reconnects.onConnected(link->address, btMillis());
+            reason = link->reason;
+            // The light may have been changed while we were away (e.g. with its remote)
+            shadow.invalidate(link->address);
+            opened = true;
+        }
+        else
+        {
+            log_w("Connecting %s failed.", formatBtAddress(address, mac));
+            reconnects.onConnectFailed(link->address, btMillis());
+            linkPool.onConnectFailed(*link);
+            failed = true;
+        }
+        startNextConnect();
+    }
+    if (opened)
+    {
+        log_i("Target device connected successfully. mac: %s", formatBtAddress(address, mac));
+        postLinkEvent(LinkEventType::OPENED, address, reason);
+    }
+    if (failed)
+    {
+        postLinkEvent(LinkEventType::CONNECT_FAILED, address);
+    }
+}
+
+void BtCommandPipeline::onTransportClose(uint32_t handle)
+{
+    uint8_t address[6];
+    {
+        std::lock_guard<std::mutex> lock(linkMutex);
+        BtLink *link = linkPool.findByHandle(handle);
+        if (!link)
+        {
+            return;
+        }
+        char mac[BT_ADDRESS_STR_SIZE];
+        log_i("Target device disconnected. mac: %s", formatBtAddress(link->address, mac));
+        memcpy(address, link->address, sizeof(address));
+        // Queued packets for the device are dropped by the writer
+        ackTracker.dropDevice(link->address);
+        // A link we did not close ourselves dropped: bring it back if it was in use
+        reconnects.onClosed(link->address, link->state == BtLinkState::CLOSING, btMillis());
+        linkPool.release(*link);
+        startNextConnect();
+    }
+    postLinkEvent(LinkEventType::CLOSED, address);
+}
+
+void BtCommandPipeline::onTransportData(uint32_t handle, const uint8_t *data, size_t len)
+{
+    // Frame status packets straight out of the transport's buffer, with the link's own framer
+    std::vector<BtStatus> statuses;
+    uint8_t address[6];
+    {
+        std::lock_guard<std::mutex> lock(linkMutex);
+        BtLink *link = linkPool.findByHandle(handle);
+        if (!link)
+        {
+            return;
+        }
+        memcpy(address, link->address, sizeof(address));
+        const uint8_t *packet;
+        BtStatus status;
+        while ((packet = link->framer.next(data, len)) != nullptr)
+        {
+            capture.record(BtCaptureDirection::RX, link->address, BT_CAPTURE_CMD_NONE, packet, RX_PACKET_SIZE);
+            if (decodeStatus(*link, packet, status))
+            {
+                // State first, so whoever waits for the ACK already sees what the light reported
+                updateDeviceState(link->address, status);
+                ackTracker.acknowledge(link->address, status.function, status.state, status.receivedAt);
+                statuses.push_back(status);
+            }
+        }
+    }
+    if (listener)
+    {
+        for (const BtStatus &status : statuses)
+        {
+            listener->onStatus(address, status);
+        }
+    }
+}
+
+void BtCommandPipeline::onTransportWriteComplete(uint32_t handle, bool ok, bool congested)
+{
+    {
+        std::lock_guard<std::mutex> lock(linkMutex);
+        BtLink *link = linkPool.findByHandle(handle);
+        if (link)
+        {
+            finishWrite(*link, ok, congested, btMillis());
+        }
+    }
+    wakeWriter();
+}
+
+void BtCommandPipeline::onTransportCongestion(uint32_t handle, bool congested)
+{
+    {
+        std::lock_guard<std::mutex> lock(linkMutex);
+        BtLink *link = linkPool.findByHandle(handle);
+        if (link)
+        {
+            link->pacer.onCongestion(congested, btMillis());
+        }
+    }
+    if (!congested)
+    {
+        wakeWriter();
+    }
+}
+
+// Called with linkMutex held. Decodes the packet and keeps it as the link's latest status.
+bool BtCommandPipeline::decodeStatus(BtLink &link, const uint8_t *packet, BtStatus &status)
+{
+    status.function = packet[RX_PACKET_FUNCTION_BYTE_IDX];
+    status.state = packet[RX_PACKET_FAN_STATE_BYTE_IDX];
+    memcpy(status.raw, packet, RX_PACKET_SIZE);
+    status.receivedAt = btMillis();
+    log_d("status packet: function 0x%02x, state %d", status.function, status.state);
+
+    if (status.function == RX_PACKET_FUNCTION_FAN)
+    {
+        link.lastFanStatus = status;
+        link.hasFanStatus = true;
+        return true;
+    }
+    if (status.function == RX_PACKET_FUNCTION_LIGHT)
+    {
+        link.lastLightStatus = status;
+        link.hasLightStatus = true;
+        return true;
+    }
+    log_w("Unknown status function 0x%02x", status.function);
+    return false;
+}
+
+// Keeps the device's live state, and lets the shadow state know when the light no longer holds
+// what we last sent it (it was changed with its remote)
+void BtCommandPipeline::updateDeviceState(const uint8_t device[6], const BtStatus &status)
+{
+    if (!deviceStates.apply(device, status))
+    {
+        return;
+    }
+    BtDeviceState state;
+    deviceStates.get(device, state);
+    if (status.function == RX_PACKET_FUNCTION_FAN)
+    {
+        shadow.observe(device, CMD_FAN_SPEED, &state.fanSpeed, 1);
+    }
+    else
+    {
+        uint8_t power = state.isOn ? LightProtocol::LIGHT_ON : LightProtocol::LIGHT_OFF;
+        shadow.observe(device, CMD_LIGHT_ON_OFF, &power, 1);
+    }
+}
+
+bool BtCommandPipeline::getDeviceState(const uint8_t device[6], BtDeviceState &state)
+{
+    return deviceStates.get(device, state);
+}
+
+std::vector<BtDeviceState> BtCommandPipeline::getDeviceStates()
+{
+    return deviceStates.getAll();
+}
+
+bool BtCommandPipeline::getLastStatus(const uint8_t device[6], uint8_t function, BtStatus &status)
+{
+    std::lock_guard<std::mutex> lock(linkMutex);
+    BtLink *link = linkPool.find(device);
+    if (!link)
+    {
+        return false;
+    }
+    if (function == RX_PACKET_FUNCTION_FAN && link->hasFanStatus)
+    {
+        status = link->lastFanStatus;
+        return true;
+    }
+    if (function == RX_PACKET_FUNCTION_LIGHT && link->hasLightStatus)
+    {
+        status = link->lastLightStatus;
+        return true;
+    }
+    return false;
+}
+
+bool BtCommandPipeline::waitForAck(const std::vector<BtCompletion> &completions, uint32_t timeoutMs)
+{
+    if (!ackTracker.waitAll(completions, timeoutMs))
+    {
+        log_w("waitForAck: not every command was acknowledged within %u ms", timeoutMs);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,158 @@
+#ifndef BT_COMMAND_PIPELINE_H
+#define BT_COMMAND_PIPELINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include "CommandType.h"
+#include "ITransport.h"
+#include "BtTxQueue.h"
+#include "BtRxFramer.h"
+#include "BtAckTracker.h"
+#include "BtLinkPool.h"
+#include "BtReconnectManager.h"
+#include "BtShadowState.h"
+#include "BtDeviceState.h"
+#include "BtCapture.h"
+
+// Called without any pipeline lock held. The link callbacks come from the writer (see processNext),
+// so they may take their time; onStatus comes straight from the transport's thread.
+class IBtPipelineListener
+{
+public:
+    virtual void onLinkOpened(const uint8_t address[6], BtConnectReason reason) = 0;
+    virtual void onLinkClosed(const uint8_t address[6]) = 0;
+    virtual void onConnectFailed(const uint8_t address[6]) = 0;
+    virtual void onStatus(const uint8_t address[6], const BtStatus &status) = 0;
+    virtual ~IBtPipelineListener() = default;
+};
+
+/**
+ * Everything between "send this command to that light" and the transport: encoding, shadow
+ * state, TX queue, per-link pacing, the link pool (kept warm by reconnects and pre-connects),
+ * RX framing and ACK tracking.
+ * It does not depend on Arduino or the ESP-IDF, so it runs unchanged on a host over a
+ * pty / socket transport for benchmarks and load tests.
+ */
+class BtCommandPipeline : public ITransportListener
+{
+public:
+    BtCommandPipeline(ITransport &transport, size_t maxLinks);
+
+    void setListener(IBtPipelineListener *listener);
+    bool begin();
+
+    // Looks up the device's link for sending and counts a pool hit or miss
+    bool lookup(const uint8_t device[6]);
+    bool isConnected(const uint8_t device[6]);
+    // Reserves a link for the device and starts opening it unless another open is running
+    void connect(const uint8_t device[6], BtConnectReason reason = BtConnectReason::REQUESTED);
+    // Closes every link and cancels the scheduled reconnects
+    void disconnectAll();
+
+    // Encodes the command and queues it for the writer. See BluetoothManager::sendCommand.
+    BtCompletion send(const uint8_t device[6], CommandType cmd, const uint8_t *payload, size_t payloadSize,
+                      BtPriority priority = BtPriority::NORMAL);
+    // Marks the device's whole shadow state dirty, so every field is sent again
+    void invalidateShadow(const uint8_t device[6]);
+    bool getLastStatus(const uint8_t device[6], uint8_t function, BtStatus &status);
+    // What the device last reported through its status packets
+    bool getDeviceState(const uint8_t device[6], BtDeviceState &state);
+    std::vector<BtDeviceState> getDeviceStates();
+    bool waitForAck(const std::vector<BtCompletion> &completions, uint32_t timeoutMs);
+
+    /**
+     * Writer step: runs the ACK / connect timeouts, reconnects and pre-connects and delivers the link events
+     * to the listener, then writes at most one packet
+     * whose link may write now. Without one it waits up to timeoutMs, or less when a paced link gets ready sooner.
+     * Pacing and write completions are tracked per link here, so senders never block.
+     * @return true if a packet was taken off the queue.
+     */
+    bool processNext(uint32_t timeoutMs);
+    // Calls processNext until stop()
+    void runWriter();
+    void stop();
+
+    size_t getTxQueueDepth();
+    BtTxStats getTxStats();
+    BtAckStats getAckStats();
+    std::vector<BtDeviceAckStats> getDeviceAckStats();
+    BtShadowStats getShadowStats();
+    std::vector<BtLinkInfo> getLinks();
+    BtLinkPoolStats getLinkPoolStats();
+    BtReconnectStats getReconnectStats();
+    // Connect latency, success rate and recent use of each known device
+    std::vector<BtConnectHistory> getConnectHistory();
+    size_t getMaxLinks() const { return linkPool.getMaxLinks(); }
+    // Every packet written and every status packet framed
+    BtCapture &getCapture() { return capture; }
+
+    // ITransportListener
+    void onTransportOpen(const uint8_t address[6], uint32_t handle, uint8_t channel, bool ok) override;
+    void onTransportClose(uint32_t handle) override;
+    void onTransportData(uint32_t handle, const uint8_t *data, size_t len) override;
+    void onTransportWriteComplete(uint32_t handle, bool ok, bool congested) override;
+    void onTransportCongestion(uint32_t handle, bool congested) override;
+
+private:
+    ITransport &transport;
+    IBtPipelineListener *listener = nullptr;
+    BtTxQueue txQueue;
+    BtAckTracker ackTracker;
+    BtShadowState shadow;
+    BtDeviceStateTable deviceStates;
+    BtCapture capture;
+    // Copy of each packet in flight, by its completion slot, for retransmits. Writer only.
+    BtPacket inFlight[BT_ACK_TRACKER_CAPACITY];
+
+    // Guards linkPool and reconnects (touched by senders, the writer and the transport's thread)
+    std::mutex linkMutex;
+    BtLinkPool linkPool;
+    BtReconnectManager reconnects;
+
+    // Wakes the writer on new packets, write completions and when a link's congestion clears
+    std::mutex wakeMutex;
+    std::condition_variable wakeCondition;
+    bool wakeRequested = false;
+
+    // Link opens, closes and failed connects for the listener. Posted from the transport's thread and
+    // delivered by the writer, so the listener never holds up the transport's callbacks.
+    enum class LinkEventType : uint8_t
+    {
+        OPENED,
+        CLOSED,
+        CONNECT_FAILED
+    };
+    struct LinkEvent
+    {
+        LinkEventType type;
+        uint8_t address[6];
+        BtConnectReason reason;
+    };
+    std::mutex eventMutex;
+    std::vector<LinkEvent> linkEvents;
+
+    std::atomic<bool> running{false};
+    uint32_t lastStatsLogMs = 0;
+
+    void retransmitExpired();
+    void startNextConnect();
+    void expireStaleConnect(uint32_t nowMs);
+    void maintainLinks(uint32_t nowMs);
+    bool closeLink(BtLink &link);
+    bool decodeStatus(BtLink &link, const uint8_t *packet, BtStatus &status);
+    void updateDeviceState(const uint8_t device[6], const BtStatus &status);
+    void logLinkStats();
+
+    void postLinkEvent(LinkEventType type, const uint8_t address[6], BtConnectReason reason = BtConnectReason::REQUESTED);
+    void dispatchLinkEvents();
+    void wakeWriter();
+    void waitForWake(uint32_t timeoutMs);
+    size_t findBusyLinks(uint32_t nowMs, uint8_t busy[][6], uint32_t &waitMs);
+    void finishWrite(BtLink &link, bool ok, bool congested, uint32_t nowMs);
+};
+
+#endif // BT_COMMAND_PIPELINE_H
@@ -0,0 +1,107 @@
+#include "BtDeviceState.h"
+#include <LightProtocol.h>
+#include <string.h>
+
+const uint8_t MAX_REPORTED_FAN_SPEED = 3;
+
+static uint32_t lastUpdate(const BtDeviceState &state)
+{
+    return state.fanUpdatedMs > state.lightUpdatedMs ? state.fanUpdatedMs : state.lightUpdatedMs;
+}
+
+BtDeviceStateTable::BtDeviceStateTable()
+    : states(), used()
+{
+}
+
+BtDeviceState &BtDeviceStateTable::findOrCreate(const uint8_t address[6], uint32_t nowMs)
+{
+    size_t slot = BT_DEVICE_STATE_CAPACITY;
+    for (size_t i = 0; i < BT_DEVICE_STATE_CAPACITY; i++)
+    {
+        if (used[i] && memcmp(states[i].address, address, sizeof(states[i].address)) == 0)
+        {
+            return states[i];
+        }
+        if (slot == BT_DEVICE_STATE_CAPACITY && !used[i])
+        {
+            slot = i;
+        }
+    }
+    if (slot == BT_DEVICE_STATE_CAPACITY)
+    {
+        slot = 0;
+        for (size_t i = 1; i < BT_DEVICE_STATE_CAPACITY; i++)
+        {
+            if (nowMs - lastUpdate(states[i]) > nowMs - lastUpdate(states[slot]))
+            {
+                slot = i;
+            }
+        }
+    }
+    used[slot] = true;
+    states[slot] = BtDeviceState();
+    memcpy(states[slot].address, address, sizeof(states[slot].address));
+    return states[slot];
+}
+
+bool BtDeviceStateTable::apply(const uint8_t address[6], const BtStatus &status)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (status.function == RX_PACKET_FUNCTION_FAN)
+    {
+        if (status.state > MAX_REPORTED_FAN_SPEED)
+        {
+            return false;
+        }
+        BtDeviceState &state = findOrCreate(address, status.receivedAt);
+        bool changed = !state.hasFanSpeed || state.fanSpeed != status.state;
+        state.hasFanSpeed = true;
+        state.fanSpeed = status.state;
+        state.fanUpdatedMs = status.receivedAt;
+        return changed;
+    }
+    if (status.function == RX_PACKET_FUNCTION_LIGHT)
+    {
+        if (status.state != LightProtocol::LIGHT_ON && status.state != LightProtocol::LIGHT_OFF)
+        {
+            return false;
+        }
+        BtDeviceState &state = findOrCreate(address, status.receivedAt);
+        bool isOn = status.state == LightProtocol::LIGHT_ON;
+        bool changed = !state.hasPower || state.isOn != isOn;
+        state.hasPower = true;
+        state.isOn = isOn;
+        state.lightUpdatedMs = status.receivedAt;
+        return changed;
+    }
+    return false;
+}
+
+bool BtDeviceStateTable::get(const uint8_t address[6], BtDeviceState &state)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < BT_DEVICE_STATE_CAPACITY; i++)
+    {
+        if (used[i] && memcmp(states[i].address, address, sizeof(states[i].address)) == 0)
+        {
+            state = states[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<BtDeviceState> BtDeviceStateTable::getAll()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<BtDeviceState> result;
+    for (size_t i = 0; i < BT_DEVICE_STATE_CAPACITY; i++)
+    {
+        if (used[i])
+        {
+            result.push_back(states[i]);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,50 @@
+#ifndef BT_DEVICE_STATE_H
+#define BT_DEVICE_STATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include <vector>
+#include "BtRxFramer.h"
+
+// Number of devices whose reported state is kept
+const size_t BT_DEVICE_STATE_CAPACITY = 16;
+
+// What a light last reported about itself through its status packets
+struct BtDeviceState
+{
+    uint8_t address[6];
+    bool hasFanSpeed;
+    uint8_t fanSpeed;       // 0 = off .. 3 = high, as in the CMD_FAN_SPEED payload
+    uint32_t fanUpdatedMs;  // when a fan status last arrived
+    bool hasPower;
+    bool isOn;
+    uint32_t lightUpdatedMs; // when a light status last arrived
+};
+
+/**
+ * Live per-device state decoded from the status packets, whatever caused them: our own
+ * commands or the light's remote. Only what the packets are known to carry is decoded: the fan
+ * status state byte is the fan speed, the light status state byte is the power state
+ * (LightProtocol::LIGHT_ON / LIGHT_OFF). Other values are ignored.
+ */
+class BtDeviceStateTable
+{
+public:
+    BtDeviceStateTable();
+
+    // Applies a decoded status packet. True if the device's state changed.
+    bool apply(const uint8_t address[6], const BtStatus &status);
+    bool get(const uint8_t address[6], BtDeviceState &state);
+    std::vector<BtDeviceState> getAll();
+
+private:
+    std::mutex mutex;
+    BtDeviceState states[BT_DEVICE_STATE_CAPACITY];
+    bool used[BT_DEVICE_STATE_CAPACITY];
+
+    // Finds the device's state, taking over the one updated longest ago if needed
+    BtDeviceState &findOrCreate(const uint8_t address[6], uint32_t nowMs);
+};
+
+#endif // BT_DEVICE_STATE_H
@@ -0,0 +1,266 @@
+#include "BtLinkPool.h"
+#include <string.h>
+
+BtLinkPool::BtLinkPool(size_t maxLinks)
+    : maxLinks(maxLinks < BT_LINK_POOL_CAPACITY ? maxLinks : BT_LINK_POOL_CAPACITY), links(), stats(), devices()
+{
+}
+
+BtLink *BtLinkPool::find(const uint8_t address[6])
+{
+    for (BtLink &link : links)
+    {
+        if (link.state != BtLinkState::FREE && memcmp(link.address, address, sizeof(link.address)) == 0)
+        {
+            return &link;
+        }
+    }
+    return nullptr;
+}
+
+BtLink *BtLinkPool::findByHandle(uint32_t handle)
+{
+    for (BtLink &link : links)
+    {
+        if ((link.state == BtLinkState::CONNECTED || link.state == BtLinkState::CLOSING) && link.handle == handle)
+        {
+            return &link;
+        }
+    }
+    return nullptr;
+}
+
+BtLink *BtLinkPool::findInProgress()
+{
+    for (BtLink &link : links)
+    {
+        if (link.state == BtLinkState::CONNECTING)
+        {
+            return &link;
+        }
+    }
+    return nullptr;
+}
+
+BtLink *BtLinkPool::nextPending()
+{
+    BtLink *oldest = nullptr;
+    for (BtLink &link : links)
+    {
+        if (link.state == BtLinkState::PENDING && (!oldest || link.stateSinceMs - oldest->stateSinceMs > 0x80000000u))
+        {
+            oldest = &link;
+        }
+    }
+    return oldest;
+}
+
+BtLink *BtLinkPool::lookup(const uint8_t address[6], uint32_t nowMs)
+{
+    BtLink *link = find(address);
+    if (link && link->state == BtLinkState::CONNECTED)
+    {
+        link->lastUsedMs = nowMs;
+        link->commands++;
+        stats.hits++;
+        return link;
+    }
+    stats.misses++;
+    return nullptr;
+}
+
+size_t BtLinkPool::activeCount()
+{
+    size_t count = 0;
+    for (BtLink &link : links)
+    {
+        if (link.state != BtLinkState::FREE && link.state != BtLinkState::CLOSING)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+BtLink *BtLinkPool::reserve(const uint8_t address[6], uint32_t nowMs, BtLink *&evicted, BtConnectReason reason)
+{
+    evicted = nullptr;
+    BtLink *existing = find(address);
+    if (existing && existing->state != BtLinkState::CLOSING)
+    {
+        existing->lastUsedMs = nowMs;
+        // A connect that was asked for takes over one opened in the background
+        if (reason == BtConnectReason::REQUESTED ||
+            (reason == BtConnectReason::BATCH && existing->reason != BtConnectReason::REQUESTED))
+        {
+            existing->reason = reason;
+        }
+        return existing;
+    }
+
+    if (activeCount() >= maxLinks)
+    {
+        BtLink *lru = nullptr;
+        for (BtLink &link : links)
+        {
+            if (link.state == BtLinkState::CONNECTED && (!lru || nowMs - link.lastUsedMs > nowMs - lru->lastUsedMs))
+            {
+                lru = &link;
+            }
+        }
+        if (!lru)
+        {
+            // Every slot is busy connecting
+            return nullptr;
+        }
+        setState(*lru, BtLinkState::CLOSING, nowMs);
+        stats.evictions++;
+        evicted = lru;
+    }
+
+    for (BtLink &link : links)
+    {
+        if (link.state == BtLinkState::FREE)
+        {
+            release(link);
+            memcpy(link.address, address, sizeof(link.address));
+            link.reason = reason;
+            DeviceCache *known = cached(address);
+            if (known)
+            {
+                link.scn = known->scn;
+                link.pacer.reset(known->intervalMs, known->floorMs);
+            }
+            link.lastUsedMs = nowMs;
+            setState(link, BtLinkState::PENDING, nowMs);
+            return &link;
+        }
+    }
+    return nullptr;
+}
+
+void BtLinkPool::setState(BtLink &link, BtLinkState state, uint32_t nowMs)
+{
+    link.state = state;
+    link.stateSinceMs = nowMs;
+}
+
+void BtLinkPool::onConnected(BtLink &link, uint32_t handle, uint8_t scn, uint32_t nowMs)
+{
+    link.handle = handle;
+    if (scn != 0)
+    {
+        link.scn = scn;
+    }
+    link.lastUsedMs = nowMs;
+    link.framer.reset();
+    setState(link, BtLinkState::CONNECTED, nowMs);
+    remember(link);
+    stats.connects++;
+}
+
+void BtLinkPool::onConnectFailed(BtLink &link)
+{
+    stats.connectFailures++;
+    release(link);
+}
+
+void BtLinkPool::release(BtLink &link)
+{
+    if (link.state == BtLinkState::CONNECTED || link.state == BtLinkState::CLOSING)
+    {
+        remember(link);
+    }
+    link.state = BtLinkState::FREE;
+    link.handle = 0;
+    link.scn = 0;
+    link.commands = 0;
+    link.pacer.reset();
+    link.writing = false;
+    link.hasFanStatus = false;
+    link.hasLightStatus = false;
+    link.framer.reset();
+}
+
+size_t BtLinkPool::connected(BtLink *out[BT_LINK_POOL_CAPACITY])
+{
+    size_t count = 0;
+    for (BtLink &link : links)
+    {
+        if (link.state == BtLinkState::CONNECTED)
+        {
+            out[count++] = &link;
+        }
+    }
+    return count;
+}
+
+size_t BtLinkPool::countInState(BtLinkState state)
+{
+    size_t count = 0;
+    for (BtLink &link : links)
+    {
+        if (link.state == state)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+size_t BtLinkPool::usedCount()
+{
+    return BT_LINK_POOL_CAPACITY - countInState(BtLinkState::FREE);
+}
+
+std::vector<BtLinkInfo> BtLinkPool::getLinks(uint32_t nowMs)
+{
+    std::vector<BtLinkInfo> infos;
+    for (BtLink &link : links)
+    {
+        if (link.state == BtLinkState::FREE)
+        {
+            continue;
+        }
+        BtLinkInfo info;
+        memcpy(info.address, link.address, sizeof(info.address));
+        info.state = link.state;
+        info.handle = link.handle;
+        info.stateSinceMs = link.stateSinceMs;
+        info.lastUsedMs = link.lastUsedMs;
+        info.commands = link.commands;
+        info.pacing = link.pacer.getStats(nowMs);
+        infos.push_back(info);
+    }
+    return infos;
+}
+
+BtLinkPool::DeviceCache *BtLinkPool::cached(const uint8_t address[6])
+{
+    for (DeviceCache &entry : devices)
+    {
+        if (entry.scn != 0 && memcmp(entry.address, address, sizeof(entry.address)) == 0)
+        {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+void BtLinkPool::remember(const BtLink &link)
+{
+    if (link.scn == 0)
+    {
+        return;
+    }
+    DeviceCache *entry = cached(link.address);
+    if (!entry)
+    {
+        entry = &devices[nextDevice];
+        nextDevice = (nextDevice + 1) % BT_LINK_POOL_CAPACITY;
+        memcpy(entry->address, link.address, sizeof(entry->address));
+    }
+    entry->scn = link.scn;
+    entry->intervalMs = link.pacer.getInterval();
+    entry->floorMs = link.pacer.getFloor();
+}
@@ -0,0 +1,137 @@
+#ifndef BT_LINK_POOL_H
+#define BT_LINK_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "BtRxFramer.h"
+#include "BtPacer.h"
+#include "BtTxQueue.h"
+#include "BtReconnectManager.h"
+
+// Upper bound on links the pool can track (including ones still closing); ESP-IDF allows 7 SPP sessions
+const size_t BT_LINK_POOL_CAPACITY = 7;
+
+enum class BtLinkState : uint8_t
+{
+    FREE,
+    PENDING,     // waiting for its turn to connect
+    CONNECTING,  // transport open issued (including the SDP lookup of the SPP channel)
+    CONNECTED,
+    CLOSING      // disconnect issued (e.g. evicted), waiting for the close event
+};
+
+struct BtLink
+{
+    BtLinkState state;
+    uint8_t address[6];
+    uint32_t handle;        // transport handle, valid while CONNECTED/CLOSING
+    uint8_t scn;            // SPP server channel, 0 until discovered
+    BtConnectReason reason; // why the link is (being) opened
+    uint32_t stateSinceMs;  // when the link entered its current state
+    uint32_t lastUsedMs;    // last lookup, drives LRU eviction
+    BtPacer pacer;          // when the next packet may be written
+    bool writing;           // a packet was written and its write completion has not arrived
+    uint32_t writeStartedMs;
+    uint32_t writeEnqueuedAt; // of that packet, for the TX latency stats
+    BtPriority writePriority;
+    uint32_t commands;      // lookups that found the link connected
+    BtRxFramer framer;
+    BtStatus lastFanStatus;
+    BtStatus lastLightStatus;
+    bool hasFanStatus;
+    bool hasLightStatus;
+};
+
+// Copy of a link's state for reporting
+struct BtLinkInfo
+{
+    uint8_t address[6];
+    BtLinkState state;
+    uint32_t handle;
+    uint32_t stateSinceMs;
+    uint32_t lastUsedMs;
+    uint32_t commands;
+    BtPacerStats pacing;
+};
+
+struct BtLinkPoolStats
+{
+    uint32_t hits;            // lookups that found a connected link
+    uint32_t misses;          // lookups that needed a (re)connect
+    uint32_t evictions;       // connected links closed to make room
+    uint32_t connects;        // successful opens
+    uint32_t connectFailures;
+};
+
+/**
+ * Bookkeeping for several SPP links kept open at the same time, with LRU eviction.
+ * The pool does not talk to the transport and is not thread safe; BtCommandPipeline
+ * owns the lock and issues the actual open/close calls.
+ */
+class BtLinkPool
+{
+public:
+    explicit BtLinkPool(size_t maxLinks);
+
+    size_t getMaxLinks() const { return maxLinks; }
+
+    // Any non-free link of the device
+    BtLink *find(const uint8_t address[6]);
+    BtLink *findByHandle(uint32_t handle);
+    // Link the open is currently running for, if any
+    BtLink *findInProgress();
+    // Oldest link still waiting for its turn to connect
+    BtLink *nextPending();
+
+    /**
+     * Looks up the device for sending and counts a hit or a miss.
+     * @return the connected link, or nullptr when a connect is needed.
+     */
+    BtLink *lookup(const uint8_t address[6], uint32_t nowMs);
+
+    /**
+     * Reserves a PENDING link for the device. When the pool is full the least recently used
+     * connected link is marked CLOSING and returned through evicted so the caller can close it.
+     * A link the device already has is upgraded to REQUESTED when a command asks for it.
+     * @return the new link, or nullptr if no room could be made.
+     */
+    BtLink *reserve(const uint8_t address[6], uint32_t nowMs, BtLink *&evicted,
+                    BtConnectReason reason = BtConnectReason::REQUESTED);
+    // True if a link can be reserved without evicting one
+    bool hasFreeLink() { return activeCount() < maxLinks; }
+
+    void setState(BtLink &link, BtLinkState state, uint32_t nowMs);
+    void onConnected(BtLink &link, uint32_t handle, uint8_t scn, uint32_t nowMs);
+    void onConnectFailed(BtLink &link);
+    void release(BtLink &link);
+
+    // Fills out with the connected links and returns how many there are
+    size_t connected(BtLink *out[BT_LINK_POOL_CAPACITY]);
+    size_t countInState(BtLinkState state);
+    // Links in any state but FREE
+    size_t usedCount();
+    std::vector<BtLinkInfo> getLinks(uint32_t nowMs);
+    BtLinkPoolStats getStats() const { return stats; }
+
+private:
+    size_t maxLinks;
+    BtLink links[BT_LINK_POOL_CAPACITY];
+    BtLinkPoolStats stats;
+    // What was learned about recently used devices: their SPP channel, so reconnects can skip SDP,
+    // and their pacing, so a reconnect does not start from the default interval
+    struct DeviceCache
+    {
+        uint8_t address[6];
+        uint8_t scn;
+        uint32_t intervalMs;
+        uint32_t floorMs;
+    } devices[BT_LINK_POOL_CAPACITY];
+    size_t nextDevice = 0;
+
+    size_t activeCount();
+    DeviceCache *cached(const uint8_t address[6]);
+    void remember(const BtLink &link);
+};
+
+#endif // BT_LINK_POOL_H
@@ -0,0 +1,108 @@
+#include "BtPacer.h"
+
+BtPacer::BtPacer()
+{
+    reset();
+}
+
+void BtPacer::reset(uint32_t interval, uint32_t floor)
+{
+    floorMs = floor < BT_PACER_MIN_INTERVAL_MS ? BT_PACER_MIN_INTERVAL_MS : floor;
+    intervalMs = interval < floorMs ? floorMs : interval;
+    lastSendMs = 0;
+    hasSent = false;
+    congested = false;
+    congestedSinceMs = 0;
+    cleanWrites = 0;
+    sent = 0;
+    congestions = 0;
+    windowStartMs = 0;
+    windowCount = 0;
+    packetsPerSecond = 0;
+}
+
+uint32_t BtPacer::delayBefore(uint32_t nowMs) const
+{
+    if (congested && nowMs - congestedSinceMs < BT_PACER_CONGESTION_HOLD_MS)
+    {
+        return BT_PACER_CONGESTION_HOLD_MS - (nowMs - congestedSinceMs);
+    }
+    if (!hasSent)
+    {
+        return 0;
+    }
+    uint32_t elapsed = nowMs - lastSendMs;
+    return elapsed >= intervalMs ? 0 : intervalMs - elapsed;
+}
+
+void BtPacer::onSend(uint32_t nowMs)
+{
+    if (!hasSent || nowMs - windowStartMs >= BT_PACER_RATE_WINDOW_MS)
+    {
+        if (hasSent)
+        {
+            packetsPerSecond = windowCount * 1000.0f / (nowMs - windowStartMs);
+        }
+        windowStartMs = nowMs;
+        windowCount = 0;
+    }
+    windowCount++;
+    sent++;
+    lastSendMs = nowMs;
+    hasSent = true;
+}
+
+void BtPacer::backOff()
+{
+    congestions++;
+    cleanWrites = 0;
+    // Writes at this interval were too fast for the device
+    uint32_t learned = intervalMs + BT_PACER_STEP_MS;
+    floorMs = learned > BT_PACER_MAX_INTERVAL_MS ? BT_PACER_MAX_INTERVAL_MS : learned;
+    intervalMs = intervalMs * 2 > BT_PACER_MAX_INTERVAL_MS ? BT_PACER_MAX_INTERVAL_MS : intervalMs * 2;
+}
+
+void BtPacer::onWriteComplete(bool ok, bool congestedNow, uint32_t nowMs)
+{
+    if (congestedNow)
+    {
+        onCongestion(true, nowMs);
+        return;
+    }
+    if (!ok)
+    {
+        backOff();
+        return;
+    }
+
+    if (++cleanWrites >= BT_PACER_FLOOR_DECAY_WRITES)
+    {
+        // Conditions may have improved since the floor was learned
+        cleanWrites = 0;
+        floorMs = floorMs - BT_PACER_STEP_MS < BT_PACER_MIN_INTERVAL_MS ? BT_PACER_MIN_INTERVAL_MS : floorMs - BT_PACER_STEP_MS;
+    }
+    uint32_t next = intervalMs - BT_PACER_STEP_MS;
+    intervalMs = intervalMs < floorMs + BT_PACER_STEP_MS ? floorMs : next;
+}
+
+void BtPacer::onCongestion(bool congestedNow, uint32_t nowMs)
+{
+    if (congestedNow && !congested)
+    {
+        congestedSinceMs = nowMs;
+        backOff();
+    }
+    congested = congestedNow;
+}
+
+BtPacerStats BtPacer::getStats(uint32_t nowMs) const
+{
+    BtPacerStats stats;
+    stats.intervalMs = intervalMs;
+    stats.floorMs = floorMs;
+    stats.sent = sent;
+    stats.congestions = congestions;
+    // An idle link has no rate, whatever its last window measured
+    stats.packetsPerSecond = hasSent && nowMs - lastSendMs < 2 * BT_PACER_RATE_WINDOW_MS ? packetsPerSecond : 0;
+    return stats;
+}
@@ -0,0 +1,64 @@
+#ifndef BT_PACER_H
+#define BT_PACER_H
+
+#include <stdint.h>
+
+const uint32_t BT_PACER_INITIAL_INTERVAL_MS = 100; // the old fixed MIN_SEND_INTERVAL
+const uint32_t BT_PACER_MIN_INTERVAL_MS = 20;
+const uint32_t BT_PACER_MAX_INTERVAL_MS = 1000;
+const uint32_t BT_PACER_STEP_MS = 5;               // additive decrease per clean write
+const uint32_t BT_PACER_FLOOR_DECAY_WRITES = 100;  // clean writes before the learned floor is probed again
+const uint32_t BT_PACER_CONGESTION_HOLD_MS = 2000; // longest wait for the stack to report the link uncongested
+const uint32_t BT_PACER_RATE_WINDOW_MS = 1000;
+
+struct BtPacerStats
+{
+    uint32_t intervalMs;      // current gap between writes
+    uint32_t floorMs;         // learned minimum interval of the device
+    uint32_t sent;
+    uint32_t congestions;     // congestion events and failed writes
+    float packetsPerSecond;   // effective rate over the last window
+};
+
+/**
+ * Adaptive pacing of one link (AIMD): every clean write completion shortens the interval
+ * between writes by a step, congestion or a failed write doubles it. The interval at which
+ * congestion hit is remembered as the device's floor and is only probed again after
+ * BT_PACER_FLOOR_DECAY_WRITES clean writes. While the stack reports the link congested
+ * nothing is sent.
+ */
+class BtPacer
+{
+public:
+    BtPacer();
+
+    // Starts over from a learned (or the initial) interval
+    void reset(uint32_t intervalMs = BT_PACER_INITIAL_INTERVAL_MS, uint32_t floorMs = BT_PACER_MIN_INTERVAL_MS);
+    // Milliseconds until the next write may go out, 0 if it may go now
+    uint32_t delayBefore(uint32_t nowMs) const;
+    void onSend(uint32_t nowMs);
+    void onWriteComplete(bool ok, bool congested, uint32_t nowMs);
+    void onCongestion(bool congested, uint32_t nowMs);
+
+    uint32_t getInterval() const { return intervalMs; }
+    uint32_t getFloor() const { return floorMs; }
+    BtPacerStats getStats(uint32_t nowMs) const;
+
+private:
+    uint32_t intervalMs;
+    uint32_t floorMs;
+    uint32_t lastSendMs;
+    bool hasSent;
+    bool congested;
+    uint32_t congestedSinceMs;
+    uint32_t cleanWrites;
+    uint32_t sent;
+    uint32_t congestions;
+    uint32_t windowStartMs;
+    uint32_t windowCount;
+    float packetsPerSecond;
+
+    void backOff();
+};
+
+#endif // BT_PACER_H
@@ -0,0 +1,71 @@
+#ifndef BT_PLATFORM_H
+#define BT_PLATFORM_H
+
+// The little the command pipeline needs from the platform: clocks and logging.
+// On the ESP32 these come from the Arduino core; on a host build (tools/host) from the standard library.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <esp_timer.h>
+
+inline uint32_t btMillis()
+{
+    return millis();
+}
+
+// Microseconds since boot; does not wrap like micros()
+inline uint64_t btMicros()
+{
+    return esp_timer_get_time();
+}
+
+#else
+#include <chrono>
+
+inline uint32_t btMillis()
+{
+    static const auto start = std::chrono::steady_clock::now();
+    return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline uint64_t btMicros()
+{
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// 1 error .. 4 debug, like CORE_DEBUG_LEVEL
+#ifndef BT_HOST_LOG_LEVEL
+#define BT_HOST_LOG_LEVEL 2
+#endif
+
+#define BT_HOST_LOG(level, letter, format, ...)                                                    \
+    do                                                                                             \
+    {                                                                                              \
+        if (level <= BT_HOST_LOG_LEVEL)                                                            \
+        {                                                                                          \
+            fprintf(stderr, "[%6u][" letter "] %s(): " format "\n", btMillis(), __func__, ##__VA_ARGS__); \
+        }                                                                                          \
+    } while (0)
+
+#define log_e(format, ...) BT_HOST_LOG(1, "E", format, ##__VA_ARGS__)
+#define log_w(format, ...) BT_HOST_LOG(2, "W", format, ##__VA_ARGS__)
+#define log_i(format, ...) BT_HOST_LOG(3, "I", format, ##__VA_ARGS__)
+#define log_d(format, ...) BT_HOST_LOG(4, "D", format, ##__VA_ARGS__)
+#endif
+
+// "AA:BB:CC:DD:EE:FF" plus the terminator
+const size_t BT_ADDRESS_STR_SIZE = 18;
+
+inline const char *formatBtAddress(const uint8_t address[6], char (&out)[BT_ADDRESS_STR_SIZE])
+{
+    snprintf(out, sizeof(out), "%02X:%02X:%02X:%02X:%02X:%02X",
+             address[0], address[1], address[2], address[3], address[4], address[5]);
+    return out;
+}
+
+#endif // BT_PLATFORM_H
@@ -0,0 +1,245 @@
+#include "BtReconnectManager.h"
+#include <math.h>
+#include <string.h>
+
+// Smoothing of the connect latency, like the ACK tracker's RTT estimate
+const uint32_t LATENCY_GAIN_SHIFT = 3; // 1/8
+
+static bool isDue(uint32_t atMs, uint32_t nowMs)
+{
+    return (int32_t)(nowMs - atMs) >= 0;
+}
+
+BtReconnectManager::BtReconnectManager() : entries(), stats()
+{
+}
+
+BtReconnectManager::Entry *BtReconnectManager::find(const uint8_t address[6])
+{
+    for (Entry &entry : entries)
+    {
+        if (entry.used && memcmp(entry.history.address, address, sizeof(entry.history.address)) == 0)
+        {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+BtReconnectManager::Entry &BtReconnectManager::findOrCreate(const uint8_t address[6], uint32_t nowMs)
+{
+    Entry *entry = find(address);
+    if (entry)
+    {
+        return *entry;
+    }
+    Entry *victim = nullptr;
+    for (Entry &candidate : entries)
+    {
+        if (!candidate.used)
+        {
+            victim = &candidate;
+            break;
+        }
+        if (!candidate.linked && (!victim || nowMs - candidate.history.lastUsedMs > nowMs - victim->history.lastUsedMs))
+        {
+            victim = &candidate;
+        }
+    }
+    if (!victim)
+    {
+        victim = &entries[0];
+    }
+    *victim = Entry();
+    victim->used = true;
+    memcpy(victim->history.address, address, sizeof(victim->history.address));
+    victim->history.lastUsedMs = nowMs;
+    victim->history.successRate = 1.0f;
+    return *victim;
+}
+
+float BtReconnectManager::scoreAt(const BtConnectHistory &history, uint32_t nowMs) const
+{
+    return history.score * exp2f(-(float)(nowMs - history.lastUsedMs) / BT_RECONNECT_SCORE_HALF_LIFE_MS);
+}
+
+void BtReconnectManager::onUsed(const uint8_t address[6], uint32_t nowMs)
+{
+    Entry &entry = findOrCreate(address, nowMs);
+    BtConnectHistory &history = entry.history;
+    history.score = scoreAt(history, nowMs) + 1.0f;
+    history.lastUsedMs = nowMs;
+    history.uses++;
+    preconnectPaused = false;
+    if (entry.predicted && entry.linked)
+    {
+        stats.preconnectHits++;
+    }
+    entry.predicted = false;
+}
+
+void BtReconnectManager::onConnectStarted(const uint8_t address[6], BtConnectReason reason, uint32_t nowMs)
+{
+    Entry &entry = findOrCreate(address, nowMs);
+    entry.linked = true;
+    entry.predicted = reason == BtConnectReason::PREDICTED;
+    entry.connectStartedMs = nowMs;
+    entry.history.attempts++;
+    if (reason == BtConnectReason::RECONNECT)
+    {
+        stats.reconnects++;
+    }
+    else if (reason == BtConnectReason::PREDICTED)
+    {
+        stats.preconnects++;
+    }
+}
+
+void BtReconnectManager::onConnected(const uint8_t address[6], uint32_t nowMs)
+{
+    Entry &entry = findOrCreate(address, nowMs);
+    BtConnectHistory &history = entry.history;
+    uint32_t latency = nowMs - entry.connectStartedMs;
+    history.avgLatencyMs = history.successes == 0
+                               ? latency
+                               : history.avgLatencyMs - (history.avgLatencyMs >> LATENCY_GAIN_SHIFT) + (latency >> LATENCY_GAIN_SHIFT);
+    history.lastLatencyMs = latency;
+    history.successes++;
+    history.successRate = (float)history.successes / history.attempts;
+    history.failures = 0;
+    if (history.reconnectPending)
+    {
+        history.reconnectPending = false;
+        stats.reconnected++;
+    }
+}
+
+void BtReconnectManager::onConnectFailed(const uint8_t address[6], uint32_t nowMs)
+{
+    Entry &entry = findOrCreate(address, nowMs);
+    BtConnectHistory &history = entry.history;
+    entry.linked = false;
+    entry.predicted = false;
+    history.failures++;
+    history.successRate = history.attempts ? (float)history.successes / history.attempts : 1.0f;
+    if (history.reconnectPending && history.failures >= BT_RECONNECT_MAX_ATTEMPTS)
+    {
+        history.reconnectPending = false;
+        stats.gaveUp++;
+    }
+    scheduleRetry(entry, nowMs);
+}
+
+void BtReconnectManager::onClosed(const uint8_t address[6], bool expected, uint32_t nowMs)
+{
+    Entry *entry = find(address);
+    if (!entry)
+    {
+        return;
+    }
+    entry->linked = false;
+    entry->predicted = false;
+    if (expected)
+    {
+        return;
+    }
+    entry->history.drops++;
+    if (nowMs - entry->history.lastUsedMs < BT_RECONNECT_RECENT_MS)
+    {
+        entry->history.reconnectPending = true;
+        entry->history.failures = 0;
+        scheduleRetry(*entry, nowMs);
+    }
+}
+
+void BtReconnectManager::cancelReconnects()
+{
+    for (Entry &entry : entries)
+    {
+        entry.history.reconnectPending = false;
+    }
+    preconnectPaused = true;
+}
+
+// Exponential backoff with jitter, so lights that dropped together do not all come back at once
+void BtReconnectManager::scheduleRetry(Entry &entry, uint32_t nowMs)
+{
+    uint32_t failures = entry.history.failures;
+    uint32_t delay = BT_RECONNECT_BASE_DELAY_MS;
+    while (failures > 1 && delay < BT_RECONNECT_MAX_DELAY_MS)
+    {
+        delay *= 2;
+        failures--;
+    }
+    if (delay > BT_RECONNECT_MAX_DELAY_MS)
+    {
+        delay = BT_RECONNECT_MAX_DELAY_MS;
+    }
+    // xorshift32, mixed with the clock
+    random ^= nowMs;
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    delay = delay - delay / 4 + random % (delay / 2 + 1);
+    entry.history.retryAtMs = nowMs + delay;
+}
+
+bool BtReconnectManager::nextReconnect(uint32_t nowMs, uint8_t address[6])
+{
+    for (Entry &entry : entries)
+    {
+        if (entry.used && !entry.linked && entry.history.reconnectPending && isDue(entry.history.retryAtMs, nowMs))
+        {
+            memcpy(address, entry.history.address, sizeof(entry.history.address));
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BtReconnectManager::nextPreconnect(uint32_t nowMs, uint8_t address[6])
+{
+    if (preconnectPaused || (hasPreconnected && nowMs - lastPreconnectMs < BT_PRECONNECT_INTERVAL_MS))
+    {
+        return false;
+    }
+    Entry *best = nullptr;
+    float bestScore = BT_PRECONNECT_MIN_SCORE;
+    for (Entry &entry : entries)
+    {
+        const BtConnectHistory &history = entry.history;
+        if (!entry.used || entry.linked || history.reconnectPending || history.failures >= BT_RECONNECT_MAX_ATTEMPTS ||
+            !isDue(history.retryAtMs, nowMs) || nowMs - history.lastUsedMs >= BT_RECONNECT_RECENT_MS)
+        {
+            continue;
+        }
+        float score = scoreAt(history, nowMs) * history.successRate;
+        if (score >= bestScore)
+        {
+            best = &entry;
+            bestScore = score;
+        }
+    }
+    if (!best)
+    {
+        return false;
+    }
+    lastPreconnectMs = nowMs;
+    hasPreconnected = true;
+    memcpy(address, best->history.address, sizeof(best->history.address));
+    return true;
+}
+
+std::vector<BtConnectHistory> BtReconnectManager::getHistory(uint32_t nowMs)
+{
+    std::vector<BtConnectHistory> history;
+    for (const Entry &entry : entries)
+    {
+        if (entry.used)
+        {
+            history.push_back(entry.history);
+            history.back().score = scoreAt(entry.history, nowMs);
+        }
+    }
+    return history;
+}
@@ -0,0 +1,114 @@
+#ifndef BT_RECONNECT_MANAGER_H
+#define BT_RECONNECT_MANAGER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Number of devices whose connection history is kept
+const size_t BT_RECONNECT_CAPACITY = 16;
+// Backoff between connect attempts after a failure: doubles from the base up to the max, +-25% jitter
+const uint32_t BT_RECONNECT_BASE_DELAY_MS = 1000;
+const uint32_t BT_RECONNECT_MAX_DELAY_MS = 60000;
+// Consecutive failures after which a dropped link is given up (until it is used again)
+const uint32_t BT_RECONNECT_MAX_ATTEMPTS = 8;
+// A dropped link is only reconnected if it was used this recently
+const uint32_t BT_RECONNECT_RECENT_MS = 30 * 60 * 1000;
+// Half-life of a device's usage score: recent uses count more than old ones
+const uint32_t BT_RECONNECT_SCORE_HALF_LIFE_MS = 10 * 60 * 1000;
+// Lowest score (about one use within the half-life) a device needs to be pre-connected
+const float BT_PRECONNECT_MIN_SCORE = 0.5f;
+// Pause between two pre-connects, so they never crowd out connects that were asked for
+const uint32_t BT_PRECONNECT_INTERVAL_MS = 5000;
+
+// Why a link is being opened
+enum class BtConnectReason : uint8_t
+{
+    REQUESTED, // a command or config needs the device
+    RECONNECT, // the link dropped on its own
+    PREDICTED, // the device is likely to be used next
+    BATCH      // one of several devices set at once (a scene); does not become the active device
+};
+
+// Connection history of one device
+struct BtConnectHistory
+{
+    uint8_t address[6];
+    uint32_t attempts;
+    uint32_t successes;
+    uint32_t drops;             // links closed by the device or the stack, not by us
+    uint32_t lastLatencyMs;     // open time of the last successful connect
+    uint32_t avgLatencyMs;      // smoothed open time
+    uint32_t uses;              // lookups for sending
+    uint32_t lastUsedMs;
+    float score;                // decayed use count, as of lastUsedMs
+    float successRate;
+    uint32_t failures;          // consecutive failed connects
+    bool reconnectPending;      // dropped and not back yet
+    uint32_t retryAtMs;         // no connect attempt (of ours) before this
+};
+
+struct BtReconnectStats
+{
+    uint32_t reconnects;     // reconnect attempts started
+    uint32_t reconnected;    // ...that opened the link again
+    uint32_t gaveUp;         // dropped links abandoned after BT_RECONNECT_MAX_ATTEMPTS
+    uint32_t preconnects;    // pre-connects started
+    uint32_t preconnectHits; // pre-connected links used before they closed
+};
+
+/**
+ * Connection history of recently used lights, used to keep their links warm: a link that drops is
+ * reconnected with exponential backoff and jitter, and the device most likely to be used next
+ * (decayed use count times connect success rate) is connected before it is needed.
+ * Not thread safe; BtCommandPipeline calls it with its link lock held and issues the connects.
+ */
+class BtReconnectManager
+{
+public:
+    BtReconnectManager();
+
+    // The device was looked up for sending
+    void onUsed(const uint8_t address[6], uint32_t nowMs);
+    void onConnectStarted(const uint8_t address[6], BtConnectReason reason, uint32_t nowMs);
+    void onConnected(const uint8_t address[6], uint32_t nowMs);
+    void onConnectFailed(const uint8_t address[6], uint32_t nowMs);
+    // The link closed. Unless we closed it, a recently used device is scheduled for a reconnect.
+    void onClosed(const uint8_t address[6], bool expected, uint32_t nowMs);
+    // Drops every scheduled reconnect and holds pre-connects off until a device is used again
+    // (everything was disconnected on purpose)
+    void cancelReconnects();
+
+    // A dropped device whose next reconnect attempt is due
+    bool nextReconnect(uint32_t nowMs, uint8_t address[6]);
+    // The unlinked device most likely to be used next, if any is worth a pre-connect now
+    bool nextPreconnect(uint32_t nowMs, uint8_t address[6]);
+
+    std::vector<BtConnectHistory> getHistory(uint32_t nowMs);
+    BtReconnectStats getStats() const { return stats; }
+
+private:
+    struct Entry
+    {
+        bool used;
+        bool linked;      // a link is connecting or open
+        bool predicted;   // opened by a pre-connect and not used yet
+        uint32_t connectStartedMs;
+        BtConnectHistory history;
+    };
+
+    Entry entries[BT_RECONNECT_CAPACITY];
+    BtReconnectStats stats;
+    uint32_t lastPreconnectMs = 0;
+    bool hasPreconnected = false;
+    bool preconnectPaused = false;
+    uint32_t random = 0x9E3779B9;
+
+    Entry *find(const uint8_t address[6]);
+    // Finds the device's entry, taking over the least recently used one if needed
+    Entry &findOrCreate(const uint8_t address[6], uint32_t nowMs);
+    float scoreAt(const BtConnectHistory &history, uint32_t nowMs) const;
+    void scheduleRetry(Entry &entry, uint32_t nowMs);
+};
+
+#endif // BT_RECONNECT_MANAGER_H
@@ -0,0 +1,83 @@
+#include "BtRxFramer.h"
+#include <string.h>
+
+// Checks the header bytes that are already available
+bool BtRxFramer::headerMatches(const uint8_t *bytes, size_t available)
+{
+    if (available > RX_PACKET_HEADER_BYTE4_IDX && bytes[RX_PACKET_HEADER_BYTE4_IDX] != RX_PACKET_HEADER_BYTE4)
+    {
+        return false;
+    }
+    if (available > RX_PACKET_HEADER_BYTE5_IDX && bytes[RX_PACKET_HEADER_BYTE5_IDX] != RX_PACKET_HEADER_BYTE5)
+    {
+        return false;
+    }
+    return true;
+}
+
+// Drops leading carry bytes until what is left can still be the start of a packet
+void BtRxFramer::resyncCarry()
+{
+    while (carryLen > 0 && !headerMatches(carry, carryLen))
+    {
+        memmove(carry, carry + 1, carryLen - 1);
+        carryLen--;
+        resyncs++;
+    }
+}
+
+const uint8_t *BtRxFramer::next(const uint8_t *&data, size_t &len)
+{
+    while (len > 0)
+    {
+        if (carryLen == 0)
+        {
+            if (len >= RX_PACKET_SIZE)
+            {
+                // Fast path: a whole packet is in the caller's buffer
+                if (headerMatches(data, RX_PACKET_SIZE))
+                {
+                    const uint8_t *packet = data;
+                    data += RX_PACKET_SIZE;
+                    len -= RX_PACKET_SIZE;
+                    packets++;
+                    return packet;
+                }
+                data++;
+                len--;
+                resyncs++;
+                continue;
+            }
+            // Tail of the read: keep it for the next one
+            memcpy(carry, data, len);
+            carryLen = len;
+            data += len;
+            len = 0;
+            resyncCarry();
+            return nullptr;
+        }
+
+        size_t n = RX_PACKET_SIZE - carryLen;
+        if (n > len)
+        {
+            n = len;
+        }
+        memcpy(carry + carryLen, data, n);
+        carryLen += n;
+        data += n;
+        len -= n;
+        resyncCarry();
+        if (carryLen == RX_PACKET_SIZE)
+        {
+            carryLen = 0;
+            packets++;
+            return carry;
+        }
+    }
+    return nullptr;
+}
+
+void BtRxFramer::reset()
+{
+    carryLen = 0;
+}
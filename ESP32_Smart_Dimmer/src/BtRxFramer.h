@@ -0,0 +1,69 @@
+#ifndef BT_RX_FRAMER_H
+#define BT_RX_FRAMER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "CommandType.h"
+
+// Define constants for received packet parsing
+// These are based on your observed "BT Data Received" logs
+const uint8_t RX_PACKET_HEADER_BYTE4 = 0x41;   // Identifies a received status packet
+const uint8_t RX_PACKET_HEADER_BYTE5 = 0x81;   // Consistent second header byte for received packets
+const uint8_t RX_PACKET_FUNCTION_FAN = 0x18;   // Byte 6 for fan/motor status
+const uint8_t RX_PACKET_FUNCTION_LIGHT = 0x1C; // Byte 6 for light status (assuming, based on sent command)
+
+// Indices for parsing received packets (0-indexed from start of 24-byte packet)
+const int RX_PACKET_HEADER_BYTE4_IDX = 4;
+const int RX_PACKET_HEADER_BYTE5_IDX = 5;
+const int RX_PACKET_FUNCTION_BYTE_IDX = 6;
+const int RX_PACKET_FAN_STATE_BYTE_IDX = 22; // For fan ON/OFF/Speed
+const size_t RX_PACKET_SIZE = 24;
+
+// A decoded status packet received from a light
+struct BtStatus
+{
+    uint8_t function;    // RX_PACKET_FUNCTION_FAN or RX_PACKET_FUNCTION_LIGHT
+    uint8_t state;       // Byte RX_PACKET_FAN_STATE_BYTE_IDX (fan ON/OFF/Speed for fan status)
+    uint8_t raw[RX_PACKET_SIZE];
+    uint32_t receivedAt; // millis() when the packet was framed
+};
+
+// The status packet function byte that acknowledges a sent command
+inline uint8_t rxFunctionForCommand(CommandType cmd)
+{
+    return cmd == CMD_FAN_SPEED ? RX_PACKET_FUNCTION_FAN : RX_PACKET_FUNCTION_LIGHT;
+}
+
+/**
+ * Incremental framer for the 24 byte status packets the lights send back.
+ *
+ * The state is the number of bytes of the current packet seen so far. Packets that arrive
+ * whole inside one read are returned as pointers into the caller's buffer; only a packet
+ * split across reads is assembled in the internal carry buffer. Bytes that cannot be the
+ * start of a packet (header bytes 4/5 mismatch) are skipped one at a time to resync.
+ */
+class BtRxFramer
+{
+public:
+    /**
+     * Consumes bytes from data/len until a packet is complete.
+     * @return the 24 byte packet (valid until the next call), or nullptr once the input is used up.
+     *         data and len are advanced past the consumed bytes.
+     */
+    const uint8_t *next(const uint8_t *&data, size_t &len);
+    void reset();
+
+    uint32_t getPacketCount() const { return packets; }
+    uint32_t getResyncCount() const { return resyncs; }
+
+private:
+    uint8_t carry[RX_PACKET_SIZE];
+    size_t carryLen = 0;
+    uint32_t packets = 0;
+    uint32_t resyncs = 0;
+
+    static bool headerMatches(const uint8_t *bytes, size_t available);
+    void resyncCarry();
+};
+
+#endif // BT_RX_FRAMER_H
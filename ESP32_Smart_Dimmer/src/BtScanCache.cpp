@@ -0,0 +1,94 @@
+#include "BtScanCache.h"
+#include <string.h>
+
+BtScanCache::BtScanCache()
+    : entries(), used()
+{
+}
+
+bool BtScanCache::update(const uint8_t address[6], const char *name, bool hasRssi, int8_t rssi, uint32_t nowMs)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    lastUpdateMs = nowMs;
+
+    BtScanEntry *entry = nullptr;
+    bool isNew = false;
+    for (size_t i = 0; i < BT_SCAN_CACHE_CAPACITY; i++)
+    {
+        if (used[i] && memcmp(entries[i].address, address, sizeof(entries[i].address)) == 0)
+        {
+            entry = &entries[i];
+            break;
+        }
+    }
+
+    if (!entry)
+    {
+        // New device; a full cache gives up the one not seen for the longest time
+        size_t slot = 0;
+        for (size_t i = 0; i < BT_SCAN_CACHE_CAPACITY; i++)
+        {
+            if (!used[i])
+            {
+                slot = i;
+                break;
+            }
+            if (nowMs - entries[i].lastSeenMs > nowMs - entries[slot].lastSeenMs)
+            {
+                slot = i;
+            }
+        }
+        entry = &entries[slot];
+        used[slot] = true;
+        memcpy(entry->address, address, sizeof(entry->address));
+        entry->name[0] = '\0';
+        entry->hasRssi = false;
+        entry->firstSeenMs = nowMs;
+        isNew = true;
+    }
+
+    if (name && name[0])
+    {
+        strncpy(entry->name, name, sizeof(entry->name) - 1);
+        entry->name[sizeof(entry->name) - 1] = '\0';
+    }
+    if (hasRssi)
+    {
+        entry->hasRssi = true;
+        entry->rssi = rssi;
+    }
+    entry->lastSeenMs = nowMs;
+    return isNew;
+}
+
+void BtScanCache::expire(uint32_t nowMs)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < BT_SCAN_CACHE_CAPACITY; i++)
+    {
+        if (used[i] && nowMs - entries[i].lastSeenMs >= BT_SCAN_CACHE_TTL_MS)
+        {
+            used[i] = false;
+        }
+    }
+}
+
+std::vector<BtScanEntry> BtScanCache::getEntries()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<BtScanEntry> result;
+    for (size_t i = 0; i < BT_SCAN_CACHE_CAPACITY; i++)
+    {
+        if (used[i])
+        {
+            result.push_back(entries[i]);
+        }
+    }
+    return result;
+}
+
+uint32_t BtScanCache::getLastUpdateMs()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return lastUpdateMs;
+}
@@ -0,0 +1,57 @@
+#ifndef BT_SCAN_CACHE_H
+#define BT_SCAN_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include <vector>
+
+// Number of discovered lights remembered
+const size_t BT_SCAN_CACHE_CAPACITY = 16;
+// A light not seen by any scan for this long is dropped from the cache
+const uint32_t BT_SCAN_CACHE_TTL_MS = 10 * 60 * 1000;
+const size_t BT_SCAN_NAME_SIZE = 32;
+
+// OUI of the lights; discovery ignores every other device
+const uint8_t BT_LIGHT_OUI[3] = {0xC9, 0xA3, 0x05};
+
+inline bool isLightAddress(const uint8_t address[6])
+{
+    return address[0] == BT_LIGHT_OUI[0] && address[1] == BT_LIGHT_OUI[1] && address[2] == BT_LIGHT_OUI[2];
+}
+
+struct BtScanEntry
+{
+    uint8_t address[6];
+    char name[BT_SCAN_NAME_SIZE];
+    bool hasRssi;
+    int8_t rssi;
+    uint32_t firstSeenMs;
+    uint32_t lastSeenMs;
+};
+
+/**
+ * Lights found by discovery, with their signal strength and when they were last seen.
+ * Filled from the GAP callback while a scan runs and read by the web server at any time.
+ */
+class BtScanCache
+{
+public:
+    BtScanCache();
+
+    // Adds or refreshes a device. An empty name keeps the one already known. True if the device is new.
+    bool update(const uint8_t address[6], const char *name, bool hasRssi, int8_t rssi, uint32_t nowMs);
+    // Drops devices not seen for BT_SCAN_CACHE_TTL_MS
+    void expire(uint32_t nowMs);
+    std::vector<BtScanEntry> getEntries();
+    // When the cache was last refreshed by a scan (0 if never)
+    uint32_t getLastUpdateMs();
+
+private:
+    std::mutex mutex;
+    BtScanEntry entries[BT_SCAN_CACHE_CAPACITY];
+    bool used[BT_SCAN_CACHE_CAPACITY];
+    uint32_t lastUpdateMs = 0;
+};
+
+#endif // BT_SCAN_CACHE_H
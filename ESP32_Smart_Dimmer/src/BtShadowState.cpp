@@ -0,0 +1,138 @@
+#include "BtShadowState.h"
+#include <string.h>
+
+const uint32_t ALL_FIELDS_DIRTY = (1u << BT_SHADOW_FIELD_COUNT) - 1;
+
+BtShadowState::BtShadowState()
+    : entries(), stats()
+{
+}
+
+BtShadowState::Entry *BtShadowState::find(const uint8_t device[6])
+{
+    for (Entry &entry : entries)
+    {
+        if (entry.used && memcmp(entry.device, device, sizeof(entry.device)) == 0)
+        {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+BtShadowState::Entry &BtShadowState::findOrCreate(const uint8_t device[6])
+{
+    Entry *entry = find(device);
+    if (!entry)
+    {
+        for (Entry &candidate : entries)
+        {
+            if (!candidate.used)
+            {
+                entry = &candidate;
+                break;
+            }
+            if (!entry || candidate.lastUsed < entry->lastUsed)
+            {
+                entry = &candidate;
+            }
+        }
+        entry->used = true;
+        memcpy(entry->device, device, sizeof(entry->device));
+        entry->dirty = ALL_FIELDS_DIRTY;
+    }
+    entry->lastUsed = ++useCounter;
+    return *entry;
+}
+
+bool BtShadowState::matches(const uint8_t device[6], CommandType cmd, const uint8_t *payload, size_t size,
+                            BtAckTracker &tracker, BtCompletionId &completion)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    Entry *entry = find(device);
+    if (!entry || cmd >= BT_SHADOW_FIELD_COUNT || (entry->dirty & (1u << cmd)))
+    {
+        stats.sent++;
+        return false;
+    }
+    const Field &field = entry->fields[cmd];
+    if (field.size != size || memcmp(field.value, payload, size) != 0)
+    {
+        stats.sent++;
+        return false;
+    }
+    entry->lastUsed = ++useCounter;
+    completion = field.completion;
+    lock.unlock();
+
+    // A value whose send failed has to go out again
+    BtAckState state = tracker.state(completion);
+    lock.lock();
+    if (state == BtAckState::TIMED_OUT || state == BtAckState::DROPPED)
+    {
+        stats.sent++;
+        return false;
+    }
+    stats.skipped++;
+    return true;
+}
+
+void BtShadowState::record(const uint8_t device[6], CommandType cmd, const uint8_t *payload, size_t size, BtCompletionId completion)
+{
+    if (cmd >= BT_SHADOW_FIELD_COUNT || size > BT_SHADOW_MAX_PAYLOAD)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry &entry = findOrCreate(device);
+    Field &field = entry.fields[cmd];
+    memcpy(field.value, payload, size);
+    field.size = size;
+    field.completion = completion;
+    entry.dirty &= ~(1u << cmd);
+    // Main light and RGB ring are exclusive modes of the light: sending a field of one
+    // switches the light over, so the other mode's fields no longer reflect it
+    if (cmd == CMD_RGB)
+    {
+        entry.dirty |= (1u << CMD_LIGHT_INTENSITY) | (1u << CMD_LIGHT_WARMNESS);
+    }
+    else if (cmd == CMD_LIGHT_INTENSITY || cmd == CMD_LIGHT_WARMNESS)
+    {
+        entry.dirty |= 1u << CMD_RGB;
+    }
+}
+
+void BtShadowState::invalidate(const uint8_t device[6])
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry *entry = find(device);
+    if (entry)
+    {
+        entry->dirty = ALL_FIELDS_DIRTY;
+    }
+}
+
+void BtShadowState::observe(const uint8_t device[6], CommandType cmd, const uint8_t *payload, size_t size)
+{
+    if (cmd >= BT_SHADOW_FIELD_COUNT)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry *entry = find(device);
+    if (!entry)
+    {
+        return;
+    }
+    const Field &field = entry->fields[cmd];
+    if (field.size != size || memcmp(field.value, payload, size) != 0)
+    {
+        entry->dirty |= 1u << cmd;
+    }
+}
+
+BtShadowStats BtShadowState::getStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
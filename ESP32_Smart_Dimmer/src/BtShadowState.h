@@ -0,0 +1,77 @@
+#ifndef BT_SHADOW_STATE_H
+#define BT_SHADOW_STATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include "CommandType.h"
+#include "BtAckTracker.h"
+
+// Number of devices whose last sent state is remembered
+const size_t BT_SHADOW_CAPACITY = 16;
+// One field per command type (indexed by CommandType)
+const size_t BT_SHADOW_FIELD_COUNT = CMD_FAN_SPEED + 1;
+// Largest command payload (RGB)
+const size_t BT_SHADOW_MAX_PAYLOAD = 4;
+
+struct BtShadowStats
+{
+    uint32_t sent;    // fields that differed from the shadow and went out
+    uint32_t skipped; // fields that matched the shadow and were not sent
+};
+
+/**
+ * Per-device copy of the last payload sent for every command, with a dirty bit per field.
+ * A field is dirty until a value was recorded for it, and again after invalidate() (e.g. the link
+ * reopened and the light may have been changed with its own remote). Clean fields whose payload
+ * did not change are not sent again.
+ */
+class BtShadowState
+{
+public:
+    BtShadowState();
+
+    /**
+     * True when the field is clean, holds exactly this payload and the command that sent it did not
+     * time out or get dropped. completion is set to that command.
+     */
+    bool matches(const uint8_t device[6], CommandType cmd, const uint8_t *payload, size_t size,
+                 BtAckTracker &tracker, BtCompletionId &completion);
+    // Stores the payload as the field's value and clears its dirty bit
+    void record(const uint8_t device[6], CommandType cmd, const uint8_t *payload, size_t size, BtCompletionId completion);
+    // Marks every field of the device dirty, so the next send of each goes out
+    void invalidate(const uint8_t device[6]);
+    // The device reported this value for the field (e.g. set with its remote). If it differs from the
+    // recorded one the field goes dirty, so sending the recorded value again is not skipped.
+    void observe(const uint8_t device[6], CommandType cmd, const uint8_t *payload, size_t size);
+
+    BtShadowStats getStats();
+
+private:
+    struct Field
+    {
+        uint8_t value[BT_SHADOW_MAX_PAYLOAD];
+        uint8_t size;
+        BtCompletionId completion;
+    };
+
+    struct Entry
+    {
+        bool used;
+        uint8_t device[6];
+        uint32_t dirty; // bit per CommandType
+        uint32_t lastUsed;
+        Field fields[BT_SHADOW_FIELD_COUNT];
+    };
+
+    std::mutex mutex;
+    Entry entries[BT_SHADOW_CAPACITY];
+    uint32_t useCounter = 0;
+    BtShadowStats stats;
+
+    Entry *find(const uint8_t device[6]);
+    // Finds the device's entry, taking over the least recently used one if needed
+    Entry &findOrCreate(const uint8_t device[6]);
+};
+
+#endif // BT_SHADOW_STATE_H
@@ -0,0 +1,201 @@
+#include "BtTxQueue.h"
+#include <string.h>
+
+BtTxQueue::BtTxQueue()
+    : stats()
+{
+    lanes[(size_t)BtPriority::URGENT] = {urgentSlots, BT_TX_URGENT_QUEUE_CAPACITY, 0, 0};
+    lanes[(size_t)BtPriority::NORMAL] = {normalSlots, BT_TX_QUEUE_CAPACITY, 0, 0};
+    stats.capacity = BT_TX_URGENT_QUEUE_CAPACITY + BT_TX_QUEUE_CAPACITY;
+}
+
+void BtTxQueue::Lane::pushBack(const BtPacket &packet)
+{
+    slots[(head + count) % capacity] = packet;
+    count++;
+}
+
+// Closes the gap, keeping the order of the packets behind it
+void BtTxQueue::Lane::remove(size_t i)
+{
+    for (; i + 1 < count; i++)
+    {
+        at(i) = at(i + 1);
+    }
+    count--;
+}
+
+size_t BtTxQueue::totalCount() const
+{
+    return lanes[0].count + lanes[1].count;
+}
+
+bool BtTxQueue::findWaiting(const BtPacket &packet, Lane *&lane, size_t &index)
+{
+    for (Lane &candidate : lanes)
+    {
+        for (size_t i = 0; i < candidate.count; i++)
+        {
+            BtPacket &pending = candidate.at(i);
+            if (pending.cmd == packet.cmd && memcmp(pending.device, packet.device, sizeof(pending.device)) == 0)
+            {
+                lane = &candidate;
+                index = i;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+BtPushResult BtTxQueue::push(BtPacket &packet)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Lane &target = lanes[(size_t)packet.priority];
+    Lane *lane;
+    size_t index;
+    if (findWaiting(packet, lane, index))
+    {
+        BtPacket &pending = lane->at(index);
+        // Keep the original enqueue time so latency still reflects the time spent waiting,
+        // and the original completion so earlier callers are answered by this packet too
+        packet.enqueuedAt = pending.enqueuedAt;
+        packet.completion = pending.completion;
+        stats.coalesced++;
+        if (packet.priority == BtPriority::URGENT && lane != &target && target.count < target.capacity)
+        {
+            lane->remove(index);
+            target.pushBack(packet);
+            stats.promoted++;
+        }
+        else
+        {
+            // A normal update to an urgent packet stays urgent
+            packet.priority = pending.priority;
+            pending = packet;
+        }
+        return BtPushResult::COALESCED;
+    }
+    if (target.count == target.capacity)
+    {
+        stats.rejected++;
+        return BtPushResult::REJECTED;
+    }
+    target.pushBack(packet);
+    stats.enqueued++;
+    return BtPushResult::QUEUED;
+}
+
+bool BtTxQueue::pushRetransmit(const BtPacket &packet)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Lane &target = lanes[(size_t)packet.priority];
+    Lane *lane;
+    size_t index;
+    if (target.count == target.capacity || findWaiting(packet, lane, index))
+    {
+        return false;
+    }
+    target.pushBack(packet);
+    stats.retransmits++;
+    return true;
+}
+
+size_t BtTxQueue::findReady(Lane &lane, const std::function<bool(const BtPacket &)> &ready)
+{
+    size_t i = 0;
+    while (i < lane.count && !ready(lane.at(i)))
+    {
+        i++;
+    }
+    return i;
+}
+
+bool BtTxQueue::pop(BtPacket &packet, uint32_t nowMs, const std::function<bool(const BtPacket &)> &ready)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Lane &urgent = lanes[(size_t)BtPriority::URGENT];
+    Lane &normal = lanes[(size_t)BtPriority::NORMAL];
+    size_t urgentIndex = findReady(urgent, ready);
+    size_t normalIndex = findReady(normal, ready);
+    bool urgentReady = urgentIndex < urgent.count;
+    bool normalReady = normalIndex < normal.count;
+    if (urgentReady && (!normalReady || urgentStreak < BT_TX_URGENT_BURST))
+    {
+        packet = urgent.at(urgentIndex);
+        urgent.remove(urgentIndex);
+        urgentStreak = normalReady ? urgentStreak + 1 : 0;
+        recordWait(packet, nowMs);
+        return true;
+    }
+    if (!normalReady)
+    {
+        return false;
+    }
+    if (urgentReady)
+    {
+        stats.starvationPicks++;
+    }
+    packet = normal.at(normalIndex);
+    normal.remove(normalIndex);
+    urgentStreak = 0;
+    recordWait(packet, nowMs);
+    return true;
+}
+
+// Called with mutex held
+void BtTxQueue::recordWait(const BtPacket &packet, uint32_t nowMs)
+{
+    uint32_t wait = nowMs - packet.enqueuedAt;
+    BtTxLaneStats &lane = stats.lanes[(size_t)packet.priority];
+    if (wait > lane.maxWaitMs)
+    {
+        lane.maxWaitMs = wait;
+    }
+    size_t bucket = 0;
+    while (bucket < BT_TX_WAIT_BUCKETS - 1 && wait >= BT_TX_WAIT_BUCKET_MS[bucket])
+    {
+        bucket++;
+    }
+    lane.waitHistogram[bucket]++;
+}
+
+void BtTxQueue::recordSent(BtPriority priority, uint32_t enqueuedAt, uint32_t nowMs)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t latency = nowMs - enqueuedAt;
+    stats.sent++;
+    stats.lastLatencyMs = latency;
+    stats.avgLatencyMs = stats.sent == 1 ? latency : (stats.avgLatencyMs * 7 + latency) / 8;
+    if (latency > stats.maxLatencyMs)
+    {
+        stats.maxLatencyMs = latency;
+    }
+
+    stats.lanes[(size_t)priority].sent++;
+}
+
+void BtTxQueue::recordDropped()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.dropped++;
+}
+
+size_t BtTxQueue::depth()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return totalCount();
+}
+
+BtTxStats BtTxQueue::getStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    BtTxStats snapshot = stats;
+    snapshot.depth = totalCount();
+    for (size_t i = 0; i < BT_PRIORITY_COUNT; i++)
+    {
+        snapshot.lanes[i].depth = lanes[i].count;
+        snapshot.lanes[i].capacity = lanes[i].capacity;
+    }
+    return snapshot;
+}
@@ -0,0 +1,141 @@
+#ifndef BT_TX_QUEUE_H
+#define BT_TX_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include <functional>
+#include <LightProtocol.h>
+#include "CommandType.h"
+#include "BtAckTracker.h"
+
+// Largest packet we ever build
+const size_t BT_MAX_PACKET_SIZE = LightProtocol::MAX_PACKET_SIZE;
+// Number of pre-built packets that may wait for the writer task, per priority lane
+const size_t BT_TX_QUEUE_CAPACITY = 16;
+const size_t BT_TX_URGENT_QUEUE_CAPACITY = 8;
+// Urgent packets written in a row while normal ones wait, before one normal packet gets its turn
+const uint32_t BT_TX_URGENT_BURST = 4;
+// Upper bounds (ms) of the queue wait histogram buckets; the last bucket has no bound
+const uint32_t BT_TX_WAIT_BUCKET_MS[] = {10, 20, 50, 100, 200, 500, 1000};
+const size_t BT_TX_WAIT_BUCKETS = sizeof(BT_TX_WAIT_BUCKET_MS) / sizeof(BT_TX_WAIT_BUCKET_MS[0]) + 1;
+
+// Which lane of the TX queue a command waits in
+enum class BtPriority : uint8_t
+{
+    URGENT, // local input (buttons, encoders): preempts everything else
+    NORMAL  // web UI, automation and config syncs
+};
+const size_t BT_PRIORITY_COUNT = 2;
+
+// A fully encoded packet, ready to be written to the link of `device`
+struct BtPacket
+{
+    uint8_t data[BT_MAX_PACKET_SIZE];
+    uint8_t size;
+    CommandType cmd;
+    BtPriority priority;
+    uint8_t device[6];   // MAC of the device the packet was built for
+    uint32_t enqueuedAt; // millis() when the packet was queued
+    BtCompletionId completion;
+};
+
+enum class BtPushResult : uint8_t
+{
+    QUEUED,    // took a new slot
+    COALESCED, // replaced an unsent packet of the same device and command
+    REJECTED   // queue full
+};
+
+struct BtTxLaneStats
+{
+    size_t depth;
+    size_t capacity;
+    uint32_t sent;
+    // Queue wait: enqueue (or retransmit) -> taken by the writer
+    uint32_t maxWaitMs;
+    // The queue wait, counted per BT_TX_WAIT_BUCKET_MS bucket
+    uint32_t waitHistogram[BT_TX_WAIT_BUCKETS];
+};
+
+struct BtTxStats
+{
+    size_t depth;           // packets currently waiting
+    size_t capacity;        // maximum number of waiting packets
+    uint32_t enqueued;      // packets accepted by push()
+    uint32_t sent;          // packets written to the link
+    uint32_t rejected;      // packets refused because the queue was full
+    uint32_t coalesced;     // packets that replaced an unsent packet of the same device and command
+    uint32_t dropped;       // packets discarded before being written (e.g. link went away)
+    uint32_t retransmits;   // packets queued again because their ACK did not arrive in time
+    uint32_t promoted;      // normal packets moved to the urgent lane by an urgent one for the same command
+    uint32_t starvationPicks; // normal packets written ahead of waiting urgent ones
+    uint32_t lastLatencyMs; // enqueue -> write complete of the last packet
+    uint32_t avgLatencyMs;  // moving average of the above
+    uint32_t maxLatencyMs;
+    BtTxLaneStats lanes[BT_PRIORITY_COUNT]; // by BtPriority
+};
+
+/**
+ * Bounded FIFOs of outgoing packets shared by the callers of sendCommand and the writer task,
+ * one per BtPriority. Only std primitives are used so the queue has no dependency on the
+ * Arduino core.
+ *
+ * The writer takes urgent packets first. So that a busy local input cannot starve the web UI,
+ * after BT_TX_URGENT_BURST urgent packets in a row a waiting normal packet goes next. Packets
+ * whose link may not write yet are passed over, so one slow light does not hold up the others.
+ *
+ * Each (device, CommandType) pair owns at most one waiting slot across both lanes: a newer packet
+ * overwrites the unsent one in place, so the latest value wins while the order between different
+ * command types is kept. An urgent packet moves a waiting normal one of its kind to the urgent lane.
+ */
+class BtTxQueue
+{
+public:
+    BtTxQueue();
+
+    // When coalesced, packet.completion is updated to the completion the waiting packet keeps.
+    BtPushResult push(BtPacket &packet);
+    // Queues a packet again for a retransmit, in its own lane. Refused when the lane is full or a
+    // packet of the same device and command is waiting: that newer value goes out anyway.
+    bool pushRetransmit(const BtPacket &packet);
+    // Takes the next packet `ready` accepts, without waiting, and counts its queue wait; the packets it
+    // refuses keep their place. `ready` runs with the queue locked. Returns false if no packet was taken.
+    bool pop(BtPacket &packet, uint32_t nowMs, const std::function<bool(const BtPacket &)> &ready);
+
+    // A packet of the lane, queued at enqueuedAt, completed its write
+    void recordSent(BtPriority priority, uint32_t enqueuedAt, uint32_t nowMs);
+    void recordDropped();
+
+    size_t depth();
+    BtTxStats getStats();
+
+private:
+    struct Lane
+    {
+        BtPacket *slots;
+        size_t capacity;
+        size_t head;
+        size_t count;
+
+        BtPacket &at(size_t i) { return slots[(head + i) % capacity]; }
+        void pushBack(const BtPacket &packet);
+        void remove(size_t i);
+    };
+
+    std::mutex mutex;
+    BtPacket urgentSlots[BT_TX_URGENT_QUEUE_CAPACITY];
+    BtPacket normalSlots[BT_TX_QUEUE_CAPACITY];
+    Lane lanes[BT_PRIORITY_COUNT];
+    uint32_t urgentStreak = 0;
+    BtTxStats stats;
+
+    // Waiting packet of the same device and command, in either lane
+    bool findWaiting(const BtPacket &packet, Lane *&lane, size_t &index);
+    // Position of the first packet of the lane `ready` accepts, lane.count if none
+    size_t findReady(Lane &lane, const std::function<bool(const BtPacket &)> &ready);
+    void recordWait(const BtPacket &packet, uint32_t nowMs);
+    size_t totalCount() const;
+};
+
+#endif // BT_TX_QUEUE_H
@@ -11,4 +11,18 @@ enum CommandType
     CMD_FAN_SPEED
 };
 
+inline const char *commandTypeName(CommandType cmdType)
+{
+    switch (cmdType)
+    {
+    case CMD_NONE: return "CMD_NONE";
+    case CMD_LIGHT_ON_OFF: return "CMD_LIGHT_ON_OFF";
+    case CMD_LIGHT_INTENSITY: return "CMD_LIGHT_INTENSITY";
+    case CMD_LIGHT_WARMNESS: return "CMD_LIGHT_WARMNESS";
+    case CMD_RGB: return "CMD_RGB";
+    case CMD_FAN_SPEED: return "CMD_FAN_SPEED";
+    default: return "Unsupported command";
+    }
+}
+
 #endif
@@ -0,0 +1,203 @@
+#include "ControlJobs.h"
+#include <algorithm>
+
+const char* controlJobStatusName(ControlJobStatus status) {
+    switch (status) {
+    case ControlJobStatus::QUEUED:          return "queued";
+    case ControlJobStatus::CONNECTING:      return "connecting";
+    case ControlJobStatus::SENDING:         return "sending";
+    case ControlJobStatus::APPLIED:         return "applied";
+    case ControlJobStatus::NOT_FOUND:       return "not_found";
+    case ControlJobStatus::CONNECT_TIMEOUT: return "connect_timeout";
+    case ControlJobStatus::UNACKED:         return "unacked";
+    }
+    return "unknown";
+}
+
+ControlJobs::ControlJobs(BluetoothManager* bt, StorageHandler* sh) : btManager(bt), storageHandler(sh) {
+}
+
+uint32_t ControlJobs::start(const String& address, const ControlUpdate& update) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (jobs.size() >= CONTROL_MAX_JOBS) {
+        return 0;
+    }
+    Job job;
+    job.info.id = nextId++;
+    if (nextId == 0) {
+        nextId = 1;
+    }
+    job.info.address = address;
+    job.info.status = ControlJobStatus::QUEUED;
+    job.info.startedMs = millis();
+    job.info.elapsedMs = 0;
+    job.update = update;
+    job.address = BTAddress(address);
+    job.stepStartedMs = job.info.startedMs;
+    jobs.push_back(job);
+    return job.info.id;
+}
+
+bool ControlJobs::get(uint32_t id, ControlJob& job) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const Job& running : jobs) {
+        if (running.info.id == id) {
+            job = running.info;
+            return true;
+        }
+    }
+    for (const ControlJob& finished : finishedJobs) {
+        if (finished.id == id) {
+            job = finished;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ControlJobs::registerJobListener(IControlJobListener* listener) {
+    this->listener = listener;
+}
+
+/**
+ * Moves every job on and reports the ones that finished. The listener is called without the lock
+ * held, so it may call get().
+ */
+void ControlJobs::process() {
+    std::vector<ControlJob> finished;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (jobs.empty()) {
+            return;
+        }
+        uint32_t now = millis();
+        // Devices with a job that has not gone out yet; the jobs after it wait their turn
+        std::vector<String> waiting;
+        for (auto it = jobs.begin(); it != jobs.end();) {
+            bool behind = std::any_of(waiting.begin(), waiting.end(),
+                                      [&it](const String& address) { return address.equalsIgnoreCase(it->info.address); });
+            // A job behind another stays QUEUED; its connect timeout starts when its turn comes
+            if (!behind) {
+                advance(*it, now);
+            }
+            if (it->info.status <= ControlJobStatus::CONNECTING) {
+                waiting.push_back(it->info.address);
+            }
+            if (!it->info.finished()) {
+                ++it;
+                continue;
+            }
+            it->info.elapsedMs = now - it->info.startedMs;
+            log_i("Control job %u for %s: %s in %u ms", it->info.id, it->info.address.c_str(),
+                  controlJobStatusName(it->info.status), it->info.elapsedMs);
+            finishedJobs.push_front(it->info);
+            if (finishedJobs.size() > CONTROL_JOB_HISTORY) {
+                finishedJobs.pop_back();
+            }
+            finished.push_back(it->info);
+            it = jobs.erase(it);
+        }
+    }
+    if (listener) {
+        for (const ControlJob& job : finished) {
+            listener->onControlJobFinished(job);
+        }
+    }
+}
+
+void ControlJobs::advance(Job& job, uint32_t now) {
+    switch (job.info.status) {
+    case ControlJobStatus::QUEUED:
+        if (!btManager->isConnected(job.address) || !send(job, now)) {
+            // The device becomes the active one, like a device picked in the UI
+            btManager->connect(job.address);
+            job.info.status = ControlJobStatus::CONNECTING;
+            job.stepStartedMs = now;
+        }
+        break;
+    case ControlJobStatus::CONNECTING:
+        if (btManager->isConnected(job.address)) {
+            send(job, now);
+        } else if (now - job.stepStartedMs >= CONTROL_CONNECT_TIMEOUT_MS) {
+            job.info.status = ControlJobStatus::CONNECT_TIMEOUT;
+        }
+        break;
+    case ControlJobStatus::SENDING: {
+        BtCompletionSummary summary = summarizeCompletions(job.completions);
+        if (!summary.pending) {
+            job.info.status = summary.failed ? ControlJobStatus::UNACKED : ControlJobStatus::APPLIED;
+        } else if (now - job.stepStartedMs >= CONTROL_ACK_TIMEOUT_MS) {
+            job.info.status = ControlJobStatus::UNACKED;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+bool ControlJobs::send(Job& job, uint32_t now) {
+    switch (sendUpdate(btManager, storageHandler, job.info.address, job.update, &job.completions)) {
+    case ControlSendResult::SENT:
+        job.info.status = ControlJobStatus::SENDING;
+        break;
+    case ControlSendResult::NOT_FOUND:
+        job.info.status = ControlJobStatus::NOT_FOUND;
+        break;
+    case ControlSendResult::LINK_CLOSED:
+        job.info.status = ControlJobStatus::CONNECTING;
+        job.stepStartedMs = now;
+        return false;
+    }
+    job.stepStartedMs = now;
+    return true;
+}
+
+ControlSendResult ControlJobs::sendUpdate(BluetoothManager* bt, StorageHandler* sh, const String& address,
+                                          const ControlUpdate& update, std::vector<BtCompletion>* completions) {
+    // Loaded only now, so the update lands on top of what was sent before it
+    DeviceConfig config;
+    if (!sh->loadSpecificDeviceConfig(address, config)) {
+        return ControlSendResult::NOT_FOUND;
+    }
+    applyUpdate(update, config);
+    bool fullSync = update.has(CONTROL_SYNC) && update.get(CONTROL_SYNC) != 0;
+    if (!bt->sendConfigToDevice(config, fullSync, completions)) {
+        return ControlSendResult::LINK_CLOSED;
+    }
+    sh->saveSpecificDeviceConfig(config);
+    return ControlSendResult::SENT;
+}
+
+void ControlJobs::applyUpdate(const ControlUpdate& update, DeviceConfig& config) {
+    if (update.has(CONTROL_FAN)) {
+        config.fan_speed = update.get(CONTROL_FAN);
+    }
+    if (update.has(CONTROL_BRIGHT)) {
+        config.main_brightness = update.get(CONTROL_BRIGHT);
+    }
+    if (update.has(CONTROL_WARM)) {
+        config.main_warmness = update.get(CONTROL_WARM);
+    }
+    if (update.has(CONTROL_HUE)) {
+        config.ring_hue = update.get(CONTROL_HUE);
+    }
+    if (update.has(CONTROL_RGB_VALUE)) {
+        config.ring_brightness = update.get(CONTROL_RGB_VALUE);
+    }
+    if (update.has(CONTROL_MODE)) {
+        switch (update.get(CONTROL_MODE)) {
+        case CONTROL_MODE_OFF:
+            config.is_on = false;
+            break;
+        case CONTROL_MODE_MAIN:
+            config.is_on = true;
+            config.light_mode = LightMode::MAIN_LIGHT;
+            break;
+        case CONTROL_MODE_RGB:
+            config.is_on = true;
+            config.light_mode = LightMode::RGB_RING;
+            break;
+        }
+    }
+}
@@ -0,0 +1,112 @@
+// ControlJobs.h
+#ifndef CONTROL_JOBS_H
+#define CONTROL_JOBS_H
+
+#include <Arduino.h>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include "BluetoothManager.h"
+#include "StorageHandler.h"
+#include "ControlProtocol.h"
+
+// Most jobs running at once; /control answers 503 beyond this
+const size_t CONTROL_MAX_JOBS = 16;
+// Finished jobs kept for /control_status, newest first
+const size_t CONTROL_JOB_HISTORY = 16;
+// A job whose device's link does not open within this fails with "connect_timeout"
+const uint32_t CONTROL_CONNECT_TIMEOUT_MS = 10000;
+// A job whose commands are not all acknowledged within this fails with "unacked"
+const uint32_t CONTROL_ACK_TIMEOUT_MS = 5000;
+
+enum class ControlJobStatus {
+    QUEUED,          // accepted, waiting for process() or for the device's earlier jobs to go out
+    CONNECTING,      // the device's link is opening
+    SENDING,         // sent, waiting for the light to acknowledge
+    APPLIED,         // the light acknowledged every command
+    NOT_FOUND,       // the device was removed in the meantime
+    CONNECT_TIMEOUT,
+    UNACKED
+};
+
+// What sendUpdate() did
+enum class ControlSendResult {
+    SENT,
+    NOT_FOUND,  // the device was removed in the meantime
+    LINK_CLOSED // the link closed in the meantime and is being opened again; nothing was saved
+};
+
+// "queued", "applied", ... as in /control_status and the "control" event
+const char* controlJobStatusName(ControlJobStatus status);
+
+struct ControlJob {
+    uint32_t id;
+    String address;
+    ControlJobStatus status;
+    uint32_t startedMs;
+    uint32_t elapsedMs; // from start() until it finished, 0 while running
+
+    bool finished() const { return status > ControlJobStatus::SENDING; }
+};
+
+class IControlJobListener {
+public:
+    virtual void onControlJobFinished(const ControlJob& job) = 0;
+    virtual ~IControlJobListener() = default;
+};
+
+/**
+ * The /control requests, run in the background so the HTTP response does not wait for the radio.
+ * start() only queues the update; process() (from loop()) opens the device's link if needed, applies
+ * the update to the stored config when it can be sent, sends the fields that changed and follows
+ * their acknowledgements. Jobs of one device run in the order they were started, and each applies
+ * its update to the config as the previous ones left it.
+ */
+class ControlJobs {
+public:
+    ControlJobs(BluetoothManager* bt, StorageHandler* sh);
+
+    /**
+     * @brief Queues the update for the device. Safe from any task.
+     * @return the job id, 0 if CONTROL_MAX_JOBS are running already.
+     */
+    uint32_t start(const String& address, const ControlUpdate& update);
+
+    /** The job as of now; false if there is no such job (or it finished long ago). */
+    bool get(uint32_t id, ControlJob& job);
+
+    void process();
+    void registerJobListener(IControlJobListener* listener);
+
+    // Sets the fields the update carries; the rest of the config stays as it is
+    static void applyUpdate(const ControlUpdate& update, DeviceConfig& config);
+    // Applies the update to the device's stored config, sends the fields that changed over its open link
+    // and saves the config. Shared by the jobs and SceneRunner.
+    static ControlSendResult sendUpdate(BluetoothManager* bt, StorageHandler* sh, const String& address,
+                                        const ControlUpdate& update, std::vector<BtCompletion>* completions);
+
+private:
+    struct Job {
+        ControlJob info;
+        ControlUpdate update;
+        BTAddress address;
+        uint32_t stepStartedMs;
+        std::vector<BtCompletion> completions;
+    };
+
+    BluetoothManager* btManager;
+    StorageHandler* storageHandler;
+    IControlJobListener* listener = nullptr;
+
+    // Guards everything below: start() and get() run on the async TCP task, process() on the loop task
+    std::mutex mutex;
+    std::vector<Job> jobs;
+    std::deque<ControlJob> finishedJobs;
+    uint32_t nextId = 1;
+
+    void advance(Job& job, uint32_t now);
+    // Sends the job's update over the open link; false if the link closed in the meantime
+    bool send(Job& job, uint32_t now);
+};
+
+#endif
@@ -0,0 +1,74 @@
+// ControlProtocol.h
+#ifndef CONTROL_PROTOCOL_H
+#define CONTROL_PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Binary control frames of the /ws WebSocket, the compact form of /control for slider drags.
+ *
+ * Request (binary message, little endian):
+ *   uint16 seq      echoed in the ack
+ *   uint8  device   index of the device in /get_all_devices ("index")
+ *   uint16 check    last two bytes of its MAC (byte 4 << 8 | byte 5), so a frame sent while a device
+ *                   was added or removed cannot reach the device that moved to its index
+ *   then 1..CONTROL_MAX_FIELDS times:
+ *   uint8  field    ControlField
+ *   uint16 value
+ * Ack: uint16 seq, uint8 ControlStatus. A frame whose device is still connecting is acked
+ * CONTROL_QUEUED right away and acked again (OK or TIMEOUT) once the link opened or gave up.
+ */
+
+enum ControlField : uint8_t {
+    CONTROL_MODE,      // ControlMode
+    CONTROL_FAN,       // 0..3
+    CONTROL_BRIGHT,    // main light intensity
+    CONTROL_WARM,      // main light warmness
+    CONTROL_HUE,       // RGB ring hue, 0..100
+    CONTROL_RGB_VALUE, // RGB ring brightness
+    CONTROL_SYNC,      // 1: resend every field, not only the changed ones
+    CONTROL_FIELD_COUNT
+};
+
+enum ControlMode : uint8_t {
+    CONTROL_MODE_OFF,
+    CONTROL_MODE_MAIN,
+    CONTROL_MODE_RGB
+};
+
+enum ControlStatus : uint8_t {
+    CONTROL_OK,
+    CONTROL_QUEUED,    // the device's link is opening; the config is sent when it is up
+    CONTROL_BAD_FRAME,
+    CONTROL_NOT_FOUND, // no device at that index, or its MAC does not match the check
+    CONTROL_TIMEOUT    // the link did not open in time
+};
+
+const size_t CONTROL_HEADER_SIZE = 5;
+const size_t CONTROL_FIELD_SIZE = 3;
+const size_t CONTROL_MAX_FIELDS = CONTROL_FIELD_COUNT;
+const size_t CONTROL_ACK_SIZE = 3;
+
+// The fields one control request sets, whether it came as a query string or a frame
+struct ControlUpdate {
+    uint8_t present = 0; // bit per ControlField
+    uint16_t values[CONTROL_FIELD_COUNT] = {};
+
+    void set(ControlField field, uint16_t value) {
+        present |= 1 << field;
+        values[field] = value;
+    }
+    bool has(ControlField field) const { return present & (1 << field); }
+    uint16_t get(ControlField field) const { return values[field]; }
+    // Takes over the fields the later update sets; the others stay as they are
+    void merge(const ControlUpdate& later) {
+        for (uint8_t field = 0; field < CONTROL_FIELD_COUNT; field++) {
+            if (later.has((ControlField)field)) {
+                set((ControlField)field, later.get((ControlField)field));
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,69 @@
+#include "DeferredResponses.h"
+#include <utility>
+#include <vector>
+
+uint32_t DeferredResponses::defer(AsyncWebServerRequest* request, uint32_t timeoutMs) {
+    // Keeps the server from answering or timing out the request itself until it is sent
+    request->pause();
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t id = nextId++;
+    entries[id] = Entry{request->getThis(), millis() + timeoutMs, false, 0, String(), String()};
+    return id;
+}
+
+bool DeferredResponses::complete(uint32_t id, int code, const String& contentType, const String& body) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(id);
+    if (it == entries.end() || it->second.completed) {
+        return false;
+    }
+    it->second.completed = true;
+    it->second.code = code;
+    it->second.contentType = contentType;
+    it->second.body = body;
+    return true;
+}
+
+void DeferredResponses::process() {
+    // Taken out under the lock and sent without it: sending can run the server's callbacks
+    std::vector<std::pair<uint32_t, Entry>> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint32_t now = millis();
+        for (auto it = entries.begin(); it != entries.end();) {
+            Entry& entry = it->second;
+            if (entry.request.expired()) {
+                // The client went away, and the server deleted the request
+            } else if (entry.completed) {
+                ready.emplace_back(it->first, std::move(entry));
+            } else if ((int32_t)(now - entry.deadlineMs) >= 0) {
+                log_w("Deferred response %u timed out.", it->first);
+                entry.code = 504;
+                entry.contentType = "text/plain";
+                entry.body = "Error: Timed out.";
+                ready.emplace_back(it->first, std::move(entry));
+            } else {
+                ++it;
+                continue;
+            }
+            it = entries.erase(it);
+        }
+    }
+    for (auto& pair : ready) {
+        // Held for the duration of send(), so the request cannot be deleted in the middle of it
+        if (std::shared_ptr<AsyncWebServerRequest> request = pair.second.request.lock()) {
+            request->send(pair.second.code, pair.second.contentType, pair.second.body);
+        }
+    }
+}
+
+bool DeferredResponses::isPending(uint32_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(id);
+    return it != entries.end() && !it->second.completed && !it->second.request.expired();
+}
+
+size_t DeferredResponses::pending() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
@@ -0,0 +1,55 @@
+// DeferredResponses.h
+#ifndef DEFERRED_RESPONSES_H
+#define DEFERRED_RESPONSES_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <map>
+#include <mutex>
+
+/**
+ * Requests whose response is sent later, possibly decided on another task.
+ * A handler parks its request with defer() and returns; whoever has the answer calls complete()
+ * with the id, and process() (called from loop()) sends it. A client that disconnects first is
+ * forgotten, and a request that is not completed in time is answered with 504.
+ * Built on the web server's request continuation (ESPAsyncWebServer >= 3.7): the request is paused,
+ * and only a weak reference to it is kept, which the server clears when it deletes the request.
+ */
+class DeferredResponses {
+public:
+    /**
+     * @brief Parks the request until complete() or the timeout.
+     * @return the id to complete it with.
+     */
+    uint32_t defer(AsyncWebServerRequest* request, uint32_t timeoutMs);
+
+    /**
+     * @brief Sets the response of a parked request. Safe from any task.
+     * @return false if the request is gone (client disconnected, timed out or already completed).
+     */
+    bool complete(uint32_t id, int code, const String& contentType, const String& body);
+
+    /** Sends the completed responses and times out the expired ones. Call from loop(). */
+    void process();
+
+    /** True while the request waits for complete() (and its client is still there). */
+    bool isPending(uint32_t id);
+    size_t pending();
+
+private:
+    struct Entry {
+        AsyncWebServerRequestPtr request;
+        uint32_t deadlineMs;
+        bool completed;
+        int code;
+        String contentType;
+        String body;
+    };
+
+    // Guards entries: handlers run on the async TCP task, process() on the loop task
+    std::mutex mutex;
+    std::map<uint32_t, Entry> entries;
+    uint32_t nextId = 1;
+};
+
+#endif
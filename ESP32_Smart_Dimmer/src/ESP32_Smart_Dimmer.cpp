@@ -143,6 +143,10 @@ void loop()
         delay(1000); // Simple delay to prevent hammering serial, remove for real-time
     }
 
-    btManager->clearInputBuffer();
+    // Picks up changes made with the lights' own remotes
+    storageHandler->reconcile();
+    // Writes the configs that changed to NVS once they settle
+    storageHandler->tryStore();
+
     delay(5); // Small delay for stability
 }
\ No newline at end of file
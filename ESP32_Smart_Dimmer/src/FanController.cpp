@@ -7,7 +7,7 @@ const uint8_t MAX_FAN_SPEED = 3;
 FanController::FanController(BluetoothManager* bt)
   : btManager(bt) {}
 
-void FanController::setSpeed(int speed) {
+void FanController::setSpeed(int speed, BtPriority priority) {
   int newSpeed = constrain(speed, MIN_FAN_SPEED, MAX_FAN_SPEED);
   if (newSpeed != currentSpeed) {
     currentSpeed = newSpeed;
@@ -25,17 +25,23 @@ void FanController::setSpeed(int speed) {
     } else {
       log_d("callback is null");
     }
-    uint8_t payload[] = { (uint8_t)currentSpeed };
-    btManager->sendCommand(CMD_FAN_SPEED, payload, sizeof(payload));
   }
+  // Always handed to the BT manager: the device's shadow state decides whether it goes out
+  // (e.g. after a reconnect the same speed has to be sent again)
+  uint8_t payload[] = { (uint8_t)currentSpeed };
+  btManager->sendCommand(CMD_FAN_SPEED, payload, sizeof(payload), priority);
 }
 
 void FanController::increaseSpeed() {
-  setSpeed(currentSpeed + 1);
+  setSpeed(currentSpeed + 1, BtPriority::URGENT);
 }
 
 void FanController::decreaseSpeed() {
-  setSpeed(currentSpeed - 1);
+  setSpeed(currentSpeed - 1, BtPriority::URGENT);
+}
+
+void FanController::syncSpeed(int speed) {
+  currentSpeed = constrain(speed, MIN_FAN_SPEED, MAX_FAN_SPEED);
 }
 
 void FanController::registerListener(IFanControllerListener* listener) {
@@ -12,9 +12,12 @@ public:
 class FanController {
 public:
   FanController(BluetoothManager* bt);
-  void setSpeed(int speed);
+  // NORMAL for config syncs; the encoder steps below send URGENT so they overtake web traffic
+  void setSpeed(int speed, BtPriority priority = BtPriority::NORMAL);
   void increaseSpeed();
   void decreaseSpeed();
+  // Takes over a speed the fan reported (e.g. set with its remote) without sending anything
+  void syncSpeed(int speed);
   void registerListener(IFanControllerListener* listener);
 private:
   BluetoothManager* btManager;
@@ -0,0 +1,40 @@
+#ifndef I_TRANSPORT_H
+#define I_TRANSPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Events of a transport. They may arrive on any thread (the Bluetooth task on the ESP32).
+class ITransportListener
+{
+public:
+    // Result of open(). channel is the one actually used, so the caller can skip the lookup next time.
+    virtual void onTransportOpen(const uint8_t address[6], uint32_t handle, uint8_t channel, bool ok) = 0;
+    virtual void onTransportClose(uint32_t handle) = 0;
+    // Received bytes; only valid during the call
+    virtual void onTransportData(uint32_t handle, const uint8_t *data, size_t len) = 0;
+    virtual void onTransportWriteComplete(uint32_t handle, bool ok, bool congested) = 0;
+    virtual void onTransportCongestion(uint32_t handle, bool congested) = 0;
+    virtual ~ITransportListener() = default;
+};
+
+/**
+ * Byte stream links to the lights, addressed by MAC. Everything is asynchronous: open and write
+ * complete with an event, and reads are pushed through onTransportData.
+ * SppTransport is the ESP32 implementation; tools/host has one over Unix sockets and ptys.
+ */
+class ITransport
+{
+public:
+    virtual bool begin(ITransportListener *listener) = 0;
+    // Starts opening a link; channel 0 means it has to be looked up first
+    virtual bool open(const uint8_t address[6], uint8_t channel) = 0;
+    // Starts writing len bytes; the data is copied before returning
+    virtual bool write(uint32_t handle, const uint8_t *data, size_t len) = 0;
+    // Waits until everything written on the link has left this side
+    virtual void flush(uint32_t) {}
+    virtual bool close(uint32_t handle) = 0;
+    virtual ~ITransport() = default;
+};
+
+#endif // I_TRANSPORT_H
@@ -0,0 +1,53 @@
+#include "JsonResponse.h"
+#include <algorithm>
+#include <memory>
+
+namespace {
+
+struct JsonStream {
+    char buffer[JSON_RESPONSE_BUFFER_SIZE];
+    JsonWriter writer;
+    JsonProducer producer;
+    size_t offset; // of the part being copied out
+    bool done;
+
+    explicit JsonStream(JsonProducer producer)
+        : writer(buffer, sizeof(buffer)), producer(producer), offset(0), done(false) {
+    }
+
+    // Writes the next part into the emptied buffer
+    void next() {
+        writer.clear();
+        offset = 0;
+        JsonWriter::Mark mark = writer.mark();
+        done = !producer(writer);
+        if (writer.overflowed()) {
+            log_e("JSON part larger than %u bytes, left out.", (unsigned)JSON_RESPONSE_BUFFER_SIZE);
+            writer.rewind(mark);
+        }
+    }
+};
+
+}
+
+AsyncWebServerResponse* beginJsonResponse(AsyncWebServerRequest* request, JsonProducer producer) {
+    std::shared_ptr<JsonStream> stream = std::make_shared<JsonStream>(producer);
+    return request->beginChunkedResponse("application/json",
+        [stream](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+            size_t written = 0;
+            while (written < maxLen) {
+                if (stream->offset == stream->writer.length()) {
+                    if (stream->done) {
+                        break;
+                    }
+                    stream->next();
+                    continue;
+                }
+                size_t count = std::min(maxLen - written, stream->writer.length() - stream->offset);
+                memcpy(buffer + written, stream->writer.data() + stream->offset, count);
+                stream->offset += count;
+                written += count;
+            }
+            return written;
+        });
+}
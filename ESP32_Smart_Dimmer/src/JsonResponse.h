@@ -0,0 +1,25 @@
+// JsonResponse.h
+#ifndef JSON_RESPONSE_H
+#define JSON_RESPONSE_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <functional>
+#include "JsonWriter.h"
+
+// Size of the buffer a streamed JSON response is written through; one part has to fit in it
+const size_t JSON_RESPONSE_BUFFER_SIZE = 1024;
+
+/**
+ * Writes the next part of a document (typically one member or array element) and returns
+ * true while there is more to come. A part that does not fit the buffer is logged and left out.
+ */
+typedef std::function<bool(JsonWriter&)> JsonProducer;
+
+/**
+ * A chunked JSON response written part by part as the socket takes it, through one fixed buffer:
+ * the heap used does not grow with the size of the document.
+ */
+AsyncWebServerResponse* beginJsonResponse(AsyncWebServerRequest* request, JsonProducer producer);
+
+#endif
@@ -0,0 +1,245 @@
+#include "JsonWriter.h"
+#include <math.h>
+#include <string.h>
+
+static const char HEX_DIGITS[] = "0123456789ABCDEF";
+
+// Characters a JSON string cannot hold as they are
+static bool needsEscape(char c) {
+    return c == '"' || c == '\\' || (uint8_t)c < 0x20;
+}
+
+JsonWriter::JsonWriter(char* buffer, size_t capacity)
+    : buffer(buffer), capacity(capacity - 1), len(0), hasElements(0), depth(0), afterKey(false), overflow(false) {
+    terminate();
+}
+
+JsonWriter& JsonWriter::beginObject() {
+    return open('{');
+}
+
+JsonWriter& JsonWriter::endObject() {
+    return close('}');
+}
+
+JsonWriter& JsonWriter::beginArray() {
+    return open('[');
+}
+
+JsonWriter& JsonWriter::endArray() {
+    return close(']');
+}
+
+JsonWriter& JsonWriter::key(const char* name) {
+    separate();
+    put('"');
+    putEscaped(name, strlen(name));
+    put('"');
+    put(':');
+    afterKey = true;
+    terminate();
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(const char* text) {
+    return value(text, strlen(text));
+}
+
+JsonWriter& JsonWriter::value(const char* text, size_t length) {
+    separate();
+    put('"');
+    putEscaped(text, length);
+    put('"');
+    terminate();
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(bool flag) {
+    separate();
+    if (flag) {
+        put("true", 4);
+    } else {
+        put("false", 5);
+    }
+    terminate();
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(float number, uint8_t decimals) {
+    if (!isfinite(number)) {
+        return null();
+    }
+    uint64_t scale = 1;
+    for (uint8_t i = 0; i < decimals; i++) {
+        scale *= 10;
+    }
+    // Rounded once, as a whole number of the last decimal
+    bool negative = number < 0;
+    uint64_t scaled = (uint64_t)llround(fabs((double)number) * scale);
+    separate();
+    if (negative && scaled) {
+        put('-');
+    }
+    putUnsigned(scaled / scale);
+    if (decimals) {
+        put('.');
+        char digits[20];
+        uint64_t fraction = scaled % scale;
+        for (uint8_t i = decimals; i > 0; i--) {
+            digits[i - 1] = '0' + fraction % 10;
+            fraction /= 10;
+        }
+        put(digits, decimals);
+    }
+    terminate();
+    return *this;
+}
+
+JsonWriter& JsonWriter::signedNumber(int64_t number) {
+    separate();
+    if (number < 0) {
+        put('-');
+        putUnsigned(0 - (uint64_t)number);
+    } else {
+        putUnsigned(number);
+    }
+    terminate();
+    return *this;
+}
+
+JsonWriter& JsonWriter::unsignedNumber(uint64_t number) {
+    separate();
+    putUnsigned(number);
+    terminate();
+    return *this;
+}
+
+JsonWriter& JsonWriter::null() {
+    separate();
+    put("null", 4);
+    terminate();
+    return *this;
+}
+
+JsonWriter& JsonWriter::macAddress(const uint8_t address[6]) {
+    char text[17];
+    for (int i = 0; i < 6; i++) {
+        text[i * 3] = HEX_DIGITS[address[i] >> 4];
+        text[i * 3 + 1] = HEX_DIGITS[address[i] & 0x0F];
+        if (i < 5) {
+            text[i * 3 + 2] = ':';
+        }
+    }
+    return value(text, sizeof(text));
+}
+
+void JsonWriter::clear() {
+    len = 0;
+    overflow = false;
+    terminate();
+}
+
+JsonWriter::Mark JsonWriter::mark() const {
+    return Mark{len, hasElements, depth, afterKey, overflow};
+}
+
+void JsonWriter::rewind(const Mark& mark) {
+    len = mark.length;
+    hasElements = mark.hasElements;
+    depth = mark.depth;
+    afterKey = mark.afterKey;
+    overflow = mark.overflowed;
+    terminate();
+}
+
+JsonWriter& JsonWriter::open(char bracket) {
+    separate();
+    put(bracket);
+    if (depth < MAX_DEPTH) {
+        depth++;
+        hasElements &= ~(1UL << (depth - 1));
+    }
+    terminate();
+    return *this;
+}
+
+JsonWriter& JsonWriter::close(char bracket) {
+    put(bracket);
+    if (depth > 0) {
+        depth--;
+    }
+    afterKey = false;
+    terminate();
+    return *this;
+}
+
+void JsonWriter::separate() {
+    if (afterKey) {
+        afterKey = false;
+        return;
+    }
+    if (depth == 0) {
+        return;
+    }
+    uint32_t bit = 1UL << (depth - 1);
+    if (hasElements & bit) {
+        put(',');
+    }
+    hasElements |= bit;
+}
+
+void JsonWriter::put(char c) {
+    if (len < capacity) {
+        buffer[len++] = c;
+    } else {
+        overflow = true;
+    }
+}
+
+void JsonWriter::put(const char* text, size_t length) {
+    if (length > capacity - len) {
+        overflow = true;
+        length = capacity - len;
+    }
+    memcpy(buffer + len, text, length);
+    len += length;
+}
+
+void JsonWriter::putUnsigned(uint64_t number) {
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[sizeof(digits) - ++count] = '0' + number % 10;
+        number /= 10;
+    } while (number);
+    put(digits + sizeof(digits) - count, count);
+}
+
+void JsonWriter::putEscaped(const char* text, size_t length) {
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (!needsEscape(text[i])) {
+            continue;
+        }
+        // Everything up to here needed no escaping and is copied as one run
+        put(text + start, i - start);
+        start = i + 1;
+        char c = text[i];
+        switch (c) {
+        case '"':  put("\\\"", 2); break;
+        case '\\': put("\\\\", 2); break;
+        case '\n': put("\\n", 2); break;
+        case '\r': put("\\r", 2); break;
+        case '\t': put("\\t", 2); break;
+        default: {
+            char escaped[6] = {'\\', 'u', '0', '0', HEX_DIGITS[(uint8_t)c >> 4], HEX_DIGITS[c & 0x0F]};
+            put(escaped, sizeof(escaped));
+        }
+        }
+    }
+    put(text + start, length - start);
+}
+
+void JsonWriter::terminate() {
+    buffer[len] = '\0';
+}
@@ -0,0 +1,95 @@
+// JsonWriter.h
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <type_traits>
+
+/**
+ * Writes JSON into a fixed buffer, without allocating. Commas and the quoting and escaping of
+ * strings are taken care of; the caller only says what comes next.
+ * Text that does not fit sets overflowed() and is dropped, and the output stays NUL terminated.
+ * clear() empties the buffer but keeps the nesting, so a document can be written (and sent) in
+ * pieces through one small buffer, see JsonResponse.h.
+ */
+class JsonWriter {
+public:
+    // Nesting levels deeper than this are not tracked
+    static const uint8_t MAX_DEPTH = 32;
+
+    // Everything needed to undo the writes made after mark()
+    struct Mark {
+        size_t length;
+        uint32_t hasElements;
+        uint8_t depth;
+        bool afterKey;
+        bool overflowed;
+    };
+
+    JsonWriter(char* buffer, size_t capacity);
+
+    JsonWriter& beginObject();
+    JsonWriter& endObject();
+    JsonWriter& beginArray();
+    JsonWriter& endArray();
+    // Name of the next object member; the value follows with value() or begin...()
+    JsonWriter& key(const char* name);
+
+    JsonWriter& value(const char* text);
+    JsonWriter& value(const char* text, size_t length);
+    JsonWriter& value(bool flag);
+    JsonWriter& value(float number, uint8_t decimals);
+    // Floating point needs the number of decimals; without these it would silently become a bool
+    JsonWriter& value(float number) = delete;
+    JsonWriter& value(double number) = delete;
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value, JsonWriter&>::type value(T number) {
+        return std::is_signed<T>::value ? signedNumber((int64_t)number) : unsignedNumber((uint64_t)number);
+    }
+    JsonWriter& null();
+    // A Bluetooth address as "AA:BB:CC:DD:EE:FF"
+    JsonWriter& macAddress(const uint8_t address[6]);
+
+    template <typename T>
+    JsonWriter& member(const char* name, T v) {
+        key(name);
+        return value(v);
+    }
+    JsonWriter& member(const char* name, float number, uint8_t decimals) {
+        key(name);
+        return value(number, decimals);
+    }
+
+    const char* data() const { return buffer; }
+    size_t length() const { return len; }
+    bool overflowed() const { return overflow; }
+
+    // Drops the written text (it was sent) but stays inside the objects and arrays opened so far
+    void clear();
+    Mark mark() const;
+    void rewind(const Mark& mark);
+
+private:
+    char* buffer;
+    size_t capacity; // without the terminating NUL
+    size_t len;
+    uint32_t hasElements; // bit per nesting level: something was written at that level
+    uint8_t depth;
+    bool afterKey;
+    bool overflow;
+
+    JsonWriter& signedNumber(int64_t number);
+    JsonWriter& unsignedNumber(uint64_t number);
+    JsonWriter& open(char bracket);
+    JsonWriter& close(char bracket);
+    // Writes the comma that separates this element from the previous one, if any
+    void separate();
+    void put(char c);
+    void put(const char* text, size_t length);
+    void putUnsigned(uint64_t number);
+    void putEscaped(const char* text, size_t length);
+    void terminate();
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "LightController.h"
+#include "Utils.h"
 #include <Arduino.h>
 
 const int LIGHT_BRIGHTNESS_STEP = 1;
@@ -20,8 +21,8 @@ void LightController::turnOn() {
   if (!isOn) {
     isOn = true;
     log_i("Light ON");
-    uint8_t payload[] = { 0x01 };  // ON
-    btManager->sendCommand(CMD_LIGHT_ON_OFF, payload, sizeof(payload));
+    uint8_t payload[] = { LightProtocol::LIGHT_ON };
+    btManager->sendCommand(CMD_LIGHT_ON_OFF, payload, sizeof(payload), BtPriority::URGENT);
   }
 }
 
@@ -29,8 +30,8 @@ void LightController::turnOff() {
   if (isOn) {
     isOn = false;
     log_i("Light OFF");
-    uint8_t payload[] = { 0x02 };  // OFF
-    btManager->sendCommand(CMD_LIGHT_ON_OFF, payload, sizeof(payload));
+    uint8_t payload[] = { LightProtocol::LIGHT_OFF };
+    btManager->sendCommand(CMD_LIGHT_ON_OFF, payload, sizeof(payload), BtPriority::URGENT);
     invokeCallback();
   }
 }
@@ -38,8 +39,8 @@ void LightController::turnOff() {
 void LightController::toggle() {
   isOn = !isOn;
   log_i("Light Toggled: %s", isOn ? "ON" : "OFF");
-  uint8_t payload[] = { isOn ? (uint8_t)0x01 : (uint8_t)0x02 };
-  btManager->sendCommand(CMD_LIGHT_ON_OFF, payload, sizeof(payload));
+  uint8_t payload[] = { isOn ? LightProtocol::LIGHT_ON : LightProtocol::LIGHT_OFF };
+  btManager->sendCommand(CMD_LIGHT_ON_OFF, payload, sizeof(payload), BtPriority::URGENT);
 }
 
 void LightController::setBrightness(int newBrightness, bool forceUpdate) {
@@ -47,7 +48,7 @@ void LightController::setBrightness(int newBrightness, bool forceUpdate) {
   *brightness = constrain(newBrightness, minIntensity, maxIntensity);
   if ((*brightness) != oldBrightness || forceUpdate) {
     log_i("Brightness set to: %d", *brightness);
-    sendState();
+    sendState(BtPriority::URGENT);
   }
 }
 
@@ -72,13 +73,13 @@ void LightController::changeWarmness() {
     warmnessStep = -warmnessStep;
   }
   log_i("Warmness changed to: %d", warmness);
-  sendState();
+  sendState(BtPriority::URGENT);
 }
 
 void LightController::rotateHue() {
   if (!isOn || currentMode != RGB_RING) return;
   hue = (hue + 1) % 100;
-  sendState();
+  sendState(BtPriority::URGENT);
 }
 
 void LightController::switchMode() {
@@ -95,27 +96,26 @@ void LightController::switchMode() {
   }
   log_i("Mode switched to: %s", (currentMode == MAIN_LIGHT) ? "Main Light" : "RGB Ring");
   // Resend state to apply current settings to the new mode
-  sendState();
-  delay(10);  // Send twice for reliability with some devices
-  sendState();
+  sendState(BtPriority::URGENT);
 }
 
-void LightController::sendState() {
+// Sends the current mode's fields; the device's shadow state filters out the ones that did not change
+void LightController::sendState(BtPriority priority) {
   if (!btManager->isConnected()) return;
 
   if (currentMode == MAIN_LIGHT) {
     uint8_t intensityPayload[] = { (uint8_t)constrain(brightnessMain, MIN_INTENSITY_MAIN, MAX_INTENSITY_MAIN) };
-    btManager->sendCommand(CMD_LIGHT_INTENSITY, intensityPayload, sizeof(intensityPayload));
+    btManager->sendCommand(CMD_LIGHT_INTENSITY, intensityPayload, sizeof(intensityPayload), priority);
 
     uint8_t warmnessPayload[] = { (uint8_t)constrain(warmness, MIN_WARMNESS, MAX_WARMNESS) };
-    btManager->sendCommand(CMD_LIGHT_WARMNESS, warmnessPayload, sizeof(warmnessPayload));
+    btManager->sendCommand(CMD_LIGHT_WARMNESS, warmnessPayload, sizeof(warmnessPayload), priority);
   } else {
-    sendRGBState();
+    sendRGBState(priority);
   }
   invokeCallback();
 }
 
-void LightController::sendRGBState() {
+void LightController::sendRGBState(BtPriority priority) {
   int r, g, b;
   hslToRgb((float)hue / 100.0, 1.0, (float)brightnessRing / 255.0, &r, &g, &b);
   log_i("Ring RGB: %d, %d, %d (hue: %d, brightness: %d)", r, g, b, hue, brightnessRing);
@@ -126,29 +126,7 @@ void LightController::sendRGBState() {
     (uint8_t)g,
     (uint8_t)b
   };
-  btManager->sendCommand(CMD_RGB, payload, sizeof(payload));
-}
-
-// HSL to RGB conversion functions (kept as static private methods)
-void LightController::hslToRgb(float h, float s, float l, int* r, int* g, int* b) {
-  if (s == 0.0) {
-    *r = *g = *b = (int)(l * 255.0);
-  } else {
-    float q = l < 0.5 ? l * (1.0 + s) : l + s - l * s;
-    float p = 2.0 * l - q;
-    *r = (int)(255 * hueToRgb(p, q, h + 1.0 / 3.0));
-    *g = (int)(255 * hueToRgb(p, q, h));
-    *b = (int)(255 * hueToRgb(p, q, h - 1.0 / 3.0));
-  }
-}
-
-float LightController::hueToRgb(float p, float q, float t) {
-  if (t < 0.0) t += 1;
-  if (t > 1.0) t -= 1;
-  if (t < 1.0 / 6.0) return p + (q - p) * 6.0 * t;
-  if (t < 1.0 / 2.0) return q;
-  if (t < 2.0 / 3.0) return p + (q - p) * (2.0 / 3.0 - t) * 6.0;
-  return p;
+  btManager->sendCommand(CMD_RGB, payload, sizeof(payload), priority);
 }
 
 void LightController::setAll(LightMode mode, int mainBrightness, int mainWarmness, int ringBrightness, int ringHue) {
@@ -157,10 +135,15 @@ void LightController::setAll(LightMode mode, int mainBrightness, int mainWarmnes
   this->warmness = mainWarmness;
   this->hue = ringHue;
   this->currentMode = mode;
-  turnOn();
-  sendState();
-  delay(10);  // Send twice for reliability with some devices
-  sendState();
+  isOn = true;
+  // Sent even if we think the light is on: the shadow state skips it unless the device needs it
+  uint8_t payload[] = { LightProtocol::LIGHT_ON };
+  btManager->sendCommand(CMD_LIGHT_ON_OFF, payload, sizeof(payload));
+  sendState(BtPriority::NORMAL);
+}
+
+void LightController::syncPower(bool on) {
+  isOn = on;
 }
 
 void LightController::registerListener(ILightControllerListener* listener) {
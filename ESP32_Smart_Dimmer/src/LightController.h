@@ -25,6 +25,8 @@ public:
   LightMode getMode();
   void registerListener(ILightControllerListener* listener);
   void setAll(LightMode mode, int mainBrightness, int mainWarmness, int ringBrightness, int ringHue);
+  // Takes over the power state the light reported (e.g. set with its remote) without sending anything
+  void syncPower(bool on);
 
 private:
   BluetoothManager* btManager;
@@ -40,10 +42,9 @@ private:
   int minIntensity = 1;  // current light mode min intensity
   int maxIntensity = 16; // current light mode max intensity
 
-  void sendState();
-  void sendRGBState();
-  static void hslToRgb(float h, float s, float l, int* r, int* g, int* b);
-  static float hueToRgb(float p, float q, float t);
+  // Methods driven by the local input send with BtPriority::URGENT, setAll (a config sync) with NORMAL
+  void sendState(BtPriority priority);
+  void sendRGBState(BtPriority priority);
   
   ILightControllerListener* listener;
   void invokeCallback();
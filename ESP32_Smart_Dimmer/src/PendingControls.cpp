@@ -0,0 +1,45 @@
+#include "PendingControls.h"
+#include <string.h>
+
+ControlUpdate PendingControls::combine(const uint8_t address[6], const ControlUpdate& update) const {
+    const Device* device = findConst(address);
+    if (!device) {
+        return update;
+    }
+    ControlUpdate combined = device->update;
+    combined.merge(update);
+    return combined;
+}
+
+PendingControls::Device& PendingControls::add(const uint8_t address[6], const ControlUpdate& update,
+                                              uint32_t deadlineMs, uint32_t client, uint16_t seq) {
+    Device* device = find(address);
+    if (!device) {
+        waiting.push_back(Device());
+        device = &waiting.back();
+        memcpy(device->address, address, sizeof(device->address));
+        device->deadlineMs = deadlineMs;
+    }
+    device->update.merge(update);
+    for (Frame& frame : device->frames) {
+        if (frame.client == client) {
+            frame.seq = seq;
+            return *device;
+        }
+    }
+    device->frames.push_back(Frame{client, seq});
+    return *device;
+}
+
+PendingControls::Device* PendingControls::find(const uint8_t address[6]) {
+    return const_cast<Device*>(findConst(address));
+}
+
+const PendingControls::Device* PendingControls::findConst(const uint8_t address[6]) const {
+    for (const Device& device : waiting) {
+        if (memcmp(device.address, address, sizeof(device.address)) == 0) {
+            return &device;
+        }
+    }
+    return nullptr;
+}
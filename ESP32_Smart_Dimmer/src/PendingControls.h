@@ -0,0 +1,49 @@
+// PendingControls.h
+#ifndef PENDING_CONTROLS_H
+#define PENDING_CONTROLS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "ControlProtocol.h"
+
+/**
+ * The /ws control frames waiting for their device's link to open (see ControlProtocol.h).
+ * Nothing is saved while a link opens, so the frames of one device are folded into one update,
+ * later frames winning: a frame that sets the warmness keeps the brightness an earlier frame set.
+ * The owner applies that update to the stored config whenever it sends or saves.
+ * Not locked; platform neutral, so tools/test_pending_controls.cpp runs it on the host.
+ */
+class PendingControls {
+public:
+    // A frame to ack once the link is up; only a client's latest frame per device is kept
+    struct Frame {
+        uint32_t client;
+        uint16_t seq;
+    };
+
+    struct Device {
+        uint8_t address[6];
+        ControlUpdate update; // every waiting frame's fields
+        uint32_t deadlineMs;  // the link has to open by then, counted from the first frame
+        std::vector<Frame> frames;
+    };
+
+    // The device's waiting update with this one on top; just this one if nothing waits
+    ControlUpdate combine(const uint8_t address[6], const ControlUpdate& update) const;
+
+    // Folds the frame's update into what waits for the device (which starts waiting if it did not),
+    // and acks the frame once the link is up
+    Device& add(const uint8_t address[6], const ControlUpdate& update, uint32_t deadlineMs, uint32_t client, uint16_t seq);
+
+    Device* find(const uint8_t address[6]);
+    std::vector<Device>& devices() { return waiting; }
+    bool empty() const { return waiting.empty(); }
+
+private:
+    std::vector<Device> waiting;
+
+    const Device* findConst(const uint8_t address[6]) const;
+};
+
+#endif
@@ -0,0 +1,195 @@
+#include "SceneRunner.h"
+#include "JsonWriter.h"
+
+SceneRunner::SceneRunner(BluetoothManager* bt, StorageHandler* sh, DeferredResponses* deferred)
+    : btManager(bt), storageHandler(sh), deferred(deferred) {
+}
+
+void SceneRunner::start(const std::vector<Entry>& entries, uint32_t deferredId) {
+    Scene scene;
+    scene.deferredId = deferredId;
+    scene.startedMs = millis();
+    scene.planned = false;
+    scene.linksOpened = 0;
+    for (const Entry& entry : entries) {
+        Device device;
+        device.entry = entry;
+        device.address = BTAddress(entry.address);
+        device.step = entry.found ? Step::WAITING : Step::DONE;
+        device.result = entry.found ? nullptr : "not_found";
+        device.wasConnected = false;
+        device.connectStartedMs = device.connectMs = device.sentMs = device.doneMs = 0;
+        scene.devices.push_back(device);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    newScenes.push_back(std::move(scene));
+}
+
+/**
+ * Moves every scene on: sends to the links that opened, collects the acknowledgements, and gives the
+ * free link slots to the next waiting devices (oldest scene first). Finished scenes are answered.
+ */
+void SceneRunner::process() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Scene& scene : newScenes) {
+            log_i("Scene with %d devices started.", scene.devices.size());
+            scenes.push_back(std::move(scene));
+        }
+        newScenes.clear();
+    }
+    if (scenes.empty()) {
+        return;
+    }
+
+    uint32_t now = millis();
+    size_t inFlight = 0;
+    for (Scene& scene : scenes) {
+        advance(scene, now);
+        for (const Device& device : scene.devices) {
+            if (device.step == Step::CONNECTING || device.step == Step::SENDING) {
+                inFlight++;
+            }
+        }
+    }
+
+    // A device only takes a slot while its link opens or its packets are unacknowledged, so a
+    // new connect never evicts a link the scene still needs
+    size_t maxLinks = btManager->getMaxLinks();
+    for (Scene& scene : scenes) {
+        for (Device& device : scene.devices) {
+            if (inFlight >= maxLinks) {
+                break;
+            }
+            if (device.step != Step::WAITING) {
+                continue;
+            }
+            if (btManager->isConnected(device.address) && send(device, now, scene)) {
+                device.wasConnected = true;
+            } else if (device.step == Step::WAITING) {
+                btManager->connect(device.address, BtConnectReason::BATCH);
+                device.step = Step::CONNECTING;
+                device.connectStartedMs = now;
+            }
+            inFlight++;
+        }
+    }
+
+    for (auto it = scenes.begin(); it != scenes.end();) {
+        Scene& scene = *it;
+        bool timedOut = now - scene.startedMs >= SCENE_TIMEOUT_MS;
+        bool done = true;
+        for (Device& device : scene.devices) {
+            if (device.step != Step::DONE) {
+                if (!timedOut) {
+                    done = false;
+                    break;
+                }
+                finish(device, device.step == Step::SENDING ? "unacked" : "connect_timeout", now, scene);
+            }
+        }
+        if (!done) {
+            ++it;
+            continue;
+        }
+        log_i("Scene with %d devices done in %u ms.", scene.devices.size(), now - scene.startedMs);
+        deferred->complete(scene.deferredId, 200, "application/json", renderResult(scene, now));
+        it = scenes.erase(it);
+    }
+}
+
+void SceneRunner::advance(Scene& scene, uint32_t now) {
+    // Devices whose link is open already go first; they need no link switch at all
+    if (!scene.planned) {
+        scene.planned = true;
+        for (Device& device : scene.devices) {
+            if (device.step == Step::WAITING && btManager->isConnected(device.address) && send(device, now, scene)) {
+                device.wasConnected = true;
+            }
+        }
+    }
+
+    for (Device& device : scene.devices) {
+        switch (device.step) {
+        case Step::CONNECTING:
+            if (btManager->isConnected(device.address)) {
+                device.connectMs = now - device.connectStartedMs;
+                if (send(device, now, scene)) {
+                    scene.linksOpened++;
+                }
+            } else if (now - device.connectStartedMs >= SCENE_CONNECT_TIMEOUT_MS) {
+                finish(device, "connect_timeout", now, scene);
+            }
+            break;
+        case Step::SENDING: {
+            BtCompletionSummary summary = summarizeCompletions(device.completions);
+            if (!summary.pending) {
+                finish(device, summary.failed ? "unacked" : "ok", now, scene);
+            } else if (now - device.sentMs >= SCENE_ACK_TIMEOUT_MS) {
+                finish(device, "unacked", now, scene);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+bool SceneRunner::send(Device& device, uint32_t now, const Scene& scene) {
+    switch (ControlJobs::sendUpdate(btManager, storageHandler, device.entry.address, device.entry.update,
+                                    &device.completions)) {
+    case ControlSendResult::SENT:
+        device.step = Step::SENDING;
+        device.sentMs = now;
+        return true;
+    case ControlSendResult::NOT_FOUND:
+        finish(device, "not_found", now, scene);
+        return false;
+    case ControlSendResult::LINK_CLOSED:
+        device.step = Step::CONNECTING;
+        device.connectStartedMs = now;
+        return false;
+    }
+    return false;
+}
+
+void SceneRunner::finish(Device& device, const char* result, uint32_t now, const Scene& scene) {
+    device.step = Step::DONE;
+    device.result = result;
+    device.doneMs = now - scene.startedMs;
+}
+
+String SceneRunner::renderResult(const Scene& scene, uint32_t now) {
+    char buffer[256];
+    JsonWriter json(buffer, sizeof(buffer));
+    String body;
+    size_t commands = 0;
+    size_t succeeded = 0;
+    for (const Device& device : scene.devices) {
+        commands += device.completions.size();
+        succeeded += strcmp(device.result, "ok") == 0;
+    }
+    json.beginObject();
+    json.member("elapsed_ms", now - scene.startedMs);
+    json.member("ok", succeeded);
+    json.member("failed", scene.devices.size() - succeeded);
+    json.member("links_opened", scene.linksOpened);
+    json.member("commands", commands);
+    json.key("devices").beginArray();
+    for (const Device& device : scene.devices) {
+        json.beginObject();
+        json.key("address").value(device.entry.address.c_str(), device.entry.address.length());
+        json.member("result", device.result);
+        json.member("was_connected", device.wasConnected);
+        json.member("connect_ms", device.connectMs);
+        json.member("commands", device.completions.size());
+        json.member("done_ms", device.doneMs);
+        json.endObject();
+        body += json.data();
+        json.clear();
+    }
+    json.endArray().endObject();
+    body += json.data();
+    return body;
+}
@@ -0,0 +1,85 @@
+// SceneRunner.h
+#ifndef SCENE_RUNNER_H
+#define SCENE_RUNNER_H
+
+#include <Arduino.h>
+#include <mutex>
+#include <vector>
+#include "BluetoothManager.h"
+#include "StorageHandler.h"
+#include "ControlJobs.h"
+#include "DeferredResponses.h"
+
+// Most devices one scene may set
+const size_t SCENE_MAX_DEVICES = 32;
+// A device whose link does not open within this is reported as "connect_timeout"
+const uint32_t SCENE_CONNECT_TIMEOUT_MS = 10000;
+// A device whose commands are not all acknowledged within this is reported as "unacked"
+const uint32_t SCENE_ACK_TIMEOUT_MS = 5000;
+// The scene is answered after this at the latest, with whatever is still running marked as failed
+const uint32_t SCENE_TIMEOUT_MS = 30000;
+
+/**
+ * Sets many lights at once (POST /scene) and answers with a result per device.
+ * The Bluetooth work is planned so each device costs at most one link switch: devices whose link
+ * is open go first, then the others are connected as link slots free up, so the next link opens
+ * while the previous devices' packets are still going out. Only the fields that differ from a
+ * device's shadow state are sent, and the lights do not take over the active device.
+ * start() may be called from any task; process() does the work and answers, from loop().
+ */
+class SceneRunner {
+public:
+    // One device of a scene and the values it sets, applied to the stored config when they are sent
+    struct Entry {
+        String address;
+        bool found; // false: not a managed device, reported as "not_found"
+        ControlUpdate update;
+    };
+
+    SceneRunner(BluetoothManager* bt, StorageHandler* sh, DeferredResponses* deferred);
+
+    // Runs the scene and completes the deferred response with its results
+    void start(const std::vector<Entry>& entries, uint32_t deferredId);
+    void process();
+
+private:
+    enum class Step { WAITING, CONNECTING, SENDING, DONE };
+
+    struct Device {
+        Entry entry;
+        BTAddress address;
+        Step step;
+        const char* result;
+        bool wasConnected; // the link was open already when the device's turn came
+        uint32_t connectStartedMs;
+        uint32_t connectMs;   // how long the link took to open, 0 if it was open
+        uint32_t sentMs;
+        uint32_t doneMs;      // since the scene started
+        std::vector<BtCompletion> completions;
+    };
+
+    struct Scene {
+        uint32_t deferredId;
+        uint32_t startedMs;
+        bool planned;
+        uint32_t linksOpened;
+        std::vector<Device> devices;
+    };
+
+    BluetoothManager* btManager;
+    StorageHandler* storageHandler;
+    DeferredResponses* deferred;
+
+    // Guards newScenes (start() runs on the async TCP task); scenes is only touched by process()
+    std::mutex mutex;
+    std::vector<Scene> newScenes;
+    std::vector<Scene> scenes;
+
+    void advance(Scene& scene, uint32_t now);
+    // Sends the device's update over its open link; false if it did not go out
+    bool send(Device& device, uint32_t now, const Scene& scene);
+    void finish(Device& device, const char* result, uint32_t now, const Scene& scene);
+    String renderResult(const Scene& scene, uint32_t now);
+};
+
+#endif
@@ -0,0 +1,265 @@
+#include "SppTransport.h"
+#include <Arduino.h>
+#include <string.h>
+
+// Initialize static instance pointer
+SppTransport *SppTransport::instance = nullptr;
+
+const esp_spp_sec_t SPP_SECURITY = ESP_SPP_SEC_ENCRYPT | ESP_SPP_SEC_AUTHENTICATE;
+
+SppTransport::SppTransport()
+{
+    instance = this; // Set the static instance pointer
+}
+
+bool SppTransport::begin(ITransportListener *listener)
+{
+    this->listener = listener;
+    return esp_spp_register_callback(sppCallback) == ESP_OK;
+}
+
+bool SppTransport::open(const uint8_t address[6], uint8_t channel)
+{
+    // A caller that timed out on an open starts the next one; late events of the old open are
+    // then reported as an unexpected link
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    memcpy(pendingAddress, address, sizeof(pendingAddress));
+    pendingScn = channel;
+    pendingHandle = 0;
+    esp_err_t err;
+    if (channel != 0)
+    {
+        err = esp_spp_connect(SPP_SECURITY, ESP_SPP_ROLE_MASTER, channel, pendingAddress);
+    }
+    else
+    {
+        // Look the channel up first; connecting continues on ESP_SPP_DISCOVERY_COMP_EVT
+        err = esp_spp_start_discovery(pendingAddress);
+    }
+    if (err != ESP_OK)
+    {
+        log_w("Could not start SPP open (%d)", err);
+        return false;
+    }
+    openPending = true;
+    return true;
+}
+
+bool SppTransport::write(uint32_t handle, const uint8_t *data, size_t len)
+{
+    // The stack copies the data into its own queue
+    return esp_spp_write(handle, len, const_cast<uint8_t *>(data)) == ESP_OK;
+}
+
+bool SppTransport::close(uint32_t handle)
+{
+    return esp_spp_disconnect(handle) == ESP_OK;
+}
+
+// Reports the open in progress as failed
+void SppTransport::failPendingOpen()
+{
+    uint8_t address[6];
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        if (!openPending)
+        {
+            return;
+        }
+        memcpy(address, pendingAddress, sizeof(address));
+        openPending = false;
+    }
+    if (listener)
+    {
+        listener->onTransportOpen(address, 0, 0, false);
+    }
+}
+
+void printStatus(esp_spp_status_t status)
+{
+    switch (status)
+    {
+    case ESP_SPP_SUCCESS:
+        log_i("ESP_SPP_SUCCESS");
+        break;
+    case ESP_SPP_FAILURE:
+        log_i("ESP_SPP_FAILURE");
+        break;
+    case ESP_SPP_BUSY:
+        log_i("ESP_SPP_BUSY");
+        break;
+    case ESP_SPP_NO_DATA:
+        log_i("ESP_SPP_NO_DATA");
+        break;
+    case ESP_SPP_NO_RESOURCE:
+        log_i("ESP_SPP_NO_RESOURCE");
+        break;
+    case ESP_SPP_NEED_INIT:
+        log_i("ESP_SPP_NEED_INIT");
+        break;
+    case ESP_SPP_NEED_DEINIT:
+        log_i("ESP_SPP_NEED_DEINIT");
+        break;
+    case ESP_SPP_NO_CONNECTION:
+        log_i("ESP_SPP_NO_CONNECTION");
+        break;
+    case ESP_SPP_NO_SERVER:
+        log_i("ESP_SPP_NO_SERVER");
+        break;
+    default:
+        log_i("Unknown status");
+        break;
+    }
+}
+
+// Member method to handle SPP events
+void SppTransport::handleSppEvent(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
+{
+    log_d("%d", event);
+    switch (event)
+    {
+
+    case ESP_SPP_INIT_EVT:
+        log_i("ESP_SPP_INIT_EVT");
+        printStatus(param->init.status);
+        break;
+    case ESP_SPP_UNINIT_EVT:
+        log_i("ESP_SPP_UNINIT_EVT");
+        printStatus(param->uninit.status);
+        break;
+    case ESP_SPP_DISCOVERY_COMP_EVT:
+        log_i("ESP_SPP_DISCOVERY_COMP_EVT");
+        printStatus(param->disc_comp.status);
+        {
+            // The event carries no address; it belongs to the open in progress
+            std::unique_lock<std::mutex> lock(pendingMutex);
+            if (!openPending || pendingScn != 0)
+            {
+                break;
+            }
+            if (param->disc_comp.status == ESP_SPP_SUCCESS && param->disc_comp.scn_num > 0)
+            {
+                pendingScn = param->disc_comp.scn[0];
+                if (esp_spp_connect(SPP_SECURITY, ESP_SPP_ROLE_MASTER, pendingScn, pendingAddress) == ESP_OK)
+                {
+                    break;
+                }
+            }
+            log_w("No SPP channel found");
+        }
+        failPendingOpen();
+        break;
+    case ESP_SPP_CL_INIT_EVT:
+        log_i("ESP_SPP_CL_INIT_EVT");
+        printStatus(param->cl_init.status);
+        if (param->cl_init.status != ESP_SPP_SUCCESS)
+        {
+            failPendingOpen();
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            pendingHandle = param->cl_init.handle;
+        }
+        break;
+    case ESP_SPP_OPEN_EVT:
+        log_i("ESP_SPP_OPEN_EVT");
+        printStatus(param->open.status);
+        if (param->open.status != ESP_SPP_SUCCESS)
+        {
+            failPendingOpen();
+            break;
+        }
+        {
+            uint8_t scn = 0;
+            {
+                std::lock_guard<std::mutex> lock(pendingMutex);
+                if (openPending && memcmp(pendingAddress, param->open.rem_bda, sizeof(pendingAddress)) == 0)
+                {
+                    scn = pendingScn;
+                    openPending = false;
+                }
+            }
+            if (listener)
+            {
+                listener->onTransportOpen(param->open.rem_bda, param->open.handle, scn, true);
+            }
+        }
+        break;
+    case ESP_SPP_CLOSE_EVT:
+        log_i("ESP_SPP_CLOSE_EVT");
+        printStatus(param->close.status);
+        {
+            bool openFailed;
+            {
+                std::lock_guard<std::mutex> lock(pendingMutex);
+                // A link closed before it opened is how a refused connect shows up
+                openFailed = openPending && pendingHandle == param->close.handle;
+            }
+            if (openFailed)
+            {
+                failPendingOpen();
+            }
+            else if (listener)
+            {
+                listener->onTransportClose(param->close.handle);
+            }
+        }
+        break;
+
+    case ESP_SPP_START_EVT:
+        log_i("ESP_SPP_START_EVT");
+        printStatus(param->start.status);
+        break;
+    case ESP_SPP_DATA_IND_EVT:
+        log_d("ESP_SPP_DATA_IND_EVT (%d bytes)", param->data_ind.len);
+        if (listener)
+        {
+            listener->onTransportData(param->data_ind.handle, param->data_ind.data, param->data_ind.len);
+        }
+        break;
+    case ESP_SPP_CONG_EVT:
+        log_i("ESP_SPP_CONG_EVT (%s)", param->cong.cong ? "congested" : "clear");
+        printStatus(param->cong.status);
+        if (listener)
+        {
+            listener->onTransportCongestion(param->cong.handle, param->cong.cong);
+        }
+        break;
+    case ESP_SPP_WRITE_EVT:
+        log_d("ESP_SPP_WRITE_EVT");
+        printStatus(param->write.status);
+        if (listener)
+        {
+            listener->onTransportWriteComplete(param->write.handle, param->write.status == ESP_SPP_SUCCESS, param->write.cong);
+        }
+        break;
+    case ESP_SPP_SRV_OPEN_EVT:
+        log_i("ESP_SPP_SRV_OPEN_EVT");
+        printStatus(param->srv_open.status);
+        break;
+    case ESP_SPP_SRV_STOP_EVT:
+        log_i("ESP_SPP_SRV_STOP_EVT");
+        printStatus(param->srv_stop.status);
+        break;
+    case ESP_SPP_VFS_REGISTER_EVT:
+        log_i("ESP_SPP_VFS_REGISTER_EVT");
+        printStatus(param->vfs_register.status);
+        break;
+    case ESP_SPP_VFS_UNREGISTER_EVT:
+        log_i("ESP_SPP_VFS_UNREGISTER_EVT");
+        printStatus(param->vfs_unregister.status);
+        break;
+    default:
+        log_i("Unknown SPP event: %d", event);
+        break;
+    }
+}
+
+void SppTransport::sppCallback(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
+{
+    if (instance)
+    {
+        instance->handleSppEvent(event, param); // Forward to member method
+    }
+}
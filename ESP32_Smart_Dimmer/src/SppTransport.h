@@ -0,0 +1,42 @@
+#ifndef SPP_TRANSPORT_H
+#define SPP_TRANSPORT_H
+
+#include <mutex>
+#include <esp_spp_api.h>
+#include "ITransport.h"
+
+/**
+ * ITransport over the ESP-IDF SPP client API. BluetoothSerial handles a single client link, so
+ * the SPP events are taken over here and every link is driven directly. The stack has to be up
+ * (SerialBT.begin) before begin() is called.
+ */
+class SppTransport : public ITransport
+{
+public:
+    SppTransport();
+
+    bool begin(ITransportListener *listener) override;
+    // One open at a time: the stack's SDP / connect events carry no address. A new open replaces the pending one.
+    bool open(const uint8_t address[6], uint8_t channel) override;
+    bool write(uint32_t handle, const uint8_t *data, size_t len) override;
+    bool close(uint32_t handle) override;
+
+private:
+    ITransportListener *listener = nullptr;
+
+    // The open in progress
+    std::mutex pendingMutex;
+    bool openPending = false;
+    uint8_t pendingAddress[6];
+    uint8_t pendingScn = 0;
+    uint32_t pendingHandle = 0; // from ESP_SPP_CL_INIT_EVT, until the link opens
+
+    void handleSppEvent(esp_spp_cb_event_t event, esp_spp_cb_param_t *param);
+    void failPendingOpen();
+
+    static void sppCallback(esp_spp_cb_event_t event, esp_spp_cb_param_t *param);
+    // Static pointer to the instance to be used in the static callback
+    static SppTransport *instance;
+};
+
+#endif // SPP_TRANSPORT_H
@@ -7,10 +7,11 @@
 // Use unsigned long for timestamps to avoid rollover issues after ~50 days
 const unsigned long DEBOUNCE_DELAY_MS = 2000;    // Wait 2 seconds of inactivity before saving a connected device
 const unsigned long MIN_SAVE_INTERVAL_MS = 1000; // Minimum 1 second between actual writes (if tryStore triggers)
+const unsigned long RECONCILE_INTERVAL_MS = 5000; // How often reported device states are folded into the configs
 
 // --- StorageHandler Constructor ---
 StorageHandler::StorageHandler(BluetoothManager *bt, LightController *lc, FanController *fc)
-    : btManager(bt), lightCtrl(lc), fanCtrl(fc), lastSaveTime(0), lastChangeDetectedTime(0)
+    : btManager(bt), lightCtrl(lc), fanCtrl(fc), lastSaveTime(0), lastChangeDetectedTime(0), lastReconcileTime(0)
 {
     // Global preferences.begin() is typically done in main setup()
     bt->registerDeviceConnectedListener(this);
@@ -21,6 +22,7 @@ StorageHandler::StorageHandler(BluetoothManager *bt, LightController *lc, FanCon
 // --- Public Method: Load all device configurations from Preferences ---
 void StorageHandler::loadAllDeviceConfigs()
 {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
     log_i("Loading all device configurations from Preferences...");
     allManagedDevices.clear(); // Clear any existing in-memory data
 
@@ -44,11 +46,37 @@ void StorageHandler::loadAllDeviceConfigs()
         }
     }
     log_i("Finished loading %d devices into memory.", allManagedDevices.size());
+    stateVersion++;
+}
+
+void StorageHandler::registerDeviceConfigListener(IDeviceConfigListener *listener)
+{
+    deviceConfigListener = listener;
+}
+
+void StorageHandler::_notifyConfigChanged(const String &mac_address)
+{
+    uint32_t version = ++stateVersion;
+    auto it = allManagedDevices.find(mac_address);
+    if (deviceConfigListener && it != allManagedDevices.end())
+    {
+        deviceConfigListener->onDeviceConfigChanged(it->second, version);
+    }
+}
+
+void StorageHandler::_notifyListChanged()
+{
+    uint32_t version = ++stateVersion;
+    if (deviceConfigListener)
+    {
+        deviceConfigListener->onDeviceListChanged(version);
+    }
 }
 
 // --- Public Method: Get a specific device's configuration ---
 DeviceConfig StorageHandler::getDeviceConfig(String mac_address)
 {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
     if (allManagedDevices.count(mac_address))
     {
         return allManagedDevices[mac_address];
@@ -62,6 +90,7 @@ DeviceConfig StorageHandler::getDeviceConfig(String mac_address)
 // --- Public Method: Get all managed device configurations ---
 std::map<String, DeviceConfig> StorageHandler::getAllManagedDevices()
 {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
     return allManagedDevices;
 }
 
@@ -200,6 +229,7 @@ DeviceConfig StorageHandler::_restoreSingleDevice(String mac_address)
 // --- Public Method: Save a specific device's configuration to Preferences ---
 void StorageHandler::saveSpecificDeviceConfig(const DeviceConfig &config)
 {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
     DeviceConfig conf = config; // Use local variable to avoid memory issues
     String prefNS = getDeviceNamespace(conf.mac_address);
     log_i("StorageHandler: Saving config for %s to Preferences (namespace: %s)...\n", conf.mac_address.c_str(), prefNS);
@@ -227,28 +257,89 @@ void StorageHandler::saveSpecificDeviceConfig(const DeviceConfig &config)
         lastSaveTime = millis();        // Record save time
     }
 
+    unsavedSince.erase(conf.mac_address);
+    auto existing = allManagedDevices.find(conf.mac_address);
+    bool added = existing == allManagedDevices.end();
+    bool changed = added || existing->second != conf;
     allManagedDevices[conf.mac_address] = conf;
+    configChangedAt[conf.mac_address] = millis();
+    if (added)
+    {
+        _notifyListChanged();
+    }
+    else if (changed)
+    {
+        _notifyConfigChanged(conf.mac_address);
+    }
 
     Serial.printf("StorageHandler: Saved %s config: Mode=%s, Brightness=%d, Fan=%d, IsOn=%d\n",
                   conf.mac_address.c_str(), lightModeToString(conf.light_mode).c_str(),
                   conf.main_brightness, conf.fan_speed, conf.is_on);
 }
 
+/**
+ * Takes over a config that was just sent to its device, e.g. for each frame of a slider drag, where a
+ * flash write per frame would be far too slow. The NVS write is left to tryStore().
+ */
+bool StorageHandler::updateDeviceConfig(const DeviceConfig &config)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    auto existing = allManagedDevices.find(config.mac_address);
+    if (existing == allManagedDevices.end())
+    {
+        return false;
+    }
+    unsigned long now = millis();
+    configChangedAt[config.mac_address] = now;
+    if (existing->second != config)
+    {
+        existing->second = config;
+        unsavedSince[config.mac_address] = now;
+        _notifyConfigChanged(config.mac_address);
+    }
+    return true;
+}
+
 /**
  * @brief Loads a specific device's configuration into the provided struct.
  */
 bool StorageHandler::loadSpecificDeviceConfig(const String& mac_address, DeviceConfig& config) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
     if (allManagedDevices.count(mac_address) > 0) {
         config = allManagedDevices.at(mac_address);
         return true;
     }
     return false;
 }
+
+bool StorageHandler::getDeviceMacAt(size_t index, String &mac_address)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    if (index >= allManagedDevices.size())
+    {
+        return false;
+    }
+    mac_address = std::next(allManagedDevices.begin(), index)->first;
+    return true;
+}
+
+uint32_t StorageHandler::forEachDevice(const std::function<void(const DeviceConfig &)> &visit)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    for (const auto &pair : allManagedDevices)
+    {
+        visit(pair.second);
+    }
+    // Every change bumps the version with the lock held, so this is the version of what was visited
+    return stateVersion;
+}
+
 /**
  * Checks if a device is configured.
  */
 bool StorageHandler::isDeviceConfigured(const String &mac_address)
 {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
     return allManagedDevices.count(mac_address) > 0;
 }
 
@@ -257,9 +348,11 @@ bool StorageHandler::isDeviceConfigured(const String &mac_address)
  */
 bool StorageHandler::deleteDeviceConfig(const String &mac_address)
 {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
     if (isDeviceConfigured(mac_address))
     {
         allManagedDevices.erase(mac_address);  // Erase from RAM
+        unsavedSince.erase(mac_address);
         _removeMacFromMasterList(mac_address); // Remove from master list in NVS
 
         // Erase the device's config from NVS
@@ -267,6 +360,7 @@ bool StorageHandler::deleteDeviceConfig(const String &mac_address)
         preferences.clear();
         preferences.end();
         log_i("Removed device %s from NVS.", mac_address.c_str());
+        _notifyListChanged();
         return true;
     }
     return false;
@@ -275,27 +369,40 @@ bool StorageHandler::deleteDeviceConfig(const String &mac_address)
 // --- Listener: On Bluetooth Connected ---
 void StorageHandler::onDeviceConnected(String mac_address)
 {
-    currentConnectedMac = mac_address; // Store the currently connected MAC
-    log_i("Bluetooth connected to MAC: %s.", currentConnectedMac.c_str());
-    std::vector<String>* macAddresses = _loadMacsFromMasterList();
-    if (std::find(macAddresses->begin(), macAddresses->end(), currentConnectedMac) == macAddresses->end()){
-        log_w("mac address not in valid addresses list:");
-        for (size_t i = 0; i < macAddresses->size(); ++i) {
-            log_i("  %s", (*macAddresses)[i].c_str());
+    DeviceConfig configForConnectedDevice;
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        currentConnectedMac = mac_address; // Store the currently connected MAC
+        log_i("Bluetooth connected to MAC: %s.", currentConnectedMac.c_str());
+        std::vector<String>* macAddresses = _loadMacsFromMasterList();
+        if (std::find(macAddresses->begin(), macAddresses->end(), currentConnectedMac) == macAddresses->end()){
+            log_w("mac address not in valid addresses list:");
+            for (size_t i = 0; i < macAddresses->size(); ++i) {
+                log_i("  %s", (*macAddresses)[i].c_str());
+            }
+            return;
+        }
+        log_i("mac address found in valid addresses list");
+        // Get (or create default) the DeviceConfig for this MAC address
+        configForConnectedDevice = _restoreSingleDevice(currentConnectedMac);
+
+        // Update the in-memory map
+        bool added = !isDeviceConfigured(currentConnectedMac);
+        allManagedDevices[currentConnectedMac] = configForConnectedDevice;
+        if (added)
+        {
+            _notifyListChanged();
+        }
+        else
+        {
+            _notifyConfigChanged(currentConnectedMac);
         }
-        return;
-    }
-    log_i("mac address found in valid addresses list");
-    // Get (or create default) the DeviceConfig for this MAC address
-    DeviceConfig configForConnectedDevice = _restoreSingleDevice(currentConnectedMac);
-
-    // Update the in-memory map
-    allManagedDevices[currentConnectedMac] = configForConnectedDevice;
 
-    // Set the lastSavedDeviceConfig for the currently connected device for debounce logic
-    lastSavedDeviceConfig = configForConnectedDevice;
+        // Set the lastSavedDeviceConfig for the currently connected device for debounce logic
+        lastSavedDeviceConfig = configForConnectedDevice;
+    }
 
-    // Apply the restored/default config to controllers
+    // Apply the restored/default config to controllers, without the lock; the TX queue keeps the commands in order
     lightCtrl->setAll(configForConnectedDevice.light_mode,
                       configForConnectedDevice.main_brightness,
                       configForConnectedDevice.main_warmness,
@@ -303,18 +410,20 @@ void StorageHandler::onDeviceConnected(String mac_address)
                       configForConnectedDevice.ring_hue);
     log_d("Light command sent to connected device.");
 
-    delay(500); // Small delay before fan command
     fanCtrl->setSpeed(configForConnectedDevice.fan_speed);
     log_d("Fan command sent to connected device.");
 
     // Reset change detection for the connected device as we just applied its config
+    std::lock_guard<std::recursive_mutex> lock(mutex);
     lastChangeDetectedTime = millis();
+    configChangedAt[currentConnectedMac] = millis();
     lastSaveTime = millis(); // Mark as just saved/applied
 }
 
 // --- Listener: On Light Controller Change ---
 void StorageHandler::onLightControllerChange(LightMode light_mode, int main_brightness, int main_warmness, int ring_brightness, int ring_hue)
 {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
     if (currentConnectedMac.isEmpty() || !allManagedDevices.count(currentConnectedMac))
     {
         log_w("Light change detected, but no device connected or managed for updates.");
@@ -330,6 +439,8 @@ void StorageHandler::onLightControllerChange(LightMode light_mode, int main_brig
     currentConfig.main_warmness = main_warmness;
     currentConfig.ring_hue = ring_hue;
     currentConfig.ring_brightness = ring_brightness;
+    configChangedAt[currentConnectedMac] = millis();
+    _notifyConfigChanged(currentConnectedMac);
     // Note: isOn state - if your LightController knows if it's truly off (e.g., brightness=0 from web)
     // you might update currentConfig.isOn here or in a separate listener for power state.
     // For now, it remains as set by _restoreSingleDevice or saveSpecificDeviceConfig.
@@ -340,6 +451,7 @@ void StorageHandler::onLightControllerChange(LightMode light_mode, int main_brig
 // --- Listener: On Fan Controller Change ---
 void StorageHandler::onFanControllerChange(int fan_speed)
 {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
     if (currentConnectedMac.isEmpty() || !allManagedDevices.count(currentConnectedMac))
     {
         log_w("StorageHandler: Fan change detected, but no device connected or managed for updates.");
@@ -349,13 +461,83 @@ void StorageHandler::onFanControllerChange(int fan_speed)
 
     DeviceConfig &currentConfig = allManagedDevices[currentConnectedMac]; // Get reference to modify
     currentConfig.fan_speed = fan_speed;
+    configChangedAt[currentConnectedMac] = millis();
+    _notifyConfigChanged(currentConnectedMac);
 
     lastChangeDetectedTime = millis(); // Mark that a change occurred for debounce
 }
 
+// --- Public Method: reconcile (Reported device state -> in-RAM config) ---
+void StorageHandler::reconcile()
+{
+    if (millis() - lastReconcileTime < RECONCILE_INTERVAL_MS)
+    {
+        return;
+    }
+    lastReconcileTime = millis();
+
+    std::vector<BtDeviceState> states = btManager->getDeviceStates();
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    for (const BtDeviceState &state : states)
+    {
+        String mac = BTAddress((uint8_t *)state.address).toString(true);
+        auto it = allManagedDevices.find(mac);
+        if (it == allManagedDevices.end())
+        {
+            continue;
+        }
+        DeviceConfig &config = it->second;
+        bool changed = false;
+        // A report older than our last change may predate the commands that applied it
+        unsigned long changedAt = configChangedAt.count(mac) ? configChangedAt[mac] : 0;
+        bool isConnected = mac.equalsIgnoreCase(currentConnectedMac);
+
+        if (state.hasFanSpeed && (long)(state.fanUpdatedMs - changedAt) > 0 && config.fan_speed != state.fanSpeed)
+        {
+            log_i("%s reports fan speed %d, config had %d.", mac.c_str(), state.fanSpeed, config.fan_speed);
+            config.fan_speed = state.fanSpeed;
+            changed = true;
+            if (isConnected)
+            {
+                fanCtrl->syncSpeed(state.fanSpeed);
+            }
+        }
+        if (state.hasPower && (long)(state.lightUpdatedMs - changedAt) > 0 && config.is_on != state.isOn)
+        {
+            log_i("%s reports the light %s, config had it %s.", mac.c_str(), state.isOn ? "on" : "off", config.is_on ? "on" : "off");
+            config.is_on = state.isOn;
+            changed = true;
+            if (isConnected)
+            {
+                lightCtrl->syncPower(state.isOn);
+            }
+        }
+        if (changed)
+        {
+            _notifyConfigChanged(mac);
+        }
+    }
+}
+
 // --- Public Method: tryStore (Debounced save for connected device) ---
 void StorageHandler::tryStore()
 {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    // Configs updateDeviceConfig() changed, once they have been left alone for the debounce delay
+    std::vector<String> settled;
+    for (const auto &unsaved : unsavedSince)
+    {
+        if (millis() - unsaved.second > DEBOUNCE_DELAY_MS)
+        {
+            settled.push_back(unsaved.first);
+        }
+    }
+    for (const String &mac : settled)
+    {
+        saveSpecificDeviceConfig(allManagedDevices[mac]); // Also drops it from unsavedSince
+    }
+
     // Only attempt to store if there's a connected device whose state we manage
     if (currentConnectedMac.isEmpty() || !allManagedDevices.count(currentConnectedMac))
     {
@@ -3,6 +3,9 @@
 #include <Preferences.h>
 #include <Arduino.h>
 #include <map>    // Required for std::map
+#include <atomic>
+#include <functional>
+#include <mutex>
 #include <vector> // Required for std::vector (used in MAC list parsing)
 
 #include "BluetoothManager.h"
@@ -16,6 +19,18 @@ String lightModeToString(LightMode mode);
 // Helper to convert String to LightMode enum (for web UI input/Preferences)
 LightMode stringToLightMode(const String &modeStr);
 
+// Called from whichever task made the change, with the state version it produced and the storage lock held
+class IDeviceConfigListener
+{
+public:
+    virtual void onDeviceConfigChanged(const DeviceConfig &config, uint32_t version) = 0;
+    // A device was added or removed, so the device indexes may have moved
+    virtual void onDeviceListChanged(uint32_t version) = 0;
+    virtual ~IDeviceConfigListener() = default;
+};
+
+// Used from the async TCP task (web handlers), the Bluetooth writer task (connects) and loop(); every public
+// method takes the same lock, so they can be called from any of them.
 class StorageHandler : public IBtDeviceConnectedListener, public IFanControllerListener, public ILightControllerListener
 {
 public:
@@ -25,18 +40,34 @@ public:
     void loadAllDeviceConfigs();
     // Public function to get a specific device's config
     DeviceConfig getDeviceConfig(String mac_address);
-    // Public function to get all managed device configs
+    // Public function to get all managed device configs (a copy)
     std::map<String, DeviceConfig> getAllManagedDevices();
 
     // Public function to save a specific device's config
     void saveSpecificDeviceConfig(const DeviceConfig &config);
+    // Updates a managed device's in-RAM config and tells the listener, without touching NVS; tryStore()
+    // saves it once it has not changed for a while. False if the device is not managed.
+    bool updateDeviceConfig(const DeviceConfig &config);
     bool loadSpecificDeviceConfig(const String &mac_address, DeviceConfig &config);
-    // Public method for debounced saving of the connected device's config
+    // MAC of the device at this position of getAllManagedDevices() (sorted by MAC), without copying the map
+    bool getDeviceMacAt(size_t index, String &mac_address);
+    // Calls visit with every device in MAC order, all under the lock, without copying the map.
+    // Returns the state version the devices are at; visit must not call back into storage from another task.
+    uint32_t forEachDevice(const std::function<void(const DeviceConfig &)> &visit);
+    // Public method for debounced saving of the connected device's config, and of the ones updateDeviceConfig() changed
     void tryStore();
+    // Folds the fan speed / power state the lights reported (e.g. changed with their remote) into the
+    // in-RAM configs, without sending anything. Call from the loop; runs every few seconds.
+    void reconcile();
     
     bool deleteDeviceConfig(const String &mac_address);
     bool isDeviceConfigured(const String &mac_address);
 
+    // Goes up by one with every change of an in-memory config (or of the set of devices)
+    // Atomic, so it can be read without the lock
+    uint32_t getStateVersion() { return stateVersion.load(); }
+    void registerDeviceConfigListener(IDeviceConfigListener *listener);
+
     // Listener callbacks
     void onDeviceConnected(String mac_address);
     void onLightControllerChange(LightMode light_mode, int main_brightness, int main_warmness, int ring_brightness, int ring_hue);
@@ -48,10 +79,16 @@ private:
     LightController *lightCtrl;
     FanController *fanCtrl;
 
+    // Guards everything below, and preferences. Recursive: public methods call each other, and the
+    // listeners are called with it held (they must not wait on another task that uses storage).
+    std::recursive_mutex mutex;
+
     Preferences preferences; // Preferences object
 
     // This map will hold the configurations of ALL managed devices in RAM
     std::map<String, DeviceConfig> allManagedDevices;
+    std::atomic<uint32_t> stateVersion{0};
+    IDeviceConfigListener *deviceConfigListener = nullptr;
 
     // Track the MAC address of the currently connected device, if any
     String currentConnectedMac;
@@ -61,6 +98,15 @@ private:
 
     long lastSaveTime;           // Time when `lastSavedDeviceConfig` was last saved (or applied on connect)
     long lastChangeDetectedTime; // Time when a change was last detected for `currentConnectedMac`'s config
+    unsigned long lastReconcileTime;
+    // When we last changed each device's config; only states reported after that are taken over
+    std::map<String, unsigned long> configChangedAt;
+    // Devices updateDeviceConfig() changed since they were last saved, and when it last did
+    std::map<String, unsigned long> unsavedSince;
+
+    // Bump the state version and tell the listener what changed
+    void _notifyConfigChanged(const String &mac_address);
+    void _notifyListChanged();
 
     // Private helper to restore a single device's config from NVS
     DeviceConfig _restoreSingleDevice(String mac_address);
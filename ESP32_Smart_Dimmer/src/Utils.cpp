@@ -1,39 +1,5 @@
 #include "Utils.h"
 
-// --- HELPER FUNCTION: Escapes a string for JSON output ---
-// This is crucial to ensure valid JSON if your strings contain quotes or backslashes.
-// For full JSON compatibility, you might need to escape more characters (e.g., newlines, tabs)
-// but for typical names/IDs, this should suffice.
-String escapeJsonString(const String &input)
-{
-    String escapedString = "";
-    escapedString.reserve(input.length() * 2); // Pre-allocate memory to reduce reallocations
-    for (char c : input)
-    {
-        if (c == '"')
-        {
-            escapedString += "\\\"";
-        }
-        else if (c == '\\')
-        {
-            escapedString += "\\\\";
-        }
-        // You might need to add more escapes for control characters like:
-        // else if (c == '\b') escapedString += "\\b"; // Backspace
-        // else if (c == '\f') escapedString += "\\f"; // Form feed
-        // else if (c == '\n') escapedString += "\\n"; // Newline
-        // else if (c == '\r') escapedString += "\\r"; // Carriage return
-        // else if (c == '\t') escapedString += "\\t"; // Tab
-        // For basic names, " and \ are the most common problematic characters.
-        else
-        {
-            escapedString += c;
-        }
-    }
-    return escapedString;
-}
-
-
 // --- LightMode Conversion Helpers ---
 // Assuming LightMode is an enum, or enum class, defined where accessible
 String lightModeToString(LightMode mode)
@@ -56,15 +22,7 @@ LightMode stringToLightMode(const String &modeStr)
 
 String commandTypeToString(CommandType cmdType)
 {
-    switch (cmdType) {
-        CMD_NONE: return "CMD_NONE";
-        CMD_LIGHT_ON_OFF: return "CMD_LIGHT_ON_OFF";
-        CMD_LIGHT_INTENSITY: return "CMD_LIGHT_INTENSITY";
-        CMD_LIGHT_WARMNESS: return "CMD_LIGHT_WARMNESS";
-        CMD_RGB: return "CMD_RGB";
-        CMD_FAN_SPEED: return "CMD_FAN_SPEED";
-        default: return "Unsupported command: " + cmdType;
-    }
+    return commandTypeName(cmdType);
 }
 
 const String getDeviceNamespace(String mac_address)
@@ -88,4 +46,25 @@ String sanitizeString(const String& input) {
         }
     }
     return output;
+}
+
+void hslToRgb(float h, float s, float l, int* r, int* g, int* b) {
+    if (s == 0.0) {
+        *r = *g = *b = (int)(l * 255.0);
+    } else {
+        float q = l < 0.5 ? l * (1.0 + s) : l + s - l * s;
+        float p = 2.0 * l - q;
+        *r = (int)(255 * hueToRgb(p, q, h + 1.0 / 3.0));
+        *g = (int)(255 * hueToRgb(p, q, h));
+        *b = (int)(255 * hueToRgb(p, q, h - 1.0 / 3.0));
+    }
+}
+
+float hueToRgb(float p, float q, float t) {
+    if (t < 0.0) t += 1;
+    if (t > 1.0) t -= 1;
+    if (t < 1.0 / 6.0) return p + (q - p) * 6.0 * t;
+    if (t < 1.0 / 2.0) return q;
+    if (t < 2.0 / 3.0) return p + (q - p) * (2.0 / 3.0 - t) * 6.0;
+    return p;
 }
\ No newline at end of file
@@ -5,12 +5,6 @@
 #include "LightMode.h"
 #include "CommandType.h"
 
-// --- HELPER FUNCTION: Escapes a string for JSON output ---
-// This is crucial to ensure valid JSON if your strings contain quotes or backslashes.
-// For full JSON compatibility, you might need to escape more characters (e.g., newlines, tabs)
-// but for typical names/IDs, this should suffice.
-String escapeJsonString(const String &input);
-
 // --- LightMode Conversion Helpers ---
 // Assuming LightMode is an enum, or enum class, defined where accessible
 String lightModeToString(LightMode mode);
@@ -22,4 +16,8 @@ const String getDeviceNamespace(String mac_address);
 
 String sanitizeString(const String& input);
 
+// HSL (all 0-1) to RGB (0-255), as used for the ring light payload
+void hslToRgb(float h, float s, float l, int* r, int* g, int* b);
+float hueToRgb(float p, float q, float t);
+
 #endif
\ No newline at end of file
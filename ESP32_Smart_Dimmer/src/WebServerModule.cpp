@@ -1,14 +1,112 @@
 #include "WebServerModule.h"
 #include "Utils.h"
+#include "JsonResponse.h"
+#include <AsyncJson.h>
 #include <SPIFFS.h>
+#include <algorithm>
 #include <functional>
+#include <memory>
+
+// Cached discovery results older than this trigger a background refresh
+const uint32_t DISCOVERY_REFRESH_MS = 60 * 1000;
+// Written by tools/build_assets.py next to the web UI
+const char* ASSET_MANIFEST_PATH = "/assets.txt";
+// Hashed names change with their content; everything else is checked with its ETag on every load
+const char* CACHE_IMMUTABLE = "public, max-age=31536000, immutable";
+const char* CACHE_REVALIDATE = "no-cache";
+
+// MIME type of each file extension served
+static const struct {
+    const char* extension;
+    const char* type;
+} CONTENT_TYPES[] = {
+    {".html", "text/html"},
+    {".htm", "text/html"},
+    {".css", "text/css"},
+    {".js", "application/javascript"},
+    {".json", "application/json"},
+    {".svg", "image/svg+xml"},
+    {".png", "image/png"},
+    {".gif", "image/gif"},
+    {".jpg", "image/jpeg"},
+    {".ico", "image/x-icon"},
+    {".xml", "text/xml"},
+};
+
+static const char* contentTypeFor(const String& path) {
+    int dot = path.lastIndexOf('.');
+    if (dot >= 0) {
+        const char* extension = path.c_str() + dot;
+        for (const auto& entry : CONTENT_TYPES) {
+            if (strcmp(extension, entry.extension) == 0) {
+                return entry.type;
+            }
+        }
+    }
+    return "text/plain";
+}
+
+// ETag of a file that did not come through build_assets.py: FNV-1a of its content
+static String hashFile(const String& path) {
+    File file = SPIFFS.open(path, "r");
+    uint32_t hash = 2166136261u;
+    uint8_t buffer[256];
+    size_t count;
+    while (file && (count = file.read(buffer, sizeof(buffer))) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            hash = (hash ^ buffer[i]) * 16777619u;
+        }
+    }
+    file.close();
+    char etag[11];
+    snprintf(etag, sizeof(etag), "\"%08x\"", (unsigned)hash);
+    return String(etag);
+}
+
+// Largest /scene request body
+const size_t SCENE_MAX_BODY = 4096;
+// Longest device name /add_device keeps, so a device always fits one JSON_RESPONSE_BUFFER_SIZE part
+const size_t DEVICE_NAME_MAX_LENGTH = 64;
+
+// Numeric fields of /control and /scene, by parameter name
+static const struct {
+    const char* name;
+    ControlField field;
+} CONTROL_PARAMS[] = {
+    {"fan", CONTROL_FAN},
+    {"bright", CONTROL_BRIGHT},
+    {"warm", CONTROL_WARM},
+    {"hue", CONTROL_HUE},
+    {"rgbValue", CONTROL_RGB_VALUE},
+};
+
+// "off", "main" or "rgb" into the update's mode
+static void setControlMode(ControlUpdate& update, const String& mode) {
+    if (mode == "off") {
+        update.set(CONTROL_MODE, CONTROL_MODE_OFF);
+    } else if (mode == "main") {
+        update.set(CONTROL_MODE, CONTROL_MODE_MAIN);
+    } else if (mode == "rgb") {
+        update.set(CONTROL_MODE, CONTROL_MODE_RGB);
+    } else {
+        log_w("light mode not supported: %s", mode.c_str());
+    }
+}
+
+// Value of a query parameter, empty if missing (like WebServer::arg)
+static String arg(AsyncWebServerRequest* request, const char* name) {
+    const AsyncWebParameter* param = request->getParam(name);
+    return param ? param->value() : String();
+}
 
 /**
  * Constructor: Initializes pointers to component classes.
  */
 WebServerModule::WebServerModule(StorageHandler* sh, BluetoothManager* bt, LightController* lc, FanController* fc)
-    : storageHandler(sh), btManager(bt), lightCtrl(lc), fanCtrl(fc) {
-    btManager->registerDevicesListReadyListener(this);
+    : _server(80), _ws("/ws"), _events("/events"), scenes(bt, sh, &deferred), controlJobs(bt, sh), storageHandler(sh),
+      btManager(bt), lightCtrl(lc), fanCtrl(fc) {
+    storageHandler->registerDeviceConfigListener(this);
+    controlJobs.registerJobListener(this);
 }
 
 /**
@@ -20,7 +118,9 @@ bool WebServerModule::begin() {
         return false;
     }
     Serial.println("SPIFFS mounted successfully");
+    bootId = esp_random();
 
+    indexStaticFiles();
     setupRoutes();
 
     _server.begin();
@@ -30,9 +130,16 @@ bool WebServerModule::begin() {
 
 /**
  * Handle client: Must be called in the main loop().
+ * Runs the /control jobs, acks the WebSocket frames whose link opened meanwhile, then sends every
+ * completed deferred response.
  */
 void WebServerModule::handleClient() {
-    _server.handleClient();
+    controlJobs.process();
+    finishPendingControls();
+    scenes.process();
+    deferred.process();
+    _ws.cleanupClients();
+    sendDeviceEvents();
 }
 
 /**
@@ -40,130 +147,373 @@ void WebServerModule::handleClient() {
  */
 void WebServerModule::setupRoutes() {
     // Root path handler
-    _server.on("/", HTTP_GET, std::bind(&WebServerModule::handleRoot, this));
+    _server.on("/", HTTP_GET, std::bind(&WebServerModule::handleRoot, this, std::placeholders::_1));
     
     // API endpoints corresponding to the Python mock server
-    _server.on("/discover_devices", HTTP_GET, std::bind(&WebServerModule::handleFindDevices, this));
-    _server.on("/get_all_devices", HTTP_GET, std::bind(&WebServerModule::handleGetAllDevices, this));
-    _server.on("/add_device", HTTP_GET, std::bind(&WebServerModule::handleAddDevice, this));
-    _server.on("/remove_device", HTTP_GET, std::bind(&WebServerModule::handleRemoveDevice, this));
-    _server.on("/control", HTTP_GET, std::bind(&WebServerModule::handleControl, this));
+    _server.on("/discover_devices", HTTP_GET, std::bind(&WebServerModule::handleFindDevices, this, std::placeholders::_1));
+    _server.on("/get_all_devices", HTTP_GET, std::bind(&WebServerModule::handleGetAllDevices, this, std::placeholders::_1));
+    _server.on("/add_device", HTTP_GET, std::bind(&WebServerModule::handleAddDevice, this, std::placeholders::_1));
+    _server.on("/remove_device", HTTP_GET, std::bind(&WebServerModule::handleRemoveDevice, this, std::placeholders::_1));
+    _server.on("/control", HTTP_GET, std::bind(&WebServerModule::handleControl, this, std::placeholders::_1));
+    _server.on("/control_status", HTTP_GET, std::bind(&WebServerModule::handleControlStatus, this, std::placeholders::_1));
+    _server.on("/capture", HTTP_GET, std::bind(&WebServerModule::handleCapture, this, std::placeholders::_1));
+    _server.on("/bt_stats", HTTP_GET, std::bind(&WebServerModule::handleBtStats, this, std::placeholders::_1));
+
+    // Many lights at once, with a JSON body
+    AsyncCallbackJsonWebHandler* sceneHandler = new AsyncCallbackJsonWebHandler("/scene",
+        std::bind(&WebServerModule::handleScene, this, std::placeholders::_1, std::placeholders::_2));
+    sceneHandler->setMethod(HTTP_POST);
+    sceneHandler->setMaxContentLength(SCENE_MAX_BODY);
+    _server.addHandler(sceneHandler);
+
+    // Binary control frames (see ControlProtocol.h), for slider drags
+    _ws.onEvent(std::bind(&WebServerModule::handleWsEvent, this, std::placeholders::_1, std::placeholders::_2,
+                          std::placeholders::_3, std::placeholders::_4, std::placeholders::_5, std::placeholders::_6));
+    _server.addHandler(&_ws);
+
+    // Device state pushed as it changes, instead of polling /get_all_devices
+    _events.onConnect(std::bind(&WebServerModule::handleEventsConnect, this, std::placeholders::_1));
+    _server.addHandler(&_events);
 
     // Not found handler
-    _server.onNotFound(std::bind(&WebServerModule::handleNotFound, this));
+    _server.onNotFound(std::bind(&WebServerModule::handleNotFound, this, std::placeholders::_1));
 }
 
 /**
- * Serves index.html as the root page.
+ * Serves index.html as the root page, or '?download=<path>' as an attachment.
  */
-void WebServerModule::handleRoot() {
-    String path = "/index.html";
-    if (_server.hasArg("download")) {
-        path = _server.arg("download");
-    }
-    String contentType = getContentType(path);
-    if (SPIFFS.exists(path)) {
-        File file = SPIFFS.open(path, "r");
-        _server.streamFile(file, contentType);
-        file.close();
-    } else {
-        handleNotFound();
+void WebServerModule::handleRoot(AsyncWebServerRequest* request) {
+    bool download = request->hasParam("download");
+    if (!serveStatic(request, download ? arg(request, "download") : String("/index.html"), download)) {
+        handleNotFound(request);
     }
 }
 
 /**
- * Handles the '/discover_devices' endpoint.
- * Returns a JSON array of discovered Bluetooth devices.
+ * Indexes the files in SPIFFS by URL, so requests are answered without touching the filesystem.
+ * The files listed in the asset manifest (one "<url> <stored file> <etag> <flags>" line each) keep
+ * its URL, hash and flags; any other file is served under its own path with a hash of its content,
+ * and a lone "x.gz" as "x", compressed.
  */
-void WebServerModule::handleFindDevices() {
-    log_i("Handling /discover_devices request - performing Bluetooth scan.");
-    btManager->scanForDevices();
-}
+void WebServerModule::indexStaticFiles() {
+    staticFiles.clear();
+    std::map<String, size_t> sizes;
+    File root = SPIFFS.open("/");
+    for (File file = root.openNextFile(); file; file = root.openNextFile()) {
+        sizes[file.path()] = file.size();
+    }
+    root.close();
+
+    File manifest = SPIFFS.open(ASSET_MANIFEST_PATH, "r");
+    while (manifest && manifest.available()) {
+        String line = manifest.readStringUntil('\n');
+        int first = line.indexOf(' ');
+        int second = line.indexOf(' ', first + 1);
+        int third = line.indexOf(' ', second + 1);
+        if (first < 0 || second < 0 || third < 0) {
+            continue;
+        }
+        String url = line.substring(0, first);
+        String flags = line.substring(third + 1);
+        auto stored = sizes.find(line.substring(first + 1, second));
+        if (stored == sizes.end()) {
+            log_w("%s is in %s but not in SPIFFS.", url.c_str(), ASSET_MANIFEST_PATH);
+            continue;
+        }
+        StaticFile& file = staticFiles[url];
+        file.storedPath = stored->first;
+        file.size = stored->second;
+        file.contentType = contentTypeFor(url);
+        file.etag = "\"" + line.substring(second + 1, third) + "\"";
+        file.gzip = flags.indexOf('g') >= 0;
+        file.immutable = flags.indexOf('i') >= 0;
+        sizes.erase(stored);
+    }
+    if (manifest) {
+        manifest.close();
+        sizes.erase(ASSET_MANIFEST_PATH);
+    } else {
+        log_w("No %s, serving the web UI uncompressed.", ASSET_MANIFEST_PATH);
+    }
 
-void WebServerModule::onDevicesListReady(std::map<String, BtDevice> devices) {
-    if (storageHandler == nullptr) {
-        log_e("storage handler is null");
-        return;
+    for (const auto& pair : sizes) {
+        bool gzip = pair.first.endsWith(".gz");
+        String url = gzip ? pair.first.substring(0, pair.first.length() - 3) : pair.first;
+        // Both "x" and "x.gz": the smaller one wins
+        auto existing = staticFiles.find(url);
+        if (existing != staticFiles.end() && existing->second.size <= pair.second) {
+            continue;
+        }
+        StaticFile& file = staticFiles[url];
+        file.storedPath = pair.first;
+        file.size = pair.second;
+        file.contentType = contentTypeFor(url);
+        file.etag = hashFile(pair.first);
+        file.gzip = gzip;
+        file.immutable = false;
     }
-    const auto& configuredDevices = storageHandler->getAllManagedDevices();
+    log_i("Indexed %d static files.", staticFiles.size());
+}
 
-    String jsonResponse = "[";
-    bool firstDevice = true;
-    for (auto const& pair : devices) {
-        const String& mac = pair.first;
-        const BtDevice& btDevice = pair.second;
+bool WebServerModule::serveStatic(AsyncWebServerRequest* request, const String& path, bool download) {
+    auto it = staticFiles.find(path);
+    if (it == staticFiles.end()) {
+        return false;
+    }
 
-        if (!firstDevice) {
-            jsonResponse += ",";
+    const StaticFile& file = it->second;
+    AsyncWebServerResponse* response;
+    if (!download && request->hasHeader("If-None-Match") && request->header("If-None-Match").indexOf(file.etag) >= 0) {
+        response = request->beginResponse(304);
+    } else {
+        response = request->beginResponse(SPIFFS, file.storedPath, file.contentType);
+        // Only the compressed copy is on flash; every browser accepts gzip
+        if (file.gzip) {
+            response->addHeader("Content-Encoding", "gzip");
+        }
+        if (download) {
+            response->addHeader("Content-Disposition", "attachment; filename=\"" + path.substring(path.lastIndexOf('/') + 1) + "\"");
         }
-        firstDevice = false;
-        String deviceName = sanitizeString(btDevice.name);
+    }
+    response->addHeader("ETag", file.etag);
+    response->addHeader("Cache-Control", file.immutable ? CACHE_IMMUTABLE : CACHE_REVALIDATE);
+    request->send(response);
+    return true;
+}
 
-        jsonResponse += "{";
-        jsonResponse += "\"name\":\"" + deviceName + "\",";
-        jsonResponse += "\"mac_address\":\"" + btDevice.address + "\",";
-        
-        bool isConfigured = configuredDevices.count(mac);
-        jsonResponse += "\"is_configured\":";
-        jsonResponse += isConfigured ? "true" : "false";
-        
-        jsonResponse += "}";
+/**
+ * Handles the '/discover_devices' endpoint.
+ * Answers right away from the scan cache and starts a background discovery when the cache is stale
+ * (or 'refresh' is given). 'scanning' tells the page to poll again for devices found meanwhile.
+ */
+void WebServerModule::handleFindDevices(AsyncWebServerRequest* request) {
+    uint32_t now = millis();
+    uint32_t lastUpdate = btManager->getLastDiscoveryUpdateMs();
+    if (request->hasParam("refresh") || lastUpdate == 0 || now - lastUpdate >= DISCOVERY_REFRESH_MS) {
+        btManager->startDiscovery();
     }
-    jsonResponse += "]";
 
-    _server.send(200, "application/json", jsonResponse);
-    log_i("Sent /discover_devices response. Count: %d", devices.size());
+    // The scan cache has a fixed capacity, so the copy does not grow with the number of lights
+    struct Cursor {
+        std::vector<BtScanEntry> devices;
+        size_t next;
+        uint32_t now;
+    };
+    std::shared_ptr<Cursor> cursor = std::make_shared<Cursor>();
+    cursor->devices = btManager->getDiscoveredDevices();
+    cursor->next = 0;
+    cursor->now = now;
+    log_i("Streaming /discover_devices response. Count: %d", cursor->devices.size());
+
+    request->send(beginJsonResponse(request, [this, cursor](JsonWriter& json) {
+        if (cursor->next == 0) {
+            json.beginObject();
+            json.member("scanning", btManager->isDiscovering());
+            json.key("devices").beginArray();
+        }
+        if (cursor->next == cursor->devices.size()) {
+            json.endArray().endObject();
+            return false;
+        }
+        const BtScanEntry& device = cursor->devices[cursor->next++];
+        json.beginObject();
+        json.key("name").value(device.name, strnlen(device.name, sizeof(device.name)));
+        json.key("mac_address").macAddress(device.address);
+        if (device.hasRssi) {
+            json.member("rssi", device.rssi);
+        }
+        json.member("last_seen_ms", cursor->now - device.lastSeenMs);
+        json.member("is_configured", storageHandler->isDeviceConfigured(BTAddress((uint8_t*)device.address).toString(true)));
+        json.endObject();
+        return true;
+    }));
 }
 
 /**
  * Handles the '/get_all_devices' endpoint.
  * Returns a JSON object of all configured devices.
  */
-void WebServerModule::handleGetAllDevices() {
+void WebServerModule::handleGetAllDevices(AsyncWebServerRequest* request) {
     Serial.println("Handling /get_all_devices request.");
 
-    const auto& devicesMap = storageHandler->getAllManagedDevices();
+    // Rendered once per state version; a client that has that version already gets a 304
+    uint32_t version = storageHandler->getStateVersion();
+    String etag = devicesEtag(version);
+    AsyncWebServerResponse* response;
+    if (request->hasHeader("If-None-Match") && request->header("If-None-Match").indexOf(etag) >= 0) {
+        response = request->beginResponse(304);
+    } else {
+        // The version may have moved on since; the ETag is the one of the body actually sent
+        std::shared_ptr<const String> body = getDevicesBody(version);
+        etag = devicesEtag(version);
+        response = request->beginResponse("application/json", body->length(),
+            [body](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+                size_t count = std::min(maxLen, body->length() - index);
+                memcpy(buffer, body->c_str() + index, count);
+                return count;
+            });
+    }
+    response->addHeader("ETag", etag);
+    response->addHeader("Cache-Control", CACHE_REVALIDATE);
+    request->send(response);
+}
+
+String WebServerModule::devicesEtag(uint32_t version) {
+    // The boot id keeps a version from before a restart from matching
+    char etag[24];
+    snprintf(etag, sizeof(etag), "\"%08x-%u\"", (unsigned)bootId, (unsigned)version);
+    return String(etag);
+}
 
-    // Matching the Python mock server's output: a JSON object, not an array
-    String jsonResponse = "{";
-    bool firstEntry = true;
-    for (auto const& pair : devicesMap) {
-        const String& mac = pair.first;
-        const DeviceConfig& config = pair.second;
+std::shared_ptr<const String> WebServerModule::getDevicesBody(uint32_t& version) {
+    std::lock_guard<std::mutex> lock(devicesBodyMutex);
+    if (devicesBody && devicesBodyVersion == storageHandler->getStateVersion()) {
+        version = devicesBodyVersion;
+        return devicesBody;
+    }
 
-        if (!firstEntry) {
-            jsonResponse += ",";
+    // Matching the Python mock server's output: a JSON object, not an array.
+    // Written one device at a time through a small buffer, walking the devices instead of copying them.
+    char buffer[JSON_RESPONSE_BUFFER_SIZE];
+    JsonWriter json(buffer, sizeof(buffer));
+    std::shared_ptr<String> body = std::make_shared<String>();
+    json.beginObject();
+    int index = 0;
+    version = storageHandler->forEachDevice([&](const DeviceConfig& config) {
+        JsonWriter::Mark mark = json.mark();
+        json.key(config.mac_address.c_str());
+        writeDevice(json, config, index++);
+        if (json.overflowed()) {
+            // Cut off, it would make the cached body invalid JSON
+            log_e("Device %s larger than %u bytes, left out.", config.mac_address.c_str(),
+                  (unsigned)JSON_RESPONSE_BUFFER_SIZE);
+            json.rewind(mark);
         }
-        firstEntry = false;
+        *body += json.data();
+        json.clear();
+    });
+    json.endObject();
+    *body += json.data();
+
+    // Responses still sending the old body keep their own reference to it
+    devicesBody = body;
+    devicesBodyVersion = version;
+    return devicesBody;
+}
+
+void WebServerModule::writeDevice(JsonWriter& json, const DeviceConfig& config, int index) {
+    json.beginObject();
+    if (index >= 0) {
+        // The device's number in /ws control frames
+        json.member("index", index);
+    }
+    json.key("mac_address").value(config.mac_address.c_str(), config.mac_address.length());
+    json.key("name").value(config.name.c_str(), config.name.length());
+    json.member("fan_speed", config.fan_speed);
+    json.member("light_mode", lightModeToString(config.light_mode).c_str());
+    json.member("main_brightness", config.main_brightness);
+    json.member("main_warmness", config.main_warmness);
+    json.member("ring_hue", config.ring_hue);
+    json.member("ring_brightness", config.ring_brightness);
+    json.member("is_on", config.is_on);
+    json.endObject();
+}
+
+String WebServerModule::snapshotEvent(uint32_t& version) {
+    // The same body as /get_all_devices, so a snapshot right after a request costs nothing
+    std::shared_ptr<const String> body = getDevicesBody(version);
+    return "{\"version\":" + String(version) + ",\"devices\":" + *body + "}";
+}
+
+void WebServerModule::onDeviceConfigChanged(const DeviceConfig& config, uint32_t version) {
+    std::lock_guard<std::mutex> lock(eventsMutex);
+    changedDevices[config.mac_address] = ChangedDevice{config, version};
+}
+
+void WebServerModule::onDeviceListChanged(uint32_t version) {
+    std::lock_guard<std::mutex> lock(eventsMutex);
+    deviceListChanged = true;
+}
+
+/**
+ * A new /events client gets every device once, stamped with the state version;
+ * the events after it only carry what changed.
+ */
+void WebServerModule::handleEventsConnect(AsyncEventSourceClient* client) {
+    uint32_t version;
+    String snapshot = snapshotEvent(version);
+    client->send(snapshot.c_str(), "snapshot", version);
+}
 
-        jsonResponse += "\"" + mac + "\":{";
-        jsonResponse += "\"mac_address\":\"" + config.mac_address + "\",";
-        jsonResponse += "\"name\":\"" + config.name + "\",";
-        jsonResponse += "\"fan_speed\":" + String(config.fan_speed) + ",";
-        jsonResponse += "\"light_mode\":\"" + lightModeToString(config.light_mode) + "\",";
-        jsonResponse += "\"main_brightness\":" + String(config.main_brightness) + ",";
-        jsonResponse += "\"main_warmness\":" + String(config.main_warmness) + ",";
-        jsonResponse += "\"ring_hue\":" + String(config.ring_hue) + ",";
-        jsonResponse += "\"ring_brightness\":" + String(config.ring_brightness) + ",";
-        jsonResponse += "\"is_on\":";
-        jsonResponse += config.is_on ? "true" : "false";
-        jsonResponse += "}";
+/**
+ * Pushes the device changes collected since the last call to every /events client:
+ * a "device" event per changed device, or a new "snapshot" when devices were added or removed
+ * (their indexes may have moved). Changes arrive on several tasks, so they are sent from loop().
+ * Each event carries the version of its own change, oldest first: the page skips an event whose
+ * version is not above the last one it applied.
+ */
+void WebServerModule::sendDeviceEvents() {
+    std::vector<ChangedDevice> changed;
+    bool listChanged;
+    {
+        std::lock_guard<std::mutex> lock(eventsMutex);
+        if (changedDevices.empty() && !deviceListChanged) {
+            return;
+        }
+        changed.reserve(changedDevices.size());
+        for (auto const& pair : changedDevices) {
+            changed.push_back(pair.second);
+        }
+        changedDevices.clear();
+        listChanged = deviceListChanged;
+        deviceListChanged = false;
+    }
+    if (_events.count() == 0) {
+        return;
     }
-    jsonResponse += "}";
 
-    _server.send(200, "application/json", jsonResponse);
-    log_i("Sent /get_all_devices response. Count: %d\n", devicesMap.size());
+    if (listChanged) {
+        uint32_t version;
+        String snapshot = snapshotEvent(version);
+        _events.send(snapshot.c_str(), "snapshot", version);
+        return;
+    }
+    std::sort(changed.begin(), changed.end(), [](const ChangedDevice& a, const ChangedDevice& b) {
+        return (int32_t)(a.version - b.version) < 0;
+    });
+    char buffer[JSON_RESPONSE_BUFFER_SIZE];
+    for (const ChangedDevice& change : changed) {
+        JsonWriter json(buffer, sizeof(buffer));
+        json.beginObject().member("version", change.version).key("device");
+        writeDevice(json, change.config, -1);
+        json.endObject();
+        if (json.overflowed()) {
+            log_e("Device %s larger than %u bytes, no event sent.", change.config.mac_address.c_str(),
+                  (unsigned)JSON_RESPONSE_BUFFER_SIZE);
+            continue;
+        }
+        _events.send(json.data(), "device", change.version);
+    }
 }
 
 /**
  * Handles the '/add_device?name=<name>&address=<mac>' endpoint.
  */
-void WebServerModule::handleAddDevice() {
-    String name = _server.arg("name");
-    String address = _server.arg("address");
+void WebServerModule::handleAddDevice(AsyncWebServerRequest* request) {
+    String name = arg(request, "name");
+    String address = arg(request, "address");
 
     log_i("Handling /add_device request. Name: %s, Address: %s\n", name.c_str(), address.c_str());
 
+    if (name.length() > DEVICE_NAME_MAX_LENGTH) {
+        // Discovered names can be up to 248 bytes; cut at a UTF-8 character boundary
+        size_t cut = DEVICE_NAME_MAX_LENGTH;
+        while (cut > 0 && ((uint8_t)name[cut] & 0xC0) == 0x80) {
+            cut--;
+        }
+        name = name.substring(0, cut);
+        log_w("Device name shortened to %u bytes.", (unsigned)cut);
+    }
     if (name.length() > 0 && address.length() > 0) {
         if (!storageHandler->isDeviceConfigured(address)) {
             DeviceConfig newConfig;
@@ -178,14 +528,14 @@ void WebServerModule::handleAddDevice() {
             newConfig.is_on = false;
 
             storageHandler->saveSpecificDeviceConfig(newConfig);
-            _server.send(200, "text/plain", "OK");
+            request->send(200, "text/plain", "OK");
             log_i("Device %s (%s) added successfully.\n", name.c_str(), address.c_str());
         } else {
-            _server.send(409, "text/plain", "Error: Device already configured.");
+            request->send(409, "text/plain", "Error: Device already configured.");
             log_e("Error: Device %s already configured.\n", address.c_str());
         }
     } else {
-        _server.send(400, "text/plain", "Error: Missing 'name' or 'address' parameters.");
+        request->send(400, "text/plain", "Error: Missing 'name' or 'address' parameters.");
         log_e("Error: Missing 'name' or 'address' parameters.");
     }
 }
@@ -193,127 +543,468 @@ void WebServerModule::handleAddDevice() {
 /**
  * Handles the '/remove_device?address=<mac>' endpoint.
  */
-void WebServerModule::handleRemoveDevice() {
-    String address = _server.arg("address");
+void WebServerModule::handleRemoveDevice(AsyncWebServerRequest* request) {
+    String address = arg(request, "address");
 
     log_i("Handling /remove_device request for address: %s\n", address.c_str());
 
     if (address.length() > 0) {
         if (storageHandler->deleteDeviceConfig(address)) {
-            _server.send(200, "text/plain", "OK");
+            request->send(200, "text/plain", "OK");
             log_i("Device %s removed successfully.\n", address.c_str());
         } else {
-            _server.send(404, "text/plain", "Error: Device not found.");
+            request->send(404, "text/plain", "Error: Device not found.");
             log_e("Error: Device %s not found in storage.\n", address.c_str());
         }
     } else {
-        _server.send(400, "text/plain", "Error: Missing 'address' parameter.");
+        request->send(400, "text/plain", "Error: Missing 'address' parameter.");
         log_e("Error: Missing 'address' parameter.");
     }
 }
 
 /**
  * Handles the '/control?address=<mac>&<params>...' endpoint.
+ * Only changed fields are sent to the light; add 'sync=full' to resend all of them.
+ * The request is checked and queued as a job (see ControlJobs), and answered right away with
+ * 202 and the job, whatever the radio is doing. Its outcome is pushed to /events as a "control"
+ * event and can be polled at the Location, /control_status?job=<id>.
  */
-void WebServerModule::handleControl() {
-    String address = _server.arg("address");
+void WebServerModule::handleControl(AsyncWebServerRequest* request) {
+    String address = arg(request, "address");
     
     if (address.length() == 0) {
-        _server.send(400, "text/plain", "Error: Missing 'address' parameter.");
+        request->send(400, "text/plain", "Error: Missing 'address' parameter.");
         return;
     }
 
     log_i("Handling /control request for address: %s", address.c_str());
 
-    // Retrieve the device's current state from StorageHandler
-    DeviceConfig currentConfig;
-    if (!storageHandler->loadSpecificDeviceConfig(address, currentConfig)) {
-        _server.send(404, "text/plain", "Error: Device not found.");
+    ControlUpdate update;
+    for (const auto& param : CONTROL_PARAMS) {
+        if (request->hasParam(param.name)) {
+            update.set(param.field, arg(request, param.name).toInt());
+        }
+    }
+    if (request->hasParam("mode")) {
+        setControlMode(update, arg(request, "mode"));
+    }
+    if (arg(request, "sync") == "full") {
+        update.set(CONTROL_SYNC, 1);
+    }
+
+    DeviceConfig config;
+    if (!storageHandler->loadSpecificDeviceConfig(address, config)) {
+        request->send(404, "text/plain", "Error: Device not found.");
+        return;
+    }
+    uint32_t id = controlJobs.start(config.mac_address, update);
+    ControlJob job;
+    if (id == 0 || !controlJobs.get(id, job)) {
+        AsyncWebServerResponse* response = request->beginResponse(503, "text/plain", "Error: Too many control jobs running.");
+        response->addHeader("Retry-After", "1");
+        request->send(response);
+        return;
+    }
+    sendControlJob(request, 202, job);
+}
+
+/**
+ * Handles the '/control_status?job=<id>' endpoint: the job as /control answered it, with its status now.
+ * Only the last CONTROL_JOB_HISTORY finished jobs are kept; older ones are 404.
+ */
+void WebServerModule::handleControlStatus(AsyncWebServerRequest* request) {
+    ControlJob job;
+    if (!controlJobs.get(arg(request, "job").toInt(), job)) {
+        request->send(404, "text/plain", "Error: Job not found.");
         return;
     }
+    sendControlJob(request, 200, job);
+}
+
+void WebServerModule::sendControlJob(AsyncWebServerRequest* request, int code, const ControlJob& job) {
+    char buffer[128];
+    JsonWriter json(buffer, sizeof(buffer));
+    writeControlJob(json, job);
+    AsyncWebServerResponse* response = request->beginResponse(code, "application/json", json.data());
+    response->addHeader("Location", "/control_status?job=" + String(job.id));
+    response->addHeader("Cache-Control", CACHE_REVALIDATE);
+    request->send(response);
+}
 
-    // Update the device's state based on query parameters
-    if (_server.hasArg("fan")) {
-        currentConfig.fan_speed = _server.arg("fan").toInt();
-        // fanCtrl->setSpeed(currentConfig.fan_speed);
+void WebServerModule::writeControlJob(JsonWriter& json, const ControlJob& job) {
+    json.beginObject();
+    json.member("job", job.id);
+    json.key("address").value(job.address.c_str(), job.address.length());
+    json.member("status", controlJobStatusName(job.status));
+    json.member("elapsed_ms", job.finished() ? job.elapsedMs : millis() - job.startedMs);
+    json.endObject();
+}
+
+void WebServerModule::onControlJobFinished(const ControlJob& job) {
+    if (_events.count() == 0) {
+        return;
     }
-    if (_server.hasArg("bright")) {
-        currentConfig.main_brightness = _server.arg("bright").toInt();
+    char buffer[128];
+    JsonWriter json(buffer, sizeof(buffer));
+    writeControlJob(json, job);
+    _events.send(json.data(), "control");
+}
+
+/**
+ * Handles 'POST /scene': sets many devices in one request. The body is
+ *   {"devices": [{"address": "<mac>", "mode": "main", "bright": 80, ...}, ...]}
+ * (or just the array), each entry taking the parameters of /control. Later entries for the same
+ * device apply on top of earlier ones. Answered once every device is done, with a result per device
+ * and the time the scene took (see SceneRunner).
+ */
+void WebServerModule::handleScene(AsyncWebServerRequest* request, JsonVariant& json) {
+    JsonArray entries = json.is<JsonArray>() ? json.as<JsonArray>() : json["devices"].as<JsonArray>();
+    if (entries.isNull() || entries.size() == 0) {
+        request->send(400, "text/plain", "Error: Expected a list of devices.");
+        return;
     }
-    if (_server.hasArg("warm")) {
-        currentConfig.main_warmness = _server.arg("warm").toInt();
+    if (entries.size() > SCENE_MAX_DEVICES) {
+        request->send(400, "text/plain", "Error: Too many devices.");
+        return;
     }
-    if (_server.hasArg("hue")) {
-        currentConfig.ring_hue = _server.arg("hue").toInt();
+
+    std::vector<SceneRunner::Entry> scene;
+    for (JsonObject item : entries) {
+        String address = item["address"] | "";
+        ControlUpdate update;
+        for (const auto& param : CONTROL_PARAMS) {
+            if (item[param.name].is<int>()) {
+                update.set(param.field, item[param.name].as<int>());
+            }
+        }
+        if (item["mode"].is<const char*>()) {
+            setControlMode(update, item["mode"].as<const char*>());
+        }
+        if (item["sync"] == "full") {
+            update.set(CONTROL_SYNC, 1);
+        }
+
+        auto existing = std::find_if(scene.begin(), scene.end(),
+                                     [&address](const SceneRunner::Entry& entry) { return entry.address == address; });
+        if (existing == scene.end()) {
+            SceneRunner::Entry entry;
+            entry.address = address;
+            entry.found = storageHandler->isDeviceConfigured(address);
+            scene.push_back(entry);
+            existing = scene.end() - 1;
+        }
+        existing->update.merge(update);
     }
-    if (_server.hasArg("rgbValue")) {
-        currentConfig.ring_brightness = _server.arg("rgbValue").toInt();
+
+    log_i("Handling /scene request with %d devices.", scene.size());
+    scenes.start(scene, deferred.defer(request, SCENE_TIMEOUT_MS + CONTROL_CONNECT_TIMEOUT_MS));
+}
+
+/**
+ * WebSocket events of /ws: every binary message is one control frame and gets one ack.
+ */
+void WebServerModule::handleWsEvent(AsyncWebSocket* server, AsyncWebSocketClient* client, AwsEventType type,
+                                    void* eventArg, uint8_t* data, size_t len) {
+    if (type == WS_EVT_CONNECT) {
+        log_i("WebSocket client %u connected.", client->id());
+        return;
+    }
+    if (type != WS_EVT_DATA) {
+        return;
+    }
+    AwsFrameInfo* info = (AwsFrameInfo*)eventArg;
+    uint16_t seq = len >= 2 ? data[0] | (data[1] << 8) : 0;
+    // Control frames are a few bytes; a fragmented or text message is not one
+    if (!info->final || info->index != 0 || info->len != len || info->opcode != WS_BINARY) {
+        sendControlAck(client->id(), seq, CONTROL_BAD_FRAME);
+        return;
     }
-    if (_server.hasArg("mode")) {
-        String lightModeArg = _server.arg("mode");
-        if (lightModeArg == "off") {
-            currentConfig.is_on = false;
+    uint32_t start = micros();
+    ControlStatus status = handleControlFrame(client, data, len);
+    sendControlAck(client->id(), seq, status);
+    log_d("Control frame %u: status %d in %u us", seq, status, micros() - start);
+}
+
+/**
+ * Decodes one control frame and sends the fields it changes, or queues it while the device's link opens.
+ */
+ControlStatus WebServerModule::handleControlFrame(AsyncWebSocketClient* client, const uint8_t* data, size_t len) {
+    if (len < CONTROL_HEADER_SIZE + CONTROL_FIELD_SIZE || (len - CONTROL_HEADER_SIZE) % CONTROL_FIELD_SIZE != 0 ||
+        (len - CONTROL_HEADER_SIZE) / CONTROL_FIELD_SIZE > CONTROL_MAX_FIELDS) {
+        return CONTROL_BAD_FRAME;
+    }
+    uint16_t seq = data[0] | (data[1] << 8);
+    ControlUpdate update;
+    for (const uint8_t* field = data + CONTROL_HEADER_SIZE; field < data + len; field += CONTROL_FIELD_SIZE) {
+        uint16_t value = field[1] | (field[2] << 8);
+        if (field[0] >= CONTROL_FIELD_COUNT || (field[0] == CONTROL_MODE && value > CONTROL_MODE_RGB)) {
+            return CONTROL_BAD_FRAME;
         }
-        else if (lightModeArg == "main") {
-            currentConfig.is_on = true;
-            currentConfig.light_mode = LightMode::MAIN_LIGHT;
-        } else if (lightModeArg == "rgb") {
-            currentConfig.is_on = true;
-            currentConfig.light_mode = LightMode::RGB_RING;
+        update.set((ControlField)field[0], value);
+    }
+
+    String address;
+    if (!storageHandler->getDeviceMacAt(data[2], address)) {
+        return CONTROL_NOT_FOUND;
+    }
+    BTAddress btAddress(address);
+    const uint8_t* native = *btAddress.getNative();
+    // The index is from the client's copy of the list; a device added or removed since moves it
+    uint16_t check = data[3] | (data[4] << 8);
+    if (check != ((native[4] << 8) | native[5])) {
+        return CONTROL_NOT_FOUND;
+    }
+
+    // Nothing is stored while the link opens, so the frame builds on the ones still waiting for it
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    ControlUpdate combined = pendingControls.combine(native, update);
+    DeviceConfig config;
+    if (!storageHandler->loadSpecificDeviceConfig(address, config)) {
+        return CONTROL_NOT_FOUND;
+    }
+    ControlJobs::applyUpdate(combined, config);
+    bool fullSync = combined.has(CONTROL_SYNC) && combined.get(CONTROL_SYNC) != 0;
+    if (btManager->sendConfigToDevice(config, fullSync)) {
+        // Only in RAM: a drag sends many frames a second, tryStore() writes the last one to NVS
+        storageHandler->updateDeviceConfig(config);
+        // The link opened just now; the frames still waiting are stored with this one's fields too
+        PendingControls::Device* waiting = pendingControls.find(native);
+        if (waiting) {
+            waiting->update.merge(update);
         }
-        else {
-            log_w("light mode not supported: %s", lightModeArg);
+        return CONTROL_OK;
+    }
+    // A drag keeps sending while the link opens: only the client's latest frame per device is acked again
+    pendingControls.add(native, update, millis() + CONTROL_CONNECT_TIMEOUT_MS, client->id(), seq);
+    return CONTROL_QUEUED;
+}
+
+void WebServerModule::sendControlAck(uint32_t clientId, uint16_t seq, ControlStatus status) {
+    uint8_t ack[CONTROL_ACK_SIZE] = {(uint8_t)seq, (uint8_t)(seq >> 8), status};
+    _ws.binary(clientId, ack, sizeof(ack));
+}
+
+/**
+ * Sends the second ack of the queued WebSocket frames whose device is connected now, or that timed out.
+ * The link sent the config of the device's last frame when it opened; that is what is stored.
+ */
+void WebServerModule::finishPendingControls() {
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    if (pendingControls.empty()) {
+        return;
+    }
+    uint32_t now = millis();
+    std::vector<PendingControls::Device>& devices = pendingControls.devices();
+    for (auto it = devices.begin(); it != devices.end();) {
+        BTAddress address(it->address);
+        ControlStatus status;
+        if (btManager->isConnected(address)) {
+            DeviceConfig config;
+            status = CONTROL_NOT_FOUND;
+            if (storageHandler->loadSpecificDeviceConfig(address.toString(true), config)) {
+                ControlJobs::applyUpdate(it->update, config);
+                storageHandler->updateDeviceConfig(config);
+                status = CONTROL_OK;
+                log_i("Link to %s opened, control commands sent.", config.mac_address.c_str());
+            }
+        } else if ((int32_t)(now - it->deadlineMs) >= 0) {
+            status = CONTROL_TIMEOUT;
+        } else {
+            ++it;
+            continue;
         }
+        for (const PendingControls::Frame& frame : it->frames) {
+            sendControlAck(frame.client, frame.seq, status);
+        }
+        it = devices.erase(it);
     }
+}
 
-    // Now, send the control commands via Bluetooth
-    if (btManager->sendConfigToDevice(currentConfig)) {
-        // If the command was sent successfully, save the new state to storage
-        storageHandler->saveSpecificDeviceConfig(currentConfig);
-        _server.send(200, "text/plain", "OK");
-        log_i("Control commands sent and state saved for %s.", address.c_str());
-    } else {
-        _server.send(503, "text/plain", "Error: Could not send command via Bluetooth. Is the device connected?");
-        log_e("Failed to send BT command to %s.", address.c_str());
+/**
+ * Handles the '/capture' endpoint: downloads the binary capture of the last Bluetooth packets
+ * (see BtCapture.h for the format, tools/replay_capture.cpp to replay it).
+ * 'clear' empties it, 'enable=0/1' stops and restarts capturing.
+ */
+void WebServerModule::handleCapture(AsyncWebServerRequest* request) {
+    BtCapture& capture = btManager->getCapture();
+    if (request->hasParam("clear") || request->hasParam("enable")) {
+        if (request->hasParam("clear")) {
+            capture.clear();
+        }
+        if (request->hasParam("enable")) {
+            capture.setEnabled(arg(request, "enable") != "0");
+        }
+        request->send(200, "text/plain", "OK");
+        return;
     }
+
+    // Streamed in chunks straight out of the ring buffer, up to the newest record at the time of the
+    // request. A record that does not fit the chunk is finished in the next one.
+    struct Stream {
+        uint32_t from;
+        uint32_t end;
+        bool headerSent;
+        BtCaptureRecord pending; // header or record being copied out
+        size_t offset;
+        size_t size;
+    };
+    static_assert(sizeof(BtCaptureHeader) <= sizeof(BtCaptureRecord), "the header is staged in a record");
+    std::shared_ptr<Stream> stream = std::make_shared<Stream>();
+    capture.range(stream->from, stream->end);
+    stream->headerSent = false;
+    stream->offset = stream->size = 0;
+    log_i("Streaming /capture response. Records: %u", stream->end - stream->from);
+
+    AsyncWebServerResponse* response = request->beginChunkedResponse("application/octet-stream",
+        [this, stream](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+            size_t written = 0;
+            while (written < maxLen) {
+                if (stream->offset == stream->size) {
+                    if (!stream->headerSent) {
+                        BtCaptureHeader header = btManager->getCapture().makeHeader();
+                        memcpy(&stream->pending, &header, sizeof(header));
+                        stream->size = sizeof(header);
+                        stream->headerSent = true;
+                    } else if (btManager->getCapture().read(stream->from, stream->end, &stream->pending, 1) == 1) {
+                        stream->size = sizeof(BtCaptureRecord);
+                    } else {
+                        break;
+                    }
+                    stream->offset = 0;
+                }
+                size_t count = std::min(maxLen - written, stream->size - stream->offset);
+                memcpy(buffer + written, (const uint8_t*)&stream->pending + stream->offset, count);
+                stream->offset += count;
+                written += count;
+            }
+            return written;
+        });
+    response->addHeader("Content-Disposition", "attachment; filename=\"bt_capture.bin\"");
+    request->send(response);
+}
+
+/**
+ * Handles the '/bt_stats' endpoint: TX queue counters with the queue wait histogram of each
+ * priority lane, and the retransmit rate of each device.
+ */
+void WebServerModule::handleBtStats(AsyncWebServerRequest* request) {
+    // Written in three parts: the TX queue, then one device and one connection at a time
+    enum Part { TX, DEVICES, CONNECTIONS };
+    struct Cursor {
+        Part part;
+        size_t next;
+        std::vector<BtDeviceAckStats> devices;
+        std::vector<BtConnectHistory> connections;
+    };
+    std::shared_ptr<Cursor> cursor = std::make_shared<Cursor>();
+    cursor->part = TX;
+    cursor->next = 0;
+
+    request->send(beginJsonResponse(request, [this, cursor](JsonWriter& json) {
+        static const char* LANE_NAMES[BT_PRIORITY_COUNT] = {"urgent", "normal"};
+        switch (cursor->part) {
+        case TX: {
+            BtTxStats tx = btManager->getTxStats();
+            json.beginObject().key("tx").beginObject();
+            json.member("depth", tx.depth);
+            json.member("sent", tx.sent);
+            json.member("coalesced", tx.coalesced);
+            json.member("rejected", tx.rejected);
+            json.member("dropped", tx.dropped);
+            json.member("retransmits", tx.retransmits);
+            json.member("promoted", tx.promoted);
+            json.member("starvation_picks", tx.starvationPicks);
+            json.key("wait_buckets_ms").beginArray();
+            for (size_t i = 0; i + 1 < BT_TX_WAIT_BUCKETS; i++) {
+                json.value(BT_TX_WAIT_BUCKET_MS[i]);
+            }
+            json.endArray();
+            json.key("lanes").beginObject();
+            for (size_t lane = 0; lane < BT_PRIORITY_COUNT; lane++) {
+                const BtTxLaneStats& stats = tx.lanes[lane];
+                json.key(LANE_NAMES[lane]).beginObject();
+                json.member("depth", stats.depth);
+                json.member("capacity", stats.capacity);
+                json.member("sent", stats.sent);
+                json.member("max_wait_ms", stats.maxWaitMs);
+                // One count more than wait_buckets_ms: the last one is everything above the last bound
+                json.key("wait_histogram").beginArray();
+                for (size_t i = 0; i < BT_TX_WAIT_BUCKETS; i++) {
+                    json.value(stats.waitHistogram[i]);
+                }
+                json.endArray().endObject();
+            }
+            json.endObject().endObject();
+            json.key("devices").beginArray();
+            cursor->devices = btManager->getDeviceAckStats();
+            cursor->part = DEVICES;
+            return true;
+        }
+        case DEVICES:
+            if (cursor->next < cursor->devices.size()) {
+                const BtDeviceAckStats& device = cursor->devices[cursor->next++];
+                json.beginObject();
+                json.key("mac_address").macAddress(device.address);
+                json.member("sent", device.sent);
+                json.member("retransmits", device.retransmits);
+                json.member("retransmit_rate", device.retransmitRate, 3);
+                json.member("timed_out", device.timedOut);
+                json.member("ack_timeout_ms", device.timeoutMs);
+                json.endObject();
+                return true;
+            } else {
+                BtReconnectStats reconnect = btManager->getReconnectStats();
+                json.endArray();
+                json.key("reconnect").beginObject();
+                json.member("reconnects", reconnect.reconnects);
+                json.member("reconnected", reconnect.reconnected);
+                json.member("gave_up", reconnect.gaveUp);
+                json.member("preconnects", reconnect.preconnects);
+                json.member("preconnect_hits", reconnect.preconnectHits);
+                json.endObject();
+                json.key("connections").beginArray();
+                cursor->devices.clear();
+                cursor->connections = btManager->getConnectHistory();
+                cursor->next = 0;
+                cursor->part = CONNECTIONS;
+                return true;
+            }
+        case CONNECTIONS:
+            if (cursor->next < cursor->connections.size()) {
+                const BtConnectHistory& history = cursor->connections[cursor->next++];
+                json.beginObject();
+                json.key("mac_address").macAddress(history.address);
+                json.member("attempts", history.attempts);
+                json.member("success_rate", history.successRate, 3);
+                json.member("connect_ms", history.avgLatencyMs);
+                json.member("drops", history.drops);
+                json.member("uses", history.uses);
+                json.member("idle_ms", millis() - history.lastUsedMs);
+                json.member("score", history.score, 2);
+                json.member("reconnecting", history.reconnectPending);
+                json.endObject();
+                return true;
+            }
+            json.endArray().endObject();
+            return false;
+        }
+        return false;
+    }));
 }
 
 /**
  * Handles 404 (Not Found) errors.
  */
-void WebServerModule::handleNotFound() {
-    // Check if the requested file exists in SPIFFS and serve it
-    String path = _server.uri();
-    if (SPIFFS.exists(path)) {
-        String contentType = getContentType(path);
-        File file = SPIFFS.open(path, "r");
-        _server.streamFile(file, contentType);
-        file.close();
+void WebServerModule::handleNotFound(AsyncWebServerRequest* request) {
+    // A file of the web UI, looked up in the index (a miss does not touch the filesystem)
+    if (serveStatic(request, request->url())) {
         return;
     }
     // If the file doesn't exist, send a 404
     String message = "File Not Found\n\n";
     message += "URI: ";
-    message += _server.uri();
+    message += request->url();
     message += "\nMethod: ";
-    message += (_server.method() == HTTP_GET) ? "GET" : "POST";
-    _server.send(404, "text/plain", message);
+    message += request->methodToString();
+    request->send(404, "text/plain", message);
 }
-
-
-/**
- * Helper to determine content type from file extension.
- */
-String WebServerModule::getContentType(String filename) {
-    if (_server.hasArg("download")) return "application/octet-stream";
-    else if (filename.endsWith(".htm")) return "text/html";
-    else if (filename.endsWith(".html")) return "text/html";
-    else if (filename.endsWith(".css")) return "text/css";
-    else if (filename.endsWith(".js")) return "application/javascript";
-    else if (filename.endsWith(".png")) return "image/png";
-    else if (filename.endsWith(".gif")) return "image/gif";
-    else if (filename.endsWith(".jpg")) return "image/jpeg";
-    else if (filename.endsWith(".ico")) return "image/x-icon";
-    else if (filename.endsWith(".xml")) return "text/xml";
-    return "text/plain";
-}
\ No newline at end of file
@@ -2,14 +2,24 @@
 #ifndef WEB_SERVER_MODULE_H
 #define WEB_SERVER_MODULE_H
 
-#include <WebServer.h>
+#include <ESPAsyncWebServer.h>
+#include <ArduinoJson.h>
 #include <SPIFFS.h>
+#include <map>
+#include <memory>
+#include <vector>
+#include "DeferredResponses.h"
+#include "SceneRunner.h"
+#include "ControlJobs.h"
+#include "JsonWriter.h"
+#include "ControlProtocol.h"
+#include "PendingControls.h"
 #include "BluetoothManager.h"
 #include "LightController.h"
 #include "FanController.h"
 #include "StorageHandler.h"
 
-class WebServerModule : public IBtDevicesListReadyListener {
+class WebServerModule : public IDeviceConfigListener, public IControlJobListener {
 public:
     /** Constructor */
     WebServerModule(StorageHandler* sh, BluetoothManager* bt, LightController* lc, FanController* fc);
@@ -21,31 +31,95 @@ public:
     bool begin();
 
     /**
-     * @brief Handles incoming HTTP client requests.
-     * This should be called frequently in the main loop.
+     * @brief Sends the deferred responses that are ready and the device changes to /events.
+     * Requests themselves are handled on the async TCP task; this should be called frequently in the main loop.
      */
     void handleClient();
 
-    virtual void onDevicesListReady(std::map<String, BtDevice> devices);
+    // IDeviceConfigListener: remembered here, pushed to /events from handleClient()
+    void onDeviceConfigChanged(const DeviceConfig& config, uint32_t version) override;
+    void onDeviceListChanged(uint32_t version) override;
+    // IControlJobListener: pushed to /events as a "control" event
+    void onControlJobFinished(const ControlJob& job) override;
 
 private:
-    WebServer _server; // Private instance of the WebServer
+    AsyncWebServer _server; // Private instance of the async web server
+    AsyncWebSocket _ws;     // Binary control frames, see ControlProtocol.h
+    AsyncEventSource _events; // Device state stream: a snapshot on connect, then changes
+    DeferredResponses deferred;
+    SceneRunner scenes;
+    ControlJobs controlJobs;
     StorageHandler* storageHandler;
     BluetoothManager* btManager;
     LightController* lightCtrl;
     FanController* fanCtrl;
 
+    // WebSocket control frames waiting for their device's link to open
+    std::mutex pendingMutex;
+    PendingControls pendingControls;
+
+    // Every file in SPIFFS by URL, indexed at begin() (see tools/build_assets.py for the web UI)
+    struct StaticFile {
+        String storedPath; // the file in SPIFFS
+        size_t size;
+        const char* contentType;
+        String etag;       // quoted content hash
+        bool gzip;
+        bool immutable;    // the name carries the hash, so it never changes
+    };
+    std::map<String, StaticFile> staticFiles;
+
+    // /get_all_devices as rendered for a state version, shared with the responses still sending it
+    std::mutex devicesBodyMutex;
+    std::shared_ptr<const String> devicesBody;
+    uint32_t devicesBodyVersion = 0;
+    uint32_t bootId = 0;
+
+    // Device changes not pushed to /events yet; a device changed several times is sent once,
+    // with the state version of its last change
+    struct ChangedDevice {
+        DeviceConfig config;
+        uint32_t version;
+    };
+    std::mutex eventsMutex;
+    std::map<String, ChangedDevice> changedDevices;
+    bool deviceListChanged = false;
+
     // Private helper methods
     void setupRoutes();
-    void handleRoot();
-    void handleControl();
-    void handleFindDevices();
-    void handleGetAllDevices();
-    void handleNotFound();
-    void handleAddDevice();
-    void handleRemoveDevice();
-
-    String getContentType(String filename);
+    void handleRoot(AsyncWebServerRequest* request);
+    void handleControl(AsyncWebServerRequest* request);
+    void handleControlStatus(AsyncWebServerRequest* request);
+    void sendControlJob(AsyncWebServerRequest* request, int code, const ControlJob& job);
+    static void writeControlJob(JsonWriter& json, const ControlJob& job);
+    void handleFindDevices(AsyncWebServerRequest* request);
+    void handleGetAllDevices(AsyncWebServerRequest* request);
+    void handleNotFound(AsyncWebServerRequest* request);
+    void handleAddDevice(AsyncWebServerRequest* request);
+    void handleRemoveDevice(AsyncWebServerRequest* request);
+    void handleCapture(AsyncWebServerRequest* request);
+    void handleBtStats(AsyncWebServerRequest* request);
+    void handleScene(AsyncWebServerRequest* request, JsonVariant& json);
+    void handleWsEvent(AsyncWebSocket* server, AsyncWebSocketClient* client, AwsEventType type,
+                       void* eventArg, uint8_t* data, size_t len);
+    ControlStatus handleControlFrame(AsyncWebSocketClient* client, const uint8_t* data, size_t len);
+    void sendControlAck(uint32_t clientId, uint16_t seq, ControlStatus status);
+    void finishPendingControls();
+    void handleEventsConnect(AsyncEventSourceClient* client);
+    void sendDeviceEvents();
+
+    // One device's object in /get_all_devices and /events; index < 0 leaves it out
+    static void writeDevice(JsonWriter& json, const DeviceConfig& config, int index);
+    // Every managed device, keyed by MAC address, as of the state version (rendered again only after a change)
+    // The body and the version it was rendered at are read together, under the storage lock
+    std::shared_ptr<const String> getDevicesBody(uint32_t& version);
+    String devicesEtag(uint32_t version);
+    // getDevicesBody() with the state version it is at (also returned), the first /events message
+    String snapshotEvent(uint32_t& version);
+
+    void indexStaticFiles();
+    // Sends a file of the web UI, or 304 if the client has it already; false if there is no such file
+    bool serveStatic(AsyncWebServerRequest* request, const String& path, bool download = false);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,129 @@
+// Host benchmark for the light protocol packet encoder.
+//
+// Compares the old runtime encoder (switch over the command, memcpy of prefix / data prefix /
+// payload / suffix into a 128 byte stack buffer) with LightProtocol's compile-time templates.
+//
+// Build and run from ESP32_Smart_Dimmer/tools:
+//   g++ -std=c++17 -O2 -I../../libraries/LightProtocol/src bench_packet_encoder.cpp -o bench_packet_encoder
+//   ./bench_packet_encoder [iterations]
+#include <LightProtocol.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace Legacy
+{
+    const uint8_t BT_PREFIX[] = {0x01, 0xfe, 0x00, 0x00, 0x51, 0x81, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0d};
+    const uint8_t BT_SUFFIX[] = {0x0e, 0x00};
+    const uint8_t ON_OFF_DATA_PREFIX[] = {0x07, 0x01, 0x03, 0x01};
+    const uint8_t INTENSITY_DATA_PREFIX[] = {0x07, 0x01, 0x03, 0x02};
+    const uint8_t WARMNESS_DATA_PREFIX[] = {0x07, 0x01, 0x03, 0x03};
+    const uint8_t RGB_DATA_PREFIX[] = {0x0A, 0x02, 0x03, 0x0C};
+    const uint8_t FAN_SPEED_DATA_PREFIX[] = {0x07, 0x0e, 0x03, 0x03};
+    const int MAX_PACKET_SIZE = 128;
+
+    // Mirrors the body of BluetoothManager::sendCommand before the LightProtocol encoder
+    size_t encode(int cmd, const uint8_t *payload, size_t payloadSize, uint8_t *packetBuffer)
+    {
+        const uint8_t *cmdPrefix;
+        size_t cmdPrefixSize;
+        uint8_t finalPacketByte6 = 0x18;
+        switch (cmd)
+        {
+        case 0: cmdPrefix = ON_OFF_DATA_PREFIX; cmdPrefixSize = sizeof(ON_OFF_DATA_PREFIX); break;
+        case 1: cmdPrefix = INTENSITY_DATA_PREFIX; cmdPrefixSize = sizeof(INTENSITY_DATA_PREFIX); break;
+        case 2: cmdPrefix = WARMNESS_DATA_PREFIX; cmdPrefixSize = sizeof(WARMNESS_DATA_PREFIX); break;
+        case 3: cmdPrefix = RGB_DATA_PREFIX; cmdPrefixSize = sizeof(RGB_DATA_PREFIX); finalPacketByte6 = 0x1c; break;
+        case 4: cmdPrefix = FAN_SPEED_DATA_PREFIX; cmdPrefixSize = sizeof(FAN_SPEED_DATA_PREFIX); break;
+        default: return 0;
+        }
+        size_t packetSize = 0;
+        memcpy(packetBuffer, BT_PREFIX, sizeof(BT_PREFIX));
+        packetSize += sizeof(BT_PREFIX);
+        packetBuffer[6] = finalPacketByte6;
+        memcpy(&packetBuffer[packetSize], cmdPrefix, cmdPrefixSize);
+        packetSize += cmdPrefixSize;
+        memcpy(&packetBuffer[packetSize], payload, payloadSize);
+        packetSize += payloadSize;
+        memcpy(&packetBuffer[packetSize], BT_SUFFIX, sizeof(BT_SUFFIX));
+        packetSize += sizeof(BT_SUFFIX);
+        return packetSize;
+    }
+}
+
+// Runtime dispatch over the templates, as done in BluetoothManager::sendCommand
+static size_t encodeTemplate(int cmd, const uint8_t *payload, uint8_t *out)
+{
+    switch (cmd)
+    {
+    case 0: return LightProtocol::OnOff::encodeInto(out, payload);
+    case 1: return LightProtocol::Intensity::encodeInto(out, payload);
+    case 2: return LightProtocol::Warmness::encodeInto(out, payload);
+    case 3: return LightProtocol::Rgb::encodeInto(out, payload);
+    case 4: return LightProtocol::FanSpeed::encodeInto(out, payload);
+    default: return 0;
+    }
+}
+
+static volatile uint32_t sink;
+
+template <typename Fn>
+static double measure(const char *name, long iterations, Fn fn)
+{
+    uint32_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++)
+    {
+        checksum += fn(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    sink = checksum;
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+    printf("%-28s %8.2f ns/packet\n", name, ns);
+    return ns;
+}
+
+int main(int argc, char **argv)
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 20000000;
+    const size_t payloadSizes[] = {1, 1, 1, 4, 1};
+
+    // Both encoders must produce identical packets
+    for (int cmd = 0; cmd < 5; cmd++)
+    {
+        uint8_t payload[4] = {0x10, 0x20, 0x30, 0x40};
+        uint8_t legacy[Legacy::MAX_PACKET_SIZE];
+        uint8_t encoded[LightProtocol::MAX_PACKET_SIZE];
+        size_t legacySize = Legacy::encode(cmd, payload, payloadSizes[cmd], legacy);
+        size_t encodedSize = encodeTemplate(cmd, payload, encoded);
+        if (legacySize != encodedSize || memcmp(legacy, encoded, legacySize) != 0)
+        {
+            printf("Mismatch for command %d\n", cmd);
+            return 1;
+        }
+    }
+
+    printf("%ld iterations per encoder\n", iterations);
+    double legacyNs = measure("legacy memcpy encoder", iterations, [&](long i)
+                              {
+        uint8_t payload[4] = {(uint8_t)i, (uint8_t)(i >> 8), 0, 0};
+        uint8_t buffer[Legacy::MAX_PACKET_SIZE];
+        int cmd = i % 5;
+        size_t size = Legacy::encode(cmd, payload, payloadSizes[cmd], buffer);
+        return (uint32_t)buffer[LightProtocol::PAYLOAD_OFFSET] + size; });
+    double templateNs = measure("LightProtocol encodeInto", iterations, [&](long i)
+                                {
+        uint8_t payload[4] = {(uint8_t)i, (uint8_t)(i >> 8), 0, 0};
+        uint8_t buffer[LightProtocol::MAX_PACKET_SIZE];
+        size_t size = encodeTemplate(i % 5, payload, buffer);
+        return (uint32_t)buffer[LightProtocol::PAYLOAD_OFFSET] + size; });
+    measure("LightProtocol::Intensity", iterations, [&](long i)
+            {
+        const uint8_t payload[1] = {(uint8_t)i};
+        LightProtocol::Intensity::Packet packet = LightProtocol::Intensity::encode(payload);
+        return (uint32_t)packet[LightProtocol::PAYLOAD_OFFSET] + packet.size(); });
+
+    printf("speedup (runtime dispatch): %.2fx\n", legacyNs / templateNs);
+    return 0;
+}
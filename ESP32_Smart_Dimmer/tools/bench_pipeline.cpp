@@ -0,0 +1,300 @@
+// Host benchmark of the Bluetooth command pipeline against simulated lights.
+//
+// Runs the firmware's BtCommandPipeline (queue, shadow state, pacing, framing, ACKs) over a
+// PosixTransport to SimulatedLight peers on Unix sockets, keeps a window of commands in flight
+// and reports packets/s and command-to-ack latency percentiles.
+//
+// Build and run from ESP32_Smart_Dimmer/tools:
+//   g++ -std=c++17 -O2 -DBT_CAPTURE_RECORDS=65536 -I../src -Ihost -I../../libraries/LightProtocol/src
+//       bench_pipeline.cpp host/*.cpp ../src/BtCommandPipeline.cpp ../src/BtTxQueue.cpp ../src/BtRxFramer.cpp
+//       ../src/BtAckTracker.cpp ../src/BtLinkPool.cpp ../src/BtShadowState.cpp ../src/BtPacer.cpp
+//       ../src/BtScanCache.cpp ../src/BtCapture.cpp ../src/BtDeviceState.cpp
+//       ../src/BtReconnectManager.cpp -pthread -o bench_pipeline
+//   ./bench_pipeline [--lights 2] [--commands 500] [--window 8] [--delay 20] [--jitter 0]
+//                    [--loss 0] [--reorder 0] [--rate 0] [--sndbuf 0] [--urgent 0] [--capture run.bin]
+// --delay/--jitter are the lights' processing time in ms, --loss/--reorder fractions of commands,
+// --rate the bytes/s a light reads (0 = unlimited) and --sndbuf the transport's socket buffer; a slow
+// light behind a small buffer makes the pipeline see congestion. --urgent N sends every Nth command
+// with BtPriority::URGENT, like local input arriving during web traffic.
+#include "BtCommandPipeline.h"
+#include "BtScanCache.h"
+#include "CaptureFile.h"
+#include "PosixTransport.h"
+#include "SimulatedLight.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    size_t lights = 2;
+    size_t commands = 500;
+    size_t window = 8;
+    int sendBufferSize = 0;
+    size_t urgentEvery = 0;
+    const char *capturePath = nullptr;
+    SimulatedLightConfig light;
+};
+
+struct InFlight
+{
+    BtCompletion completion;
+    Clock::time_point sentAt;
+};
+
+static bool parseOptions(int argc, char **argv, Options &options)
+{
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        const char *name = argv[i];
+        const char *value = argv[i + 1];
+        if (strcmp(name, "--lights") == 0)
+            options.lights = atoi(value);
+        else if (strcmp(name, "--commands") == 0)
+            options.commands = atoi(value);
+        else if (strcmp(name, "--window") == 0)
+            options.window = atoi(value);
+        else if (strcmp(name, "--delay") == 0)
+            options.light.processingDelayMs = atoi(value);
+        else if (strcmp(name, "--jitter") == 0)
+            options.light.jitterMs = atoi(value);
+        else if (strcmp(name, "--loss") == 0)
+            options.light.lossRate = atof(value);
+        else if (strcmp(name, "--reorder") == 0)
+            options.light.reorderRate = atof(value);
+        else if (strcmp(name, "--rate") == 0)
+            options.light.readBytesPerSecond = atoi(value);
+        else if (strcmp(name, "--sndbuf") == 0)
+            options.sendBufferSize = atoi(value);
+        else if (strcmp(name, "--urgent") == 0)
+            options.urgentEvery = atoi(value);
+        else if (strcmp(name, "--capture") == 0)
+            options.capturePath = value;
+        else
+        {
+            printf("Unknown option %s\n", name);
+            return false;
+        }
+    }
+    if (options.lights == 0 || options.lights > BT_LINK_POOL_CAPACITY)
+    {
+        printf("--lights must be 1..%d\n", (int)BT_LINK_POOL_CAPACITY);
+        return false;
+    }
+    // Every tracked command needs an ACK slot and may sit in the TX queue
+    if (options.window == 0 || options.window > BT_TX_QUEUE_CAPACITY)
+    {
+        printf("--window must be 1..%d\n", (int)BT_TX_QUEUE_CAPACITY);
+        return false;
+    }
+    return true;
+}
+
+// Moves finished commands out of inFlight, recording their latency in ms
+static void collect(std::vector<InFlight> &inFlight, std::vector<double> &latencies, BtAckStats &results)
+{
+    Clock::time_point now = Clock::now();
+    for (size_t i = 0; i < inFlight.size();)
+    {
+        BtAckState state = inFlight[i].completion.state();
+        if (state == BtAckState::QUEUED || state == BtAckState::SENT)
+        {
+            i++;
+            continue;
+        }
+        if (state == BtAckState::ACKED)
+        {
+            results.acked++;
+            latencies.push_back(std::chrono::duration<double, std::milli>(now - inFlight[i].sentAt).count());
+        }
+        else if (state == BtAckState::TIMED_OUT)
+        {
+            results.timedOut++;
+        }
+        else
+        {
+            results.dropped++;
+        }
+        inFlight[i] = inFlight.back();
+        inFlight.pop_back();
+    }
+}
+
+static double percentile(std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        return 1;
+    }
+
+    char directory[] = "/tmp/bench_pipeline.XXXXXX";
+    if (!mkdtemp(directory))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<SimulatedLight>> lights;
+    std::vector<std::array<uint8_t, 6>> addresses;
+    for (size_t i = 0; i < options.lights; i++)
+    {
+        std::array<uint8_t, 6> address = {BT_LIGHT_OUI[0], BT_LIGHT_OUI[1], BT_LIGHT_OUI[2], 0x00, 0x00, (uint8_t)(i + 1)};
+        SimulatedLightConfig config = options.light;
+        config.seed += i;
+        lights.emplace_back(new SimulatedLight(directory, address.data(), config));
+        if (!lights.back()->start())
+        {
+            return 1;
+        }
+        addresses.push_back(address);
+    }
+
+    PosixTransport transport(directory, options.sendBufferSize);
+    BtCommandPipeline pipeline(transport, options.lights);
+    if (!pipeline.begin())
+    {
+        return 1;
+    }
+    std::thread writer(&BtCommandPipeline::runWriter, &pipeline);
+
+    for (const auto &address : addresses)
+    {
+        pipeline.connect(address.data());
+    }
+    Clock::time_point deadline = Clock::now() + std::chrono::seconds(5);
+    size_t connected = 0;
+    while (connected < addresses.size() && Clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        connected = std::count_if(addresses.begin(), addresses.end(), [&](const std::array<uint8_t, 6> &address)
+                                  { return pipeline.isConnected(address.data()); });
+    }
+    if (connected < addresses.size())
+    {
+        printf("Only %d of %d lights connected\n", (int)connected, (int)addresses.size());
+        return 1;
+    }
+
+    // Round robin over the lights and three commands, each send with a new value so the shadow state
+    // never filters it. A kind of command is only sent again once its last packet left the queue:
+    // otherwise it would coalesce into that packet instead of adding load.
+    const CommandType commands[] = {CMD_LIGHT_INTENSITY, CMD_LIGHT_WARMNESS, CMD_FAN_SPEED};
+    const size_t kinds = addresses.size() * 3;
+    std::vector<BtCompletion> lastSent(kinds);
+    std::vector<uint32_t> values(kinds, 0);
+    std::vector<InFlight> inFlight;
+    std::vector<double> latencies;
+    BtAckStats results = {};
+    size_t rejected = 0;
+
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < options.commands; i++)
+    {
+        size_t kind = i % kinds;
+        while (inFlight.size() >= options.window || lastSent[kind].state() == BtAckState::QUEUED)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            collect(inFlight, latencies, results);
+        }
+        const auto &address = addresses[kind % addresses.size()];
+        CommandType cmd = commands[kind / addresses.size()];
+        uint32_t value = ++values[kind];
+        uint8_t payload = cmd == CMD_FAN_SPEED ? value % 4 : value % 256;
+
+        bool urgent = options.urgentEvery && i % options.urgentEvery == 0;
+        BtCompletion completion = pipeline.send(address.data(), cmd, &payload, 1, urgent ? BtPriority::URGENT : BtPriority::NORMAL);
+        if (!completion.isValid())
+        {
+            rejected++;
+            continue;
+        }
+        lastSent[kind] = completion;
+        inFlight.push_back({completion, Clock::now()});
+    }
+    while (!inFlight.empty())
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        collect(inFlight, latencies, results);
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    BtTxStats tx = pipeline.getTxStats();
+    std::vector<BtLinkInfo> links = pipeline.getLinks();
+    std::vector<BtDeviceAckStats> devices = pipeline.getDeviceAckStats();
+    if (options.capturePath && !writeCaptureFile(options.capturePath, pipeline.getCapture()))
+    {
+        return 1;
+    }
+    pipeline.stop();
+    writer.join();
+    transport.stop();
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("%d lights, %d commands, window %d, delay %u+%u ms, loss %.2f, reorder %.2f, rate %u B/s\n",
+           (int)options.lights, (int)options.commands, (int)options.window, options.light.processingDelayMs,
+           options.light.jitterMs, options.light.lossRate, options.light.reorderRate, options.light.readBytesPerSecond);
+    printf("elapsed            %.2f s\n", elapsed);
+    printf("packets sent       %u (%.1f packets/s)\n", tx.sent, tx.sent / elapsed);
+    printf("acked              %u (%.1f commands/s)\n", results.acked, results.acked / elapsed);
+    printf("timed out          %u\n", results.timedOut);
+    printf("retransmits        %u\n", tx.retransmits);
+    printf("dropped            %u\n", results.dropped);
+    printf("rejected           %d\n", (int)rejected);
+    printf("coalesced          %u\n", tx.coalesced);
+    printf("ack latency p50    %.1f ms\n", percentile(latencies, 0.50));
+    printf("ack latency p99    %.1f ms\n", percentile(latencies, 0.99));
+    printf("ack latency max    %.1f ms\n", latencies.empty() ? 0.0 : latencies.back());
+    printf("send latency avg   %u ms (max %u ms)\n", tx.avgLatencyMs, tx.maxLatencyMs);
+    const char *laneNames[BT_PRIORITY_COUNT] = {"urgent", "normal"};
+    for (size_t lane = 0; lane < BT_PRIORITY_COUNT; lane++)
+    {
+        printf("%-6s lane wait  %u sent, max %u ms:", laneNames[lane], tx.lanes[lane].sent, tx.lanes[lane].maxWaitMs);
+        for (size_t i = 0; i < BT_TX_WAIT_BUCKETS; i++)
+        {
+            if (i + 1 < BT_TX_WAIT_BUCKETS)
+                printf(" <%u:%u", BT_TX_WAIT_BUCKET_MS[i], tx.lanes[lane].waitHistogram[i]);
+            else
+                printf(" more:%u", tx.lanes[lane].waitHistogram[i]);
+        }
+        printf("\n");
+    }
+    printf("starvation picks   %u\n", tx.starvationPicks);
+    for (const BtLinkInfo &link : links)
+    {
+        printf("link %02X: interval %u ms (floor %u ms), %u sent, %u congestions\n", link.address[5],
+               link.pacing.intervalMs, link.pacing.floorMs, link.pacing.sent, link.pacing.congestions);
+    }
+    for (const BtDeviceAckStats &device : devices)
+    {
+        printf("device %02X: %u sent, %u retransmits (%.1f%%), %u timed out, ACK timeout %u ms\n", device.address[5],
+               device.sent, device.retransmits, device.retransmitRate * 100, device.timedOut, device.timeoutMs);
+    }
+    for (size_t i = 0; i < lights.size(); i++)
+    {
+        SimulatedLightStats stats = lights[i]->getStats();
+        printf("light %02X: %u commands, %u lost, %u reordered, %u statuses, %u bytes skipped\n",
+               addresses[i][5], stats.commands, stats.lost, stats.reordered, stats.statuses, stats.skippedBytes);
+        lights[i]->stop();
+    }
+    rmdir(directory);
+    return 0;
+}
@@ -0,0 +1,99 @@
+# Prepares the web UI in data/ for the SPIFFS image: every asset gets a content hash (its ETag),
+# text assets are gzip'd, and the assets index.html links to are renamed to name.<hash>.ext so
+# the browser can cache them for good. The result goes to .pio/build/<env>/data together with
+# assets.txt, which the web server reads at startup (see WebServerModule::indexStaticFiles):
+#   <url> <stored file> <etag> <flags>    flags: g = gzip'd, i = immutable (hashed name)
+#
+# Run by PlatformIO before every build (extra_scripts in platformio.ini), so buildfs / uploadfs
+# pick up the processed copy instead of data/. It also runs on its own:
+#   python3 build_assets.py ../data /tmp/assets
+import gzip
+import hashlib
+import os
+import shutil
+import sys
+
+# Compressed on flash and sent with Content-Encoding: gzip
+GZIP_EXTENSIONS = (".html", ".htm", ".css", ".js", ".svg", ".json", ".xml")
+# SPIFFS file names, with the leading '/', are at most 31 characters
+SPIFFS_MAX_NAME = 31
+HASH_LENGTH = 8
+MANIFEST = "assets.txt"
+ENTRY_PAGE = "index.html"
+
+
+def content_hash(data):
+    return hashlib.sha256(data).hexdigest()[:HASH_LENGTH]
+
+
+def hashed_name(name, digest):
+    base, ext = os.path.splitext(name)
+    hashed = f"{base}.{digest}{ext}"
+    # Too long for SPIFFS: keeps its name and is revalidated with its ETag instead
+    return hashed if len("/" + hashed) + (3 if ext in GZIP_EXTENSIONS else 0) <= SPIFFS_MAX_NAME else name
+
+
+def build_assets(source_dir, output_dir):
+    if os.path.isdir(output_dir):
+        shutil.rmtree(output_dir)
+    os.makedirs(output_dir)
+
+    assets = {}
+    for name in sorted(os.listdir(source_dir)):
+        path = os.path.join(source_dir, name)
+        if os.path.isfile(path) and not name.startswith("."):
+            with open(path, "rb") as f:
+                assets[name] = f.read()
+
+    # The entry page keeps its name; what it links to is renamed, so a new build changes its links
+    renamed = {}
+    for name, data in assets.items():
+        if name != ENTRY_PAGE:
+            renamed[name] = hashed_name(name, content_hash(data))
+    if ENTRY_PAGE in assets:
+        page = assets[ENTRY_PAGE].decode("utf-8")
+        for name, new_name in renamed.items():
+            page = page.replace(f'"{name}"', f'"{new_name}"')
+        assets[ENTRY_PAGE] = page.encode("utf-8")
+
+    manifest = []
+    total_in = total_out = 0
+    for name, data in assets.items():
+        url_name = renamed.get(name, name)
+        flags = ""
+        stored_name = url_name
+        stored = data
+        if url_name.endswith(GZIP_EXTENSIONS):
+            # mtime=0 keeps the output the same from build to build
+            compressed = gzip.compress(data, compresslevel=9, mtime=0)
+            if len(compressed) < len(data):
+                stored_name += ".gz"
+                stored = compressed
+                flags += "g"
+        if url_name != name:
+            flags += "i"
+        with open(os.path.join(output_dir, stored_name), "wb") as f:
+            f.write(stored)
+        manifest.append(f"/{url_name} /{stored_name} {content_hash(data)} {flags or '-'}")
+        total_in += len(data)
+        total_out += len(stored)
+
+    with open(os.path.join(output_dir, MANIFEST), "w") as f:
+        f.write("\n".join(manifest) + "\n")
+    print(f"build_assets: {len(assets)} assets, {total_in} -> {total_out} bytes in {output_dir}")
+
+
+try:
+    Import("env")  # noqa: F821 (defined when PlatformIO runs the script)
+except NameError:
+    env = None
+
+if env is None:
+    if len(sys.argv) != 3:
+        print(f"usage: {sys.argv[0]} <data dir> <output dir>")
+        sys.exit(1)
+    build_assets(sys.argv[1], sys.argv[2])
+else:
+    output = os.path.join(env.subst("$BUILD_DIR"), "data")
+    build_assets(env.subst("$PROJECT_DATA_DIR"), output)
+    env.Replace(PROJECT_DATA_DIR=output)
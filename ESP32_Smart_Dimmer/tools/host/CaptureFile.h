@@ -0,0 +1,60 @@
+#ifndef CAPTURE_FILE_H
+#define CAPTURE_FILE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "BtCapture.h"
+
+// Reading and writing the capture files served by /capture (BtCaptureHeader, then records)
+
+inline bool readCaptureFile(const char *path, BtCaptureHeader &header, std::vector<BtCaptureRecord> &records)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        perror(path);
+        return false;
+    }
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+              header.magic == BT_CAPTURE_MAGIC &&
+              header.version == BT_CAPTURE_VERSION &&
+              header.recordSize == sizeof(BtCaptureRecord);
+    if (!ok)
+    {
+        fprintf(stderr, "%s: not a version %d capture file\n", path, BT_CAPTURE_VERSION);
+        fclose(file);
+        return false;
+    }
+    BtCaptureRecord record;
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        records.push_back(record);
+    }
+    fclose(file);
+    return true;
+}
+
+// Writes everything the capture holds
+inline bool writeCaptureFile(const char *path, BtCapture &capture)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file)
+    {
+        perror(path);
+        return false;
+    }
+    BtCaptureHeader header = capture.makeHeader();
+    fwrite(&header, sizeof(header), 1, file);
+    uint32_t from, end;
+    capture.range(from, end);
+    BtCaptureRecord chunk[16];
+    size_t count;
+    while ((count = capture.read(from, end, chunk, 16)) > 0)
+    {
+        fwrite(chunk, sizeof(BtCaptureRecord), count, file);
+    }
+    return fclose(file) == 0;
+}
+
+#endif // CAPTURE_FILE_H
@@ -0,0 +1,392 @@
+#include "PosixTransport.h"
+#include "BtPlatform.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// Same order of magnitude as an SPP DATA_IND
+const size_t READ_BUFFER_SIZE = 256;
+
+PosixTransport::PosixTransport(const std::string &directory, int sendBufferSize)
+    : directory(directory), sendBufferSize(sendBufferSize)
+{
+}
+
+PosixTransport::~PosixTransport()
+{
+    stop();
+}
+
+bool PosixTransport::begin(ITransportListener *listener)
+{
+    this->listener = listener;
+    if (pipe(wakePipe) != 0)
+    {
+        log_e("pipe: %s", strerror(errno));
+        return false;
+    }
+    fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(wakePipe[1], F_SETFL, O_NONBLOCK);
+    running = true;
+    ioThread = std::thread(&PosixTransport::run, this);
+    return true;
+}
+
+void PosixTransport::stop()
+{
+    if (!running)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    wake();
+    ioThread.join();
+    for (auto &entry : links)
+    {
+        ::close(entry.second.fd);
+    }
+    links.clear();
+    drained.notify_all();
+    ::close(wakePipe[0]);
+    ::close(wakePipe[1]);
+}
+
+void PosixTransport::wake()
+{
+    uint8_t byte = 0;
+    if (::write(wakePipe[1], &byte, 1) < 0 && errno != EAGAIN)
+    {
+        log_w("wake: %s", strerror(errno));
+    }
+}
+
+bool PosixTransport::open(const uint8_t address[6], uint8_t /* channel */)
+{
+    Request request = {RequestType::OPEN, {}, 0};
+    memcpy(request.address, address, sizeof(request.address));
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running)
+        {
+            return false;
+        }
+        requests.push_back(request);
+    }
+    wake();
+    return true;
+}
+
+bool PosixTransport::write(uint32_t handle, const uint8_t *data, size_t len)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = links.find(handle);
+        if (it == links.end())
+        {
+            return false;
+        }
+        it->second.pending.emplace_back(data, data + len);
+    }
+    wake();
+    return true;
+}
+
+void PosixTransport::flush(uint32_t handle)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    drained.wait(lock, [this, handle]
+                 {
+                     auto it = links.find(handle);
+                     return it == links.end() || it->second.pending.empty(); });
+}
+
+bool PosixTransport::close(uint32_t handle)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (links.find(handle) == links.end())
+        {
+            return false;
+        }
+        requests.push_back({RequestType::CLOSE, {}, handle});
+    }
+    wake();
+    return true;
+}
+
+int PosixTransport::openPath(const uint8_t address[6])
+{
+    char name[13];
+    snprintf(name, sizeof(name), "%02X%02X%02X%02X%02X%02X",
+             address[0], address[1], address[2], address[3], address[4], address[5]);
+    std::string path = directory + "/" + name;
+
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+    {
+        log_w("%s: %s", path.c_str(), strerror(errno));
+        return -1;
+    }
+
+    int fd = -1;
+    if (S_ISSOCK(info.st_mode))
+    {
+        struct sockaddr_un socketAddress = {};
+        socketAddress.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(socketAddress.sun_path))
+        {
+            log_w("%s: path too long for a socket", path.c_str());
+            return -1;
+        }
+        strcpy(socketAddress.sun_path, path.c_str());
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && sendBufferSize > 0)
+        {
+            setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sendBufferSize, sizeof(sendBufferSize));
+        }
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&socketAddress, sizeof(socketAddress)) != 0)
+        {
+            log_w("%s: %s", path.c_str(), strerror(errno));
+            ::close(fd);
+            return -1;
+        }
+    }
+    else if (S_ISCHR(info.st_mode))
+    {
+        fd = ::open(path.c_str(), O_RDWR | O_NOCTTY);
+        struct termios tty;
+        if (fd >= 0 && tcgetattr(fd, &tty) == 0)
+        {
+            cfmakeraw(&tty);
+            tcsetattr(fd, TCSANOW, &tty);
+        }
+    }
+    else
+    {
+        log_w("%s is neither a socket nor a character device", path.c_str());
+        return -1;
+    }
+
+    if (fd < 0)
+    {
+        log_w("%s: %s", path.c_str(), strerror(errno));
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+void PosixTransport::handleRequests()
+{
+    std::vector<Request> batch;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        batch.swap(requests);
+    }
+    for (const Request &request : batch)
+    {
+        if (request.type == RequestType::CLOSE)
+        {
+            closeLink(request.handle);
+            continue;
+        }
+        int fd = openPath(request.address);
+        if (fd < 0)
+        {
+            listener->onTransportOpen(request.address, 0, 0, false);
+            continue;
+        }
+        struct stat info;
+        fstat(fd, &info);
+        uint32_t handle;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            handle = nextHandle++;
+            Link &link = links[handle];
+            link.fd = fd;
+            link.isSocket = S_ISSOCK(info.st_mode);
+        }
+        listener->onTransportOpen(request.address, handle, 1, true);
+    }
+}
+
+void PosixTransport::closeLink(uint32_t handle)
+{
+    bool lostWrite;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = links.find(handle);
+        if (it == links.end())
+        {
+            return;
+        }
+        ::close(it->second.fd);
+        lostWrite = !it->second.pending.empty();
+        links.erase(it);
+    }
+    drained.notify_all();
+    if (lostWrite)
+    {
+        listener->onTransportWriteComplete(handle, false, false);
+    }
+    listener->onTransportClose(handle);
+}
+
+// Writes as much as the kernel takes. A full buffer is reported as congestion, like ESP_SPP_CONG_EVT.
+void PosixTransport::flushLink(uint32_t handle)
+{
+    size_t completed = 0;
+    bool congestionChanged = false;
+    bool congested = false;
+    bool failed = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = links.find(handle);
+        if (it == links.end())
+        {
+            return;
+        }
+        Link &link = it->second;
+        while (!link.pending.empty())
+        {
+            const std::vector<uint8_t> &front = link.pending.front();
+            ssize_t written = link.isSocket
+                                  ? send(link.fd, front.data() + link.frontOffset, front.size() - link.frontOffset, MSG_NOSIGNAL)
+                                  : ::write(link.fd, front.data() + link.frontOffset, front.size() - link.frontOffset);
+            if (written < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    break;
+                }
+                log_w("write: %s", strerror(errno));
+                failed = true;
+                break;
+            }
+            link.frontOffset += written;
+            if (link.frontOffset == front.size())
+            {
+                link.pending.pop_front();
+                link.frontOffset = 0;
+                completed++;
+            }
+        }
+        congested = !failed && !link.pending.empty();
+        congestionChanged = congested != link.congested;
+        link.congested = congested;
+    }
+    drained.notify_all();
+
+    if (failed)
+    {
+        closeLink(handle);
+        return;
+    }
+    for (size_t i = 0; i < completed; i++)
+    {
+        listener->onTransportWriteComplete(handle, true, congested && i + 1 == completed);
+    }
+    if (congestionChanged)
+    {
+        listener->onTransportCongestion(handle, congested);
+    }
+}
+
+void PosixTransport::readLink(uint32_t handle)
+{
+    int fd;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = links.find(handle);
+        if (it == links.end())
+        {
+            return;
+        }
+        fd = it->second.fd;
+    }
+    uint8_t buffer[READ_BUFFER_SIZE];
+    ssize_t len = ::read(fd, buffer, sizeof(buffer));
+    if (len > 0)
+    {
+        listener->onTransportData(handle, buffer, len);
+    }
+    else if (len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+    {
+        // Peer went away (EIO on a pty whose other side was closed)
+        closeLink(handle);
+    }
+}
+
+void PosixTransport::run()
+{
+    std::vector<struct pollfd> fds;
+    std::vector<uint32_t> handles;
+    std::vector<bool> tryWrite;
+    while (true)
+    {
+        fds.clear();
+        handles.clear();
+        tryWrite.clear();
+        fds.push_back({wakePipe[0], POLLIN, 0});
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!running)
+            {
+                return;
+            }
+            for (const auto &entry : links)
+            {
+                short events = POLLIN;
+                if (!entry.second.pending.empty())
+                {
+                    events |= POLLOUT;
+                }
+                fds.push_back({entry.second.fd, events, 0});
+                handles.push_back(entry.first);
+                // New writes are tried at once, so a full buffer shows up as EAGAIN (congestion)
+                // instead of as a missing POLLOUT
+                tryWrite.push_back(!entry.second.pending.empty() && !entry.second.congested);
+            }
+        }
+
+        bool anyWrite = std::find(tryWrite.begin(), tryWrite.end(), true) != tryWrite.end();
+        if (poll(fds.data(), fds.size(), anyWrite ? 0 : -1) < 0)
+        {
+            if (errno != EINTR)
+            {
+                log_e("poll: %s", strerror(errno));
+            }
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            uint8_t drain[64];
+            while (::read(wakePipe[0], drain, sizeof(drain)) > 0)
+            {
+            }
+        }
+        for (size_t i = 1; i < fds.size(); i++)
+        {
+            if ((fds[i].revents & POLLOUT) || tryWrite[i - 1])
+            {
+                flushLink(handles[i - 1]);
+            }
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                readLink(handles[i - 1]);
+            }
+        }
+        handleRequests();
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef POSIX_TRANSPORT_H
+#define POSIX_TRANSPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ITransport.h"
+
+/**
+ * ITransport for host builds. A light with address AA:BB:CC:DD:EE:FF is the file AABBCCDDEEFF in
+ * the transport's directory: a Unix stream socket is connected, a character device (e.g. a pty
+ * symlinked there by socat) is opened raw. The channel is ignored and reported back as 1.
+ *
+ * All I/O and every listener call happen on one thread, like the Bluetooth task on the ESP32,
+ * so open, write and close never call back into the listener directly.
+ *
+ * Host builds compile the pipeline sources from src/ next to this file, e.g. from ESP32_Smart_Dimmer:
+ *   g++ -std=c++17 -Isrc -Itools/host -I../libraries/LightProtocol/src <tool>.cpp src/Bt*.cpp
+ *       tools/host/PosixTransport.cpp -pthread
+ * (src/BtScanCache.cpp is not needed but compiles too; BtPlatform.h supplies millis and log_x.)
+ */
+class PosixTransport : public ITransport
+{
+public:
+    // sendBufferSize sets SO_SNDBUF of socket links (0 = kernel default); a small one makes a slow
+    // peer show up as congestion after a few packets, like the SPP stack's buffers
+    explicit PosixTransport(const std::string &directory, int sendBufferSize = 0);
+    ~PosixTransport();
+
+    bool begin(ITransportListener *listener) override;
+    bool open(const uint8_t address[6], uint8_t channel) override;
+    bool write(uint32_t handle, const uint8_t *data, size_t len) override;
+    void flush(uint32_t handle) override;
+    bool close(uint32_t handle) override;
+    // Closes every link and stops the I/O thread
+    void stop();
+
+private:
+    enum class RequestType : uint8_t
+    {
+        OPEN,
+        CLOSE,
+    };
+
+    struct Request
+    {
+        RequestType type;
+        uint8_t address[6];
+        uint32_t handle;
+    };
+
+    struct Link
+    {
+        int fd;
+        bool isSocket;
+        // Writes not yet accepted by the kernel, oldest first; the front one may be partly written
+        std::deque<std::vector<uint8_t>> pending;
+        size_t frontOffset = 0;
+        bool congested = false;
+    };
+
+    std::string directory;
+    int sendBufferSize;
+    ITransportListener *listener = nullptr;
+    std::thread ioThread;
+    int wakePipe[2] = {-1, -1};
+    bool running = false;
+
+    // Guards requests, links and nextHandle
+    std::mutex mutex;
+    std::condition_variable drained;
+    std::vector<Request> requests;
+    std::map<uint32_t, Link> links;
+    uint32_t nextHandle = 1;
+
+    void wake();
+    void run();
+    void handleRequests();
+    int openPath(const uint8_t address[6]);
+    void closeLink(uint32_t handle);
+    void flushLink(uint32_t handle);
+    void readLink(uint32_t handle);
+};
+
+#endif // POSIX_TRANSPORT_H
@@ -0,0 +1,399 @@
+#include "SimulatedLight.h"
+#include "BtPlatform.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// A held back status packet is sent after this long even if no other one follows
+const uint32_t REORDER_HOLD_MAX_MS = 100;
+const size_t READ_CHUNK_SIZE = 256;
+
+// Command packet templates, in CommandType order
+struct CommandTemplate
+{
+    CommandType cmd;
+    const uint8_t *packet;
+    size_t payloadSize;
+};
+
+template <typename Cmd>
+static CommandTemplate makeCommandTemplate(CommandType cmd)
+{
+    return {cmd, Cmd::TEMPLATE.data(), Cmd::PAYLOAD_SIZE};
+}
+
+static const CommandTemplate COMMANDS[] = {
+    makeCommandTemplate<LightProtocol::OnOff>(CMD_LIGHT_ON_OFF),
+    makeCommandTemplate<LightProtocol::Intensity>(CMD_LIGHT_INTENSITY),
+    makeCommandTemplate<LightProtocol::Warmness>(CMD_LIGHT_WARMNESS),
+    makeCommandTemplate<LightProtocol::Rgb>(CMD_RGB),
+    makeCommandTemplate<LightProtocol::FanSpeed>(CMD_FAN_SPEED),
+};
+
+SimulatedLight::SimulatedLight(const std::string &directory, const uint8_t address[6], const SimulatedLightConfig &config)
+    : config(config), random(config.seed)
+{
+    memcpy(this->address, address, sizeof(this->address));
+    char name[13];
+    snprintf(name, sizeof(name), "%02X%02X%02X%02X%02X%02X",
+             address[0], address[1], address[2], address[3], address[4], address[5]);
+    path = directory + "/" + name;
+}
+
+SimulatedLight::~SimulatedLight()
+{
+    stop();
+}
+
+bool SimulatedLight::start()
+{
+    struct sockaddr_un socketAddress = {};
+    socketAddress.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(socketAddress.sun_path))
+    {
+        log_e("%s: path too long for a socket", path.c_str());
+        return false;
+    }
+    strcpy(socketAddress.sun_path, path.c_str());
+    unlink(path.c_str());
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0 ||
+        bind(listenFd, (struct sockaddr *)&socketAddress, sizeof(socketAddress)) != 0 ||
+        listen(listenFd, 1) != 0 ||
+        pipe(stopPipe) != 0)
+    {
+        log_e("%s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    running = true;
+    thread = std::thread(&SimulatedLight::run, this);
+    return true;
+}
+
+void SimulatedLight::stop()
+{
+    if (!running)
+    {
+        return;
+    }
+    running = false;
+    if (::write(stopPipe[1], "x", 1) < 0)
+    {
+        log_w("stop: %s", strerror(errno));
+    }
+    thread.join();
+    closeClient();
+    ::close(listenFd);
+    ::close(stopPipe[0]);
+    ::close(stopPipe[1]);
+    unlink(path.c_str());
+}
+
+SimulatedLightStats SimulatedLight::getStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+bool SimulatedLight::isOn()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return on;
+}
+
+uint8_t SimulatedLight::getIntensity()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return intensity;
+}
+
+uint8_t SimulatedLight::getWarmness()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return warmness;
+}
+
+uint8_t SimulatedLight::getFanSpeed()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return fanSpeed;
+}
+
+void SimulatedLight::acceptClient()
+{
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0)
+    {
+        return;
+    }
+    if (clientFd >= 0)
+    {
+        // One link at a time, like the real lights
+        ::close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    clientFd = fd;
+    rxBuffer.clear();
+    scheduled.clear();
+    hasHeld = false;
+    readTokens = 0;
+    lastRefillMs = btMillis();
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.connections++;
+}
+
+void SimulatedLight::closeClient()
+{
+    if (clientFd >= 0)
+    {
+        ::close(clientFd);
+        clientFd = -1;
+    }
+}
+
+void SimulatedLight::readCommands(uint32_t nowMs)
+{
+    size_t budget = READ_CHUNK_SIZE;
+    if (config.readBytesPerSecond > 0)
+    {
+        // Token bucket holding at most one chunk, so a slow light leaves the rest in the socket
+        readTokens += (double)(nowMs - lastRefillMs) * config.readBytesPerSecond / 1000.0;
+        lastRefillMs = nowMs;
+        if (readTokens > READ_CHUNK_SIZE)
+        {
+            readTokens = READ_CHUNK_SIZE;
+        }
+        budget = (size_t)readTokens;
+        if (budget == 0)
+        {
+            return;
+        }
+    }
+
+    uint8_t buffer[READ_CHUNK_SIZE];
+    ssize_t len = ::read(clientFd, buffer, budget);
+    if (len > 0)
+    {
+        readTokens -= len;
+        rxBuffer.insert(rxBuffer.end(), buffer, buffer + len);
+        parseCommands(nowMs);
+    }
+    else if (len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+    {
+        closeClient();
+    }
+}
+
+// Returns the size of the command packet at data, 0 if more bytes are needed, or SIZE_MAX if
+// data does not start a valid command
+size_t SimulatedLight::matchCommand(const uint8_t *data, size_t len, uint32_t nowMs)
+{
+    for (const CommandTemplate &command : COMMANDS)
+    {
+        size_t packetSize = LightProtocol::PAYLOAD_OFFSET + command.payloadSize + LightProtocol::SUFFIX_SIZE;
+        size_t compare = len < LightProtocol::PAYLOAD_OFFSET ? len : LightProtocol::PAYLOAD_OFFSET;
+        if (memcmp(data, command.packet, compare) != 0)
+        {
+            continue;
+        }
+        if (len < packetSize)
+        {
+            return 0;
+        }
+        if (memcmp(data + packetSize - LightProtocol::SUFFIX_SIZE, command.packet + packetSize - LightProtocol::SUFFIX_SIZE,
+                   LightProtocol::SUFFIX_SIZE) != 0)
+        {
+            continue;
+        }
+        apply(command.cmd, data + LightProtocol::PAYLOAD_OFFSET, nowMs);
+        return packetSize;
+    }
+    return SIZE_MAX;
+}
+
+void SimulatedLight::parseCommands(uint32_t nowMs)
+{
+    size_t offset = 0;
+    while (offset < rxBuffer.size())
+    {
+        size_t consumed = matchCommand(rxBuffer.data() + offset, rxBuffer.size() - offset, nowMs);
+        if (consumed == 0)
+        {
+            break;
+        }
+        if (consumed == SIZE_MAX)
+        {
+            // Resync one byte at a time, like BtRxFramer
+            std::lock_guard<std::mutex> lock(mutex);
+            stats.skippedBytes++;
+            consumed = 1;
+        }
+        offset += consumed;
+    }
+    rxBuffer.erase(rxBuffer.begin(), rxBuffer.begin() + offset);
+}
+
+void SimulatedLight::apply(CommandType cmd, const uint8_t *payload, uint32_t nowMs)
+{
+    std::uniform_real_distribution<double> chance(0, 1);
+    Status status = {};
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.commands++;
+        if (chance(random) < config.lossRate)
+        {
+            stats.lost++;
+            return;
+        }
+
+        switch (cmd)
+        {
+        case CMD_LIGHT_ON_OFF:
+            on = payload[0] == LightProtocol::LIGHT_ON;
+            break;
+        case CMD_LIGHT_INTENSITY:
+            intensity = payload[0];
+            break;
+        case CMD_LIGHT_WARMNESS:
+            warmness = payload[0];
+            break;
+        case CMD_RGB:
+            memcpy(rgb, payload, sizeof(rgb));
+            break;
+        case CMD_FAN_SPEED:
+            fanSpeed = payload[0];
+            break;
+        default:
+            break;
+        }
+        // Fan statuses carry the fan speed, light statuses the power state (see BtDeviceState.h)
+        uint8_t state = cmd == CMD_FAN_SPEED ? fanSpeed : (on ? LightProtocol::LIGHT_ON : LightProtocol::LIGHT_OFF);
+
+        // Same framing as the sent packets; BtRxFramer only looks at the header bytes
+        memcpy(status.data, LightProtocol::PREFIX, 4);
+        status.data[RX_PACKET_HEADER_BYTE4_IDX] = RX_PACKET_HEADER_BYTE4;
+        status.data[RX_PACKET_HEADER_BYTE5_IDX] = RX_PACKET_HEADER_BYTE5;
+        status.data[RX_PACKET_FUNCTION_BYTE_IDX] = rxFunctionForCommand(cmd);
+        status.data[RX_PACKET_FAN_STATE_BYTE_IDX] = state;
+    }
+
+    uint32_t delay = config.processingDelayMs;
+    if (config.jitterMs > 0)
+    {
+        delay += std::uniform_int_distribution<uint32_t>(0, config.jitterMs)(random);
+    }
+    scheduled.emplace(nowMs + delay, status);
+}
+
+void SimulatedLight::sendStatus(const Status &status)
+{
+    if (clientFd < 0)
+    {
+        return;
+    }
+    // Status packets are small; a full socket means the other side stopped reading
+    if (send(clientFd, status.data, sizeof(status.data), MSG_NOSIGNAL) != (ssize_t)sizeof(status.data))
+    {
+        log_w("%s: status packet not sent", path.c_str());
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.statuses++;
+}
+
+void SimulatedLight::sendDue(uint32_t nowMs)
+{
+    std::uniform_real_distribution<double> chance(0, 1);
+    while (!scheduled.empty() && (int32_t)(nowMs - scheduled.begin()->first) >= 0)
+    {
+        Status status = scheduled.begin()->second;
+        scheduled.erase(scheduled.begin());
+        if (hasHeld)
+        {
+            sendStatus(status);
+            sendStatus(held);
+            hasHeld = false;
+        }
+        else if (chance(random) < config.reorderRate)
+        {
+            held = status;
+            hasHeld = true;
+            heldSinceMs = nowMs;
+            std::lock_guard<std::mutex> lock(mutex);
+            stats.reordered++;
+        }
+        else
+        {
+            sendStatus(status);
+        }
+    }
+    if (hasHeld && nowMs - heldSinceMs >= REORDER_HOLD_MAX_MS)
+    {
+        sendStatus(held);
+        hasHeld = false;
+    }
+}
+
+int SimulatedLight::pollTimeout(uint32_t nowMs)
+{
+    int timeout = -1;
+    if (!scheduled.empty())
+    {
+        int32_t due = (int32_t)(scheduled.begin()->first - nowMs);
+        timeout = due > 0 ? due : 0;
+    }
+    if (hasHeld)
+    {
+        int32_t due = (int32_t)(heldSinceMs + REORDER_HOLD_MAX_MS - nowMs);
+        due = due > 0 ? due : 0;
+        timeout = timeout < 0 || due < timeout ? due : timeout;
+    }
+    if (clientFd >= 0 && config.readBytesPerSecond > 0 && readTokens < 1)
+    {
+        // Wake up when the next byte may be read
+        int refill = (int)(1000 / config.readBytesPerSecond) + 1;
+        timeout = timeout < 0 || refill < timeout ? refill : timeout;
+    }
+    return timeout;
+}
+
+void SimulatedLight::run()
+{
+    while (running)
+    {
+        uint32_t now = btMillis();
+        bool throttled = config.readBytesPerSecond > 0 && readTokens < 1;
+        struct pollfd fds[3] = {
+            {stopPipe[0], POLLIN, 0},
+            {listenFd, POLLIN, 0},
+            {clientFd, (short)(throttled ? 0 : POLLIN), 0},
+        };
+        int count = clientFd >= 0 ? 3 : 2;
+        if (poll(fds, count, pollTimeout(now)) < 0 && errno != EINTR)
+        {
+            log_e("poll: %s", strerror(errno));
+            return;
+        }
+
+        now = btMillis();
+        if (fds[1].revents & POLLIN)
+        {
+            acceptClient();
+        }
+        if (clientFd >= 0 && count == 3 && (fds[2].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            readCommands(now);
+        }
+        else if (clientFd >= 0 && throttled)
+        {
+            readCommands(now); // refills the bucket
+        }
+        sendDue(now);
+    }
+}
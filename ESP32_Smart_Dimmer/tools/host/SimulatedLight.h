@@ -0,0 +1,105 @@
+#ifndef SIMULATED_LIGHT_H
+#define SIMULATED_LIGHT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <LightProtocol.h>
+#include "BtRxFramer.h"
+
+struct SimulatedLightConfig
+{
+    uint32_t processingDelayMs = 20; // command received -> status packet sent
+    uint32_t jitterMs = 0;           // uniform extra delay on top of processingDelayMs
+    double lossRate = 0;             // commands silently ignored (no status packet)
+    double reorderRate = 0;          // status packets held back and sent after the next one
+    uint32_t readBytesPerSecond = 0; // how fast commands are taken off the link, 0 = at once
+    uint32_t seed = 1;
+};
+
+struct SimulatedLightStats
+{
+    uint32_t connections;
+    uint32_t commands;     // complete, valid command packets received
+    uint32_t lost;         // commands dropped because of lossRate
+    uint32_t reordered;    // status packets held back because of reorderRate
+    uint32_t statuses;     // status packets sent
+    uint32_t skippedBytes; // bytes that were not part of a valid command
+};
+
+/**
+ * A light on the other end of a PosixTransport link. It listens on the Unix socket
+ * <directory>/<MAC without colons>, parses the LightProtocol command packets, applies them to
+ * its state and answers each with a 24 byte status packet, after a configurable delay.
+ * Loss, reordering and a slow reader (to fill the link and make the sender see congestion)
+ * can be switched on in the config.
+ */
+class SimulatedLight
+{
+public:
+    SimulatedLight(const std::string &directory, const uint8_t address[6], const SimulatedLightConfig &config);
+    ~SimulatedLight();
+
+    bool start();
+    void stop();
+
+    SimulatedLightStats getStats();
+    bool isOn();
+    uint8_t getIntensity();
+    uint8_t getWarmness();
+    uint8_t getFanSpeed();
+
+private:
+    struct Status
+    {
+        uint8_t data[RX_PACKET_SIZE];
+    };
+
+    std::string path;
+    uint8_t address[6];
+    SimulatedLightConfig config;
+    std::mt19937 random;
+
+    std::thread thread;
+    std::atomic<bool> running{false};
+    int listenFd = -1;
+    int clientFd = -1;
+    int stopPipe[2] = {-1, -1};
+
+    // Guards the light's state and stats (read by the benchmark while the thread runs)
+    std::mutex mutex;
+    bool on = false;
+    uint8_t intensity = 0;
+    uint8_t warmness = 0;
+    uint8_t rgb[4] = {0, 0, 0, 0};
+    uint8_t fanSpeed = 0;
+    SimulatedLightStats stats = {};
+
+    std::vector<uint8_t> rxBuffer;
+    // Status packets by the time (ms) they are due
+    std::multimap<uint32_t, Status> scheduled;
+    bool hasHeld = false;
+    Status held;
+    uint32_t heldSinceMs = 0;
+    double readTokens = 0;
+    uint32_t lastRefillMs = 0;
+
+    void run();
+    void acceptClient();
+    void closeClient();
+    void readCommands(uint32_t nowMs);
+    void parseCommands(uint32_t nowMs);
+    size_t matchCommand(const uint8_t *data, size_t len, uint32_t nowMs);
+    void apply(CommandType cmd, const uint8_t *payload, uint32_t nowMs);
+    void sendDue(uint32_t nowMs);
+    void sendStatus(const Status &status);
+    int pollTimeout(uint32_t nowMs);
+};
+
+#endif // SIMULATED_LIGHT_H
@@ -3,14 +3,23 @@ import socketserver
 import json
 import time
 import os
+import struct
 from urllib.parse import urlparse, parse_qs
 
 PORT = 8080 # You can change this port if 8080 is already in use
 DEVICE_DISCOVERY_PATH = "/discover_devices" # This will now simulate BT scanning results
 CONTROL_PATH_PREFIX = "/control?"
+CONTROL_STATUS_PATH_PREFIX = "/control_status?" # The mock applies a control at once, so every job is "applied"
 GET_ALL_DEVICES_PATH = "/get_all_devices" # Returns configured devices (from registered_devices)
 ADD_DEVICE_PATH_PREFIX = "/add_device?" # Adds a new device to registered_devices
 REMOVE_DEVICE_PATH_PREFIX = "/remove_device?" # Removes a device from registered_devices
+CAPTURE_PATH = "/capture" # Binary Bluetooth capture; the mock has no Bluetooth, so it is always empty
+BT_STATS_PATH = "/bt_stats" # TX queue and retransmit stats; idle, since the mock has no Bluetooth
+EVENTS_PATH = "/events" # Device state stream; the mock sends one snapshot per connection (the browser reconnects)
+SCENE_PATH = "/scene" # POST: sets many devices at once; the mock applies them all and reports each "ok"
+
+# BtCaptureHeader: magic "BCAP", version, record size, records overwritten, reserved
+CAPTURE_HEADER = struct.pack("<IHHII", 0x50414342, 1, 48, 0, 0)
 
 
 # Simulated Bluetooth discovered devices (these do NOT have control parameters initially)
@@ -32,6 +41,12 @@ mock_discovered_devices = [
     }
 ]
 
+# Simulated background discovery: a refresh "finds" one more device every second for 4 seconds
+DISCOVERY_DURATION_S = 4
+discovery_started_at = None
+# Id of the next /control job
+next_control_job = 1
+
 # This dictionary will simulate the 'StorageHandler's allManagedDevices map
 # Key: MAC address (String), Value: Dictionary representing DeviceConfig
 # Start with an empty set, or pre-populate some for initial testing
@@ -76,30 +91,32 @@ class CustomHandler(http.server.SimpleHTTPRequestHandler):
 
     def do_GET(self):
         # /discover_devices: Simulate Bluetooth scan results
-        if self.path == DEVICE_DISCOVERY_PATH:
-            time.sleep(4) # simulate 4 seconds search time
+        if self.path.startswith(DEVICE_DISCOVERY_PATH):
+            global discovery_started_at
+            query = parse_qs(urlparse(self.path).query)
+            if "refresh" in query or discovery_started_at is None:
+                discovery_started_at = time.time()
+            elapsed = time.time() - discovery_started_at
+            scanning = elapsed < DISCOVERY_DURATION_S
+            found = mock_discovered_devices[:int(elapsed) + 1] if scanning else mock_discovered_devices
+
             self.send_response(200)
             self.send_header('Content-type', 'application/json')
             self.send_header('Access-Control-Allow-Origin', '*') # Allow CORS for your HTML page
             self.end_headers()
             # Add 'is_configured' flag to mock discovered devices based on registered_devices
             response_devices = []
-            for device in mock_discovered_devices:
+            for device in found:
                 device_copy = device.copy() # Avoid modifying the original mock_discovered_devices
+                device_copy["last_seen_ms"] = 0
                 device_copy["is_configured"] = device_copy["mac_address"] in registered_devices
                 response_devices.append(device_copy)
 
-            self.wfile.write(json.dumps(response_devices).encode('utf-8'))
-            print(f"[{time.ctime()}] Responded to {self.path} with {len(response_devices)} discovered devices (incl. configured status).")
+            self.wfile.write(json.dumps({"scanning": scanning, "devices": response_devices}).encode('utf-8'))
+            print(f"[{time.ctime()}] Responded to {self.path} with {len(response_devices)} discovered devices (scanning: {scanning}).")
 
         # /control?: Simulate controlling a specific device
         elif self.path.startswith(CONTROL_PATH_PREFIX):
-            time.sleep(1) # simulate 1 second round-trip time
-            self.send_response(200)
-            self.send_header('Content-type', 'text/plain')
-            self.send_header('Access-Control-Allow-Origin', '*') # Allow CORS
-            self.end_headers()
-
             query_string = urlparse(self.path).query
             params = parse_qs(query_string)
 
@@ -119,9 +136,9 @@ class CustomHandler(http.server.SimpleHTTPRequestHandler):
                     device_config['main_brightness'] = int(params['brightness'][0])
                 if 'mode' in params:
                     if (lightMode == "off"):
-                        device_config['is_on'] = "false"
+                        device_config['is_on'] = False
                     else:
-                        device_config['is_on'] = "true"
+                        device_config['is_on'] = True
                         device_config['light_mode'] = lightMode
                 if 'fan_speed' in params:
                     device_config['fan_speed'] = int(params['fan_speed'][0])
@@ -132,11 +149,32 @@ class CustomHandler(http.server.SimpleHTTPRequestHandler):
                 if 'rgb_brightness' in params:
                     device_config['ring_brightness'] = int(params['rgb_brightness'][0])
                 
+                global next_control_job
+                job = {"job": next_control_job, "address": address, "status": "applied", "elapsed_ms": 0}
+                next_control_job += 1
+                self.send_response(202)
+                self.send_header('Content-type', 'application/json')
+                self.send_header('Location', f"/control_status?job={job['job']}")
+                self.send_header('Access-Control-Allow-Origin', '*') # Allow CORS
+                self.end_headers()
                 print(log_message + f"  Updated state for {address}: {device_config}")
-                self.wfile.write(b"OK")
+                self.wfile.write(json.dumps(job).encode('utf-8'))
             else:
+                self.send_response(404)
+                self.send_header('Content-type', 'text/plain')
+                self.end_headers()
                 print(log_message + f"  Error: Device {address} not found in registered devices.")
-                self.wfile.write(b"ERROR: Device not found.")
+                self.wfile.write(b"Error: Device not found.")
+
+        elif self.path.startswith(CONTROL_STATUS_PATH_PREFIX):
+            job = int(parse_qs(urlparse(self.path).query).get('job', ['0'])[0])
+            if 0 < job < next_control_job:
+                self.send_response(200)
+                self.send_header('Content-type', 'application/json')
+                self.end_headers()
+                self.wfile.write(json.dumps({"job": job, "address": "", "status": "applied", "elapsed_ms": 0}).encode('utf-8'))
+            else:
+                self.send_error(404)
 
         # /get_all_devices: Return all registered (configured) devices
         elif self.path == GET_ALL_DEVICES_PATH:
@@ -147,9 +185,25 @@ class CustomHandler(http.server.SimpleHTTPRequestHandler):
             
             # Convert the dictionary values to a list for JSON array response
             # devices_list = list(registered_devices.values())
-            self.wfile.write(json.dumps(registered_devices).encode('utf-8'))
+            # Sorted by MAC like the ESP32's map; "index" numbers the device in /ws control frames.
+            # The mock has no WebSocket, so the page falls back to /control.
+            devices = {mac: dict(registered_devices[mac], index=i) for i, mac in enumerate(sorted(registered_devices))}
+            self.wfile.write(json.dumps(devices).encode('utf-8'))
             print(f"[{time.ctime()}] Responded to {self.path} with {len(registered_devices)} registered devices.")
 
+        # /events: Server-Sent Events. The ESP32 keeps the stream open and pushes changes; the
+        # single-threaded mock closes it after the snapshot and asks the browser to come back soon.
+        elif self.path == EVENTS_PATH:
+            self.send_response(200)
+            self.send_header('Content-type', 'text/event-stream')
+            self.send_header('Cache-Control', 'no-cache')
+            self.send_header('Access-Control-Allow-Origin', '*')
+            self.end_headers()
+            version = int(time.time() * 1000) # only has to grow, like the ESP32's state version
+            devices = {mac: dict(registered_devices[mac], index=i) for i, mac in enumerate(sorted(registered_devices))}
+            snapshot = json.dumps({"version": version, "devices": devices})
+            self.wfile.write(f"retry: 2000\nid: {version}\nevent: snapshot\ndata: {snapshot}\n\n".encode('utf-8'))
+
         # /add_device?: Register a new device with default settings
         elif self.path.startswith(ADD_DEVICE_PATH_PREFIX):
             self.send_response(200)
@@ -188,6 +242,35 @@ class CustomHandler(http.server.SimpleHTTPRequestHandler):
                 response_msg = "Error: Missing 'name' or 'address' parameters for add_device."
                 print(f"[{time.ctime()}] {response_msg}")
                 self.wfile.write(response_msg.encode('utf-8'))
+        elif self.path.startswith(CAPTURE_PATH):
+            self.send_response(200)
+            if "?" in self.path:
+                self.send_header('Content-type', 'text/plain')
+                self.end_headers()
+                self.wfile.write(b"OK")
+            else:
+                self.send_header('Content-type', 'application/octet-stream')
+                self.send_header('Content-Disposition', 'attachment; filename="bt_capture.bin"')
+                self.end_headers()
+                self.wfile.write(CAPTURE_HEADER)
+        elif self.path == BT_STATS_PATH:
+            self.send_response(200)
+            self.send_header('Content-type', 'application/json')
+            self.send_header('Access-Control-Allow-Origin', '*')
+            self.end_headers()
+            buckets = [10, 20, 50, 100, 200, 500, 1000]
+            lane = lambda capacity: {"depth": 0, "capacity": capacity, "sent": 0, "max_wait_ms": 0,
+                                     "wait_histogram": [0] * (len(buckets) + 1)}
+            stats = {
+                "tx": {"depth": 0, "sent": 0, "coalesced": 0, "rejected": 0, "dropped": 0, "retransmits": 0,
+                       "promoted": 0, "starvation_picks": 0, "wait_buckets_ms": buckets,
+                       "lanes": {"urgent": lane(8), "normal": lane(16)}},
+                "devices": [],
+                "reconnect": {"reconnects": 0, "reconnected": 0, "gave_up": 0, "preconnects": 0,
+                              "preconnect_hits": 0},
+                "connections": []
+            }
+            self.wfile.write(json.dumps(stats).encode('utf-8'))
         elif self.path.startswith(REMOVE_DEVICE_PATH_PREFIX):
             self.send_response(200)
             self.send_header('Content-type', 'text/plain') # Can be application/json if you want to return device details
@@ -206,6 +289,51 @@ class CustomHandler(http.server.SimpleHTTPRequestHandler):
             print(f"[{time.ctime()}] Serving static file from '{WEB_ROOT_DIR}': {self.path}")
             super().do_GET()
 
+    def do_POST(self):
+        if self.path == SCENE_PATH:
+            length = int(self.headers.get('Content-Length', 0))
+            body = json.loads(self.rfile.read(length) or b"null")
+            entries = body if isinstance(body, list) else (body or {}).get("devices")
+            if not entries:
+                self.send_response(400)
+                self.end_headers()
+                self.wfile.write(b"Error: Expected a list of devices.")
+                return
+
+            # /control parameter -> mock device field
+            fields = {"bright": "main_brightness", "warm": "main_warmness", "fan": "fan_speed",
+                      "hue": "ring_hue", "rgbValue": "ring_brightness"}
+            results = {}
+            for entry in entries:
+                address = entry.get("address", "")
+                device_config = registered_devices.get(address)
+                if device_config is None:
+                    results[address] = "not_found"
+                    continue
+                for param, field in fields.items():
+                    if param in entry:
+                        device_config[field] = int(entry[param])
+                if entry.get("mode") == "off":
+                    device_config['is_on'] = False
+                elif entry.get("mode") in ("main", "rgb"):
+                    device_config['is_on'] = True
+                    device_config['light_mode'] = entry["mode"]
+                results[address] = "ok"
+
+            devices = [{"address": address, "result": result, "was_connected": result == "ok", "connect_ms": 0,
+                        "commands": 1 if result == "ok" else 0, "done_ms": 0}
+                       for address, result in results.items()]
+            ok = sum(1 for device in devices if device["result"] == "ok")
+            self.send_response(200)
+            self.send_header('Content-type', 'application/json')
+            self.send_header('Access-Control-Allow-Origin', '*')
+            self.end_headers()
+            self.wfile.write(json.dumps({"elapsed_ms": 0, "ok": ok, "failed": len(devices) - ok, "links_opened": 0,
+                                         "commands": ok, "devices": devices}).encode('utf-8'))
+            print(f"[{time.ctime()}] Applied scene to {len(devices)} devices ({ok} ok).")
+        else:
+            self.send_error(404)
+
 # Create the server
 Handler = CustomHandler
 with socketserver.TCPServer(("", PORT), Handler) as httpd:
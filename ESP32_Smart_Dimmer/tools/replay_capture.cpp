@@ -0,0 +1,270 @@
+// Replays a Bluetooth capture (downloaded from /capture) through the command pipeline.
+//
+// Every sent packet of the capture is decoded back into its command and fed to BtCommandPipeline,
+// which talks to one SimulatedLight per captured device over a PosixTransport. Commands are fed
+// at the recorded pace or as fast as the pipeline takes them, and the replay is compared with the
+// capture, so a change in throughput or in the number of packets sent shows up offline.
+// A command always waits for the previous packet of its kind to leave the queue, so a replay that
+// falls behind sends the same packets later instead of coalescing them.
+//
+// Build and run from ESP32_Smart_Dimmer/tools:
+//   g++ -std=c++17 -O2 -DBT_CAPTURE_RECORDS=65536 -I../src -Ihost -I../../libraries/LightProtocol/src
+//       replay_capture.cpp host/*.cpp ../src/BtCommandPipeline.cpp ../src/BtTxQueue.cpp ../src/BtRxFramer.cpp
+//       ../src/BtAckTracker.cpp ../src/BtLinkPool.cpp ../src/BtShadowState.cpp ../src/BtPacer.cpp
+//       ../src/BtScanCache.cpp ../src/BtCapture.cpp ../src/BtDeviceState.cpp
+//       ../src/BtReconnectManager.cpp -pthread -o replay_capture
+//   ./replay_capture capture.bin [--max-speed] [--delay 20] [--out replay.bin]
+// --delay is the simulated lights' processing time in ms; --out saves the replay's own capture.
+#include "BtCommandPipeline.h"
+#include "CaptureFile.h"
+#include "PosixTransport.h"
+#include "SimulatedLight.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+struct CaptureSummary
+{
+    size_t tx = 0;
+    size_t rx = 0;
+    size_t perCommand[CMD_FAN_SPEED + 1] = {};
+    double seconds = 0;
+};
+
+static std::array<uint8_t, 6> deviceOf(const BtCaptureRecord &record)
+{
+    std::array<uint8_t, 6> device;
+    memcpy(device.data(), record.device, sizeof(record.device));
+    return device;
+}
+
+static CaptureSummary summarize(const std::vector<BtCaptureRecord> &records)
+{
+    CaptureSummary summary;
+    for (const BtCaptureRecord &record : records)
+    {
+        if (record.direction == (uint8_t)BtCaptureDirection::RX)
+        {
+            summary.rx++;
+            continue;
+        }
+        summary.tx++;
+        if (record.cmd <= CMD_FAN_SPEED)
+        {
+            summary.perCommand[record.cmd]++;
+        }
+    }
+    if (!records.empty())
+    {
+        summary.seconds = (records.back().timeUs - records.front().timeUs) / 1e6;
+    }
+    return summary;
+}
+
+static void printSummary(const char *title, const CaptureSummary &summary)
+{
+    printf("%-8s %5d sent, %5d received over %.2f s (%.1f packets/s)\n", title, (int)summary.tx, (int)summary.rx,
+           summary.seconds, summary.seconds > 0 ? summary.tx / summary.seconds : 0.0);
+    for (int cmd = 0; cmd <= CMD_FAN_SPEED; cmd++)
+    {
+        if (summary.perCommand[cmd] > 0)
+        {
+            printf("         %-20s %5d\n", commandTypeName((CommandType)cmd), (int)summary.perCommand[cmd]);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        printf("usage: %s capture.bin [--max-speed] [--delay ms] [--out replay.bin]\n", argv[0]);
+        return 1;
+    }
+    bool maxSpeed = false;
+    const char *outPath = nullptr;
+    SimulatedLightConfig lightConfig;
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--max-speed") == 0)
+            maxSpeed = true;
+        else if (strcmp(argv[i], "--delay") == 0 && i + 1 < argc)
+            lightConfig.processingDelayMs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            outPath = argv[++i];
+        else
+        {
+            printf("Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    BtCaptureHeader header;
+    std::vector<BtCaptureRecord> records;
+    if (!readCaptureFile(argv[1], header, records))
+    {
+        return 1;
+    }
+    if (header.overwritten > 0)
+    {
+        printf("Note: %u packets before the capture were overwritten in the ring buffer\n", header.overwritten);
+    }
+
+    std::vector<std::array<uint8_t, 6>> devices;
+    for (const BtCaptureRecord &record : records)
+    {
+        std::array<uint8_t, 6> device = deviceOf(record);
+        if (record.direction == (uint8_t)BtCaptureDirection::TX &&
+            std::find(devices.begin(), devices.end(), device) == devices.end())
+        {
+            devices.push_back(device);
+        }
+    }
+    if (devices.empty() || devices.size() > BT_LINK_POOL_CAPACITY)
+    {
+        printf("The capture sends to %d devices, 1..%d can be replayed\n", (int)devices.size(), (int)BT_LINK_POOL_CAPACITY);
+        return 1;
+    }
+
+    char directory[] = "/tmp/replay_capture.XXXXXX";
+    if (!mkdtemp(directory))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::vector<std::unique_ptr<SimulatedLight>> lights;
+    for (const auto &device : devices)
+    {
+        lights.emplace_back(new SimulatedLight(directory, device.data(), lightConfig));
+        if (!lights.back()->start())
+        {
+            return 1;
+        }
+    }
+
+    PosixTransport transport(directory);
+    BtCommandPipeline pipeline(transport, devices.size());
+    if (!pipeline.begin())
+    {
+        return 1;
+    }
+    std::thread writer(&BtCommandPipeline::runWriter, &pipeline);
+    for (const auto &device : devices)
+    {
+        pipeline.connect(device.data());
+    }
+    Clock::time_point deadline = Clock::now() + std::chrono::seconds(5);
+    while (Clock::now() < deadline &&
+           !std::all_of(devices.begin(), devices.end(), [&](const std::array<uint8_t, 6> &device)
+                        { return pipeline.isConnected(device.data()); }))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    pipeline.getCapture().clear();
+
+    std::vector<BtCompletion> lastSent(devices.size() * (CMD_FAN_SPEED + 1));
+    size_t fed = 0;
+    size_t undecodable = 0;
+    Clock::time_point start = Clock::now();
+    uint64_t firstUs = 0;
+    for (const BtCaptureRecord &record : records)
+    {
+        if (record.direction != (uint8_t)BtCaptureDirection::TX)
+        {
+            continue;
+        }
+        size_t payloadSize = record.length - LightProtocol::PAYLOAD_OFFSET - LightProtocol::SUFFIX_SIZE;
+        if (record.cmd > CMD_FAN_SPEED || record.length < LightProtocol::PAYLOAD_OFFSET + LightProtocol::SUFFIX_SIZE)
+        {
+            undecodable++;
+            continue;
+        }
+        if (fed == 0)
+        {
+            firstUs = record.timeUs;
+        }
+        size_t kind = (std::find(devices.begin(), devices.end(), deviceOf(record)) - devices.begin()) * (CMD_FAN_SPEED + 1) + record.cmd;
+        if (!maxSpeed)
+        {
+            std::this_thread::sleep_until(start + std::chrono::microseconds(record.timeUs - firstUs));
+        }
+        // Never change what is sent: a command still waiting in the queue would be coalesced with
+        // this one. At max speed this is the only wait; at the recorded pace it lets the replay fall
+        // behind instead.
+        while (lastSent[kind].state() == BtAckState::QUEUED)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        // Never overflow the queue: a rejected command would change what is sent
+        while (pipeline.getTxQueueDepth() >= BT_TX_QUEUE_CAPACITY - 1)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        lastSent[kind] = pipeline.send(record.device, (CommandType)record.cmd, record.data + LightProtocol::PAYLOAD_OFFSET, payloadSize);
+        fed++;
+    }
+
+    // Let the last packets go out and be acknowledged (or time out)
+    deadline = Clock::now() + std::chrono::milliseconds(BT_ACK_GIVE_UP_MS * 2);
+    while (Clock::now() < deadline)
+    {
+        BtAckStats acks = pipeline.getAckStats();
+        if (pipeline.getTxQueueDepth() == 0 && acks.acked + acks.timedOut + acks.dropped >= acks.tracked)
+        {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    BtTxStats tx = pipeline.getTxStats();
+    BtAckStats acks = pipeline.getAckStats();
+    BtShadowStats shadow = pipeline.getShadowStats();
+    std::vector<BtCaptureRecord> replayed;
+    {
+        BtCapture &capture = pipeline.getCapture();
+        uint32_t from, end;
+        capture.range(from, end);
+        replayed.resize(end - from);
+        replayed.resize(capture.read(from, end, replayed.data(), replayed.size()));
+    }
+    if (outPath && !writeCaptureFile(outPath, pipeline.getCapture()))
+    {
+        return 1;
+    }
+    pipeline.stop();
+    writer.join();
+    transport.stop();
+    for (auto &light : lights)
+    {
+        light->stop();
+    }
+    rmdir(directory);
+
+    CaptureSummary original = summarize(records);
+    CaptureSummary replay = summarize(replayed);
+    printf("%d devices, %s, light delay %u ms\n", (int)devices.size(), maxSpeed ? "max speed" : "recorded pace",
+           lightConfig.processingDelayMs);
+    printSummary("capture", original);
+    printSummary("replay", replay);
+    printf("commands fed       %d (%d undecodable)\n", (int)fed, (int)undecodable);
+    printf("coalesced          %u\n", tx.coalesced);
+    printf("unchanged, skipped %u\n", shadow.skipped);
+    printf("acked              %u, timed out %u, dropped %u\n", acks.acked, acks.timedOut, acks.dropped);
+    printf("retransmits        %u\n", acks.retransmits);
+    printf("elapsed            %.2f s (%.1f packets/s)\n", elapsed, tx.sent / elapsed);
+    long difference = (long)replay.tx - (long)original.tx;
+    if (difference != 0)
+    {
+        printf("replay sent %+ld packets compared to the capture\n", difference);
+    }
+    return difference == 0 ? 0 : 2;
+}
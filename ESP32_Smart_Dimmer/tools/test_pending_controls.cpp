@@ -0,0 +1,80 @@
+// Checks how /ws control frames are combined while their device's link opens (src/PendingControls.h).
+//
+// Build and run from ESP32_Smart_Dimmer/tools; exits with 1 if a check fails:
+//   g++ -std=c++17 -Wall -I../src test_pending_controls.cpp ../src/PendingControls.cpp -o test_pending_controls
+//   ./test_pending_controls
+#include "PendingControls.h"
+#include <cstdio>
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    failures += !ok;
+}
+
+static const uint8_t LIGHT[6] = {0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0x01};
+static const uint8_t OTHER[6] = {0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0x02};
+static const uint32_t CLIENT = 1;
+static const uint32_t DEADLINE = 10000;
+
+// Brightness, then warmness, while the link opens: the second frame must keep the brightness
+static void brightThenWarm()
+{
+    PendingControls pending;
+    ControlUpdate bright;
+    bright.set(CONTROL_BRIGHT, 12);
+    ControlUpdate sent = pending.combine(LIGHT, bright);
+    pending.add(LIGHT, bright, DEADLINE, CLIENT, 1);
+    check(sent.has(CONTROL_BRIGHT) && !sent.has(CONTROL_WARM), "first frame goes out as it is");
+
+    ControlUpdate warm;
+    warm.set(CONTROL_WARM, 90);
+    sent = pending.combine(LIGHT, warm);
+    pending.add(LIGHT, warm, DEADLINE + 50, CLIENT, 2);
+    check(sent.has(CONTROL_BRIGHT) && sent.get(CONTROL_BRIGHT) == 12, "second frame keeps the first frame's brightness");
+    check(sent.has(CONTROL_WARM) && sent.get(CONTROL_WARM) == 90, "second frame sets the warmness");
+
+    PendingControls::Device *device = pending.find(LIGHT);
+    check(device != nullptr, "the device waits");
+    if (!device)
+    {
+        return;
+    }
+    check(device->update.get(CONTROL_BRIGHT) == 12 && device->update.get(CONTROL_WARM) == 90,
+          "what is saved once the link is up has both fields");
+    check(device->frames.size() == 1 && device->frames[0].seq == 2, "only the client's latest frame is acked again");
+    check(device->deadlineMs == DEADLINE, "the deadline counts from the first frame");
+}
+
+// A later value of the same field wins, and devices do not mix
+static void laterWinsPerDevice()
+{
+    PendingControls pending;
+    ControlUpdate first;
+    first.set(CONTROL_BRIGHT, 3);
+    first.set(CONTROL_FAN, 1);
+    pending.add(LIGHT, first, DEADLINE, CLIENT, 1);
+    ControlUpdate second;
+    second.set(CONTROL_BRIGHT, 9);
+    pending.add(LIGHT, second, DEADLINE, CLIENT + 1, 7);
+    ControlUpdate other;
+    other.set(CONTROL_HUE, 40);
+    pending.add(OTHER, other, DEADLINE, CLIENT, 3);
+
+    PendingControls::Device *device = pending.find(LIGHT);
+    check(device && device->update.get(CONTROL_BRIGHT) == 9 && device->update.get(CONTROL_FAN) == 1,
+          "later brightness wins, the fan speed stays");
+    check(device && !device->update.has(CONTROL_HUE), "another device's fields stay out");
+    check(device && device->frames.size() == 2, "each client's frame is acked");
+    check(pending.devices().size() == 2, "one entry per device");
+}
+
+int main()
+{
+    brightThenWarm();
+    laterWinsPerDevice();
+    printf("%s\n", failures ? "FAILED" : "all passed");
+    return failures ? 1 : 0;
+}
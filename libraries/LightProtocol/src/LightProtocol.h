@@ -0,0 +1,126 @@
+#ifndef LIGHT_PROTOCOL_H
+#define LIGHT_PROTOCOL_H
+
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Packet layout of the smart light SPP protocol, shared by the ESP32_Smart_Dimmer firmware
+// and the BluetoothSmartLightControl sketch.
+//
+//   [17 byte prefix (byte 6 = function)] [4 byte data prefix] [payload] [2 byte suffix]
+//
+// Every command is a template instantiation, so everything except the payload is
+// built at compile time and encoding is a copy of a constant plus the payload bytes.
+//
+// Written in C++11: the firmware builds with gnu++17, but the Arduino IDE builds the sketch
+// with its default gnu++11.
+#if __cplusplus < 201103L
+#error "LightProtocol.h needs C++11 or later"
+#endif
+
+namespace LightProtocol
+{
+    constexpr size_t PREFIX_SIZE = 17;
+    constexpr size_t DATA_PREFIX_SIZE = 4;
+    constexpr size_t SUFFIX_SIZE = 2;
+    constexpr size_t FUNCTION_BYTE_IDX = 6;
+    constexpr size_t PAYLOAD_OFFSET = PREFIX_SIZE + DATA_PREFIX_SIZE;
+
+    constexpr uint8_t FUNCTION_DEFAULT = 0x18;
+    constexpr uint8_t FUNCTION_RGB = 0x1c;
+
+    constexpr uint8_t PREFIX[PREFIX_SIZE] = {0x01, 0xfe, 0x00, 0x00, 0x51, 0x81, FUNCTION_DEFAULT, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0d};
+    constexpr uint8_t SUFFIX[SUFFIX_SIZE] = {0x0e, 0x00};
+
+    constexpr uint8_t LIGHT_ON = 0x01;
+    constexpr uint8_t LIGHT_OFF = 0x02;
+
+    // 0, 1, ..., N - 1 as a parameter pack (std::index_sequence is C++14)
+    template <size_t... I>
+    struct Indices
+    {
+    };
+
+    template <size_t N, size_t... I>
+    struct MakeIndices : MakeIndices<N - 1, N - 1, I...>
+    {
+    };
+
+    template <size_t... I>
+    struct MakeIndices<0, I...>
+    {
+        typedef Indices<I...> Type;
+    };
+
+    // Byte i of a packet with a zeroed payload; one expression, as C++11 constexpr functions are
+    template <size_t PacketSize, uint8_t Function, uint8_t D0, uint8_t D1, uint8_t D2, uint8_t D3>
+    constexpr uint8_t templateByte(size_t i)
+    {
+        return i == FUNCTION_BYTE_IDX ? Function
+               : i < PREFIX_SIZE ? PREFIX[i]
+               : i == PREFIX_SIZE ? D0
+               : i == PREFIX_SIZE + 1 ? D1
+               : i == PREFIX_SIZE + 2 ? D2
+               : i == PREFIX_SIZE + 3 ? D3
+               : i >= PacketSize - SUFFIX_SIZE ? SUFFIX[i - (PacketSize - SUFFIX_SIZE)]
+               : 0;
+    }
+
+    template <size_t PacketSize, uint8_t Function, uint8_t D0, uint8_t D1, uint8_t D2, uint8_t D3, size_t... I>
+    constexpr std::array<uint8_t, PacketSize> makeTemplate(Indices<I...>)
+    {
+        return std::array<uint8_t, PacketSize>{{templateByte<PacketSize, Function, D0, D1, D2, D3>(I)...}};
+    }
+
+    template <uint8_t Function, uint8_t D0, uint8_t D1, uint8_t D2, uint8_t D3, size_t PayloadSize>
+    struct Command
+    {
+        static constexpr size_t PAYLOAD_SIZE = PayloadSize;
+        static constexpr size_t PACKET_SIZE = PAYLOAD_OFFSET + PayloadSize + SUFFIX_SIZE;
+        using Packet = std::array<uint8_t, PACKET_SIZE>;
+        using AllIndices = typename MakeIndices<PACKET_SIZE>::Type;
+
+        // The packet with a zeroed payload
+        static constexpr Packet TEMPLATE = makeTemplate<PACKET_SIZE, Function, D0, D1, D2, D3>(AllIndices());
+
+        static constexpr Packet encode(const uint8_t (&payload)[PayloadSize])
+        {
+            return encode(payload, AllIndices());
+        }
+
+        // Writes the packet into out (at least PACKET_SIZE bytes) and returns its size
+        static size_t encodeInto(uint8_t *out, const uint8_t *payload)
+        {
+            memcpy(out, TEMPLATE.data(), PACKET_SIZE);
+            memcpy(out + PAYLOAD_OFFSET, payload, PayloadSize);
+            return PACKET_SIZE;
+        }
+
+    private:
+        template <size_t... I>
+        static constexpr Packet encode(const uint8_t (&payload)[PayloadSize], Indices<I...>)
+        {
+            return Packet{{(I >= PAYLOAD_OFFSET && I < PAYLOAD_OFFSET + PayloadSize
+                                ? payload[I - PAYLOAD_OFFSET]
+                                : templateByte<PACKET_SIZE, Function, D0, D1, D2, D3>(I))...}};
+        }
+    };
+
+#if __cplusplus < 201703L
+    // Before C++17 a static constexpr member that is used (TEMPLATE.data()) also needs a definition
+    template <uint8_t Function, uint8_t D0, uint8_t D1, uint8_t D2, uint8_t D3, size_t PayloadSize>
+    constexpr typename Command<Function, D0, D1, D2, D3, PayloadSize>::Packet Command<Function, D0, D1, D2, D3, PayloadSize>::TEMPLATE;
+#endif
+
+    using OnOff = Command<FUNCTION_DEFAULT, 0x07, 0x01, 0x03, 0x01, 1>;     // payload: LIGHT_ON / LIGHT_OFF
+    using Intensity = Command<FUNCTION_DEFAULT, 0x07, 0x01, 0x03, 0x02, 1>; // payload: intensity
+    using Warmness = Command<FUNCTION_DEFAULT, 0x07, 0x01, 0x03, 0x03, 1>;  // payload: warmness
+    using Rgb = Command<FUNCTION_RGB, 0x0A, 0x02, 0x03, 0x0C, 4>;           // payload: I R G B
+    using FanSpeed = Command<FUNCTION_DEFAULT, 0x07, 0x0e, 0x03, 0x03, 1>;  // payload: fan speed (0-3)
+
+    constexpr size_t MAX_PACKET_SIZE = Rgb::PACKET_SIZE;
+}
+
+#endif // LIGHT_PROTOCOL_H